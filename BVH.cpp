@@ -0,0 +1,263 @@
+#include "BVH.hpp"
+
+#include <algorithm>
+#include <cfloat>
+
+namespace gps {
+
+	//centroid bins per axis evaluated for each split
+	static const int SAH_BINS = 12;
+	//cost of visiting a node relative to testing one item
+	static const float TRAVERSAL_COST = 1.0f;
+	//a node at this depth becomes a leaf, each level needs at most one more slot on the traversal stack
+	static const int MAX_DEPTH = BVH_STACK_SIZE - 2;
+
+	static float surfaceArea(const glm::vec3& boxMin, const glm::vec3& boxMax)
+	{
+		glm::vec3 extent = boxMax - boxMin;
+		if (extent.x < 0.0f || extent.y < 0.0f || extent.z < 0.0f) {
+			return 0.0f;
+		}
+		return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+	}
+
+	BVH::BVH() : builtArea(0.0f)
+	{
+	}
+
+	void BVH::build(const std::vector<BVHBox>& boxes)
+	{
+		nodes.clear();
+		items.clear();
+		itemBoxes = boxes;
+		if (boxes.empty()) {
+			return;
+		}
+
+		std::vector<glm::vec3> centroids(boxes.size());
+		items.resize(boxes.size());
+		for (size_t i = 0; i < boxes.size(); i++) {
+			centroids[i] = (boxes[i].min + boxes[i].max) * 0.5f;
+			items[i] = (uint32_t)i;
+		}
+
+		//a binary tree with n leaves has 2n - 1 nodes
+		nodes.reserve(2 * boxes.size() - 1);
+		BVHNode root;
+		root.leftOrFirst = 0;
+		root.count = (uint32_t)boxes.size();
+		nodes.push_back(root);
+		updateNodeBounds(0);
+		subdivide(0, 0, centroids);
+		builtArea = getNodeArea();
+	}
+
+	void BVH::refit(const std::vector<BVHBox>& boxes)
+	{
+		if (boxes.size() != itemBoxes.size()) {
+			build(boxes);
+			return;
+		}
+		itemBoxes = boxes;
+
+		//children always come after their parent, so walking backwards finishes them first
+		for (size_t i = nodes.size(); i-- > 0;) {
+			BVHNode& node = nodes[i];
+			if (node.count > 0) {
+				updateNodeBounds((uint32_t)i);
+			}
+			else {
+				const BVHNode& left = nodes[node.leftOrFirst];
+				const BVHNode& right = nodes[node.leftOrFirst + 1];
+				node.min = glm::min(left.min, right.min);
+				node.max = glm::max(left.max, right.max);
+			}
+		}
+	}
+
+	bool BVH::update(const std::vector<BVHBox>& boxes)
+	{
+		if (boxes.size() != itemBoxes.size()) {
+			build(boxes);
+			return true;
+		}
+
+		//the SAH cost of the tree grows with the area of its nodes
+		refit(boxes);
+		if (getNodeArea() > REBUILD_AREA_RATIO * builtArea) {
+			build(boxes);
+			return true;
+		}
+		return false;
+	}
+
+	float BVH::getNodeArea() const
+	{
+		float area = 0.0f;
+		for (size_t i = 0; i < nodes.size(); i++) {
+			area += surfaceArea(nodes[i].min, nodes[i].max);
+		}
+		return area;
+	}
+
+	void BVH::updateNodeBounds(uint32_t nodeIndex)
+	{
+		BVHNode& node = nodes[nodeIndex];
+		node.min = glm::vec3(FLT_MAX);
+		node.max = glm::vec3(-FLT_MAX);
+		for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+			const BVHBox& box = itemBoxes[items[i]];
+			node.min = glm::min(node.min, box.min);
+			node.max = glm::max(node.max, box.max);
+		}
+	}
+
+	void BVH::subdivide(uint32_t nodeIndex, int depth, const std::vector<glm::vec3>& centroids)
+	{
+		uint32_t first = nodes[nodeIndex].leftOrFirst;
+		uint32_t count = nodes[nodeIndex].count;
+		if (count <= MAX_LEAF_ITEMS || depth >= MAX_DEPTH) {
+			return;
+		}
+
+		//bin the centroids along each axis and sweep the bins for the cheapest split plane
+		glm::vec3 centroidMin(FLT_MAX);
+		glm::vec3 centroidMax(-FLT_MAX);
+		for (uint32_t i = first; i < first + count; i++) {
+			centroidMin = glm::min(centroidMin, centroids[items[i]]);
+			centroidMax = glm::max(centroidMax, centroids[items[i]]);
+		}
+
+		int bestAxis = -1;
+		int bestBin = 0;
+		float bestCost = FLT_MAX;
+		for (int axis = 0; axis < 3; axis++) {
+			float extent = centroidMax[axis] - centroidMin[axis];
+			if (extent <= 0.0f) {
+				continue;
+			}
+			float binScale = SAH_BINS / extent;
+
+			glm::vec3 binMin[SAH_BINS];
+			glm::vec3 binMax[SAH_BINS];
+			uint32_t binCount[SAH_BINS];
+			for (int b = 0; b < SAH_BINS; b++) {
+				binMin[b] = glm::vec3(FLT_MAX);
+				binMax[b] = glm::vec3(-FLT_MAX);
+				binCount[b] = 0;
+			}
+			for (uint32_t i = first; i < first + count; i++) {
+				uint32_t item = items[i];
+				int b = std::min(SAH_BINS - 1, (int)((centroids[item][axis] - centroidMin[axis]) * binScale));
+				binMin[b] = glm::min(binMin[b], itemBoxes[item].min);
+				binMax[b] = glm::max(binMax[b], itemBoxes[item].max);
+				binCount[b]++;
+			}
+
+			//areas and counts left of each plane from a forward sweep, right of it from a backward one
+			float leftArea[SAH_BINS - 1];
+			uint32_t leftCount[SAH_BINS - 1];
+			glm::vec3 sweepMin(FLT_MAX);
+			glm::vec3 sweepMax(-FLT_MAX);
+			uint32_t sweepCount = 0;
+			for (int b = 0; b < SAH_BINS - 1; b++) {
+				sweepMin = glm::min(sweepMin, binMin[b]);
+				sweepMax = glm::max(sweepMax, binMax[b]);
+				sweepCount += binCount[b];
+				leftArea[b] = surfaceArea(sweepMin, sweepMax);
+				leftCount[b] = sweepCount;
+			}
+			sweepMin = glm::vec3(FLT_MAX);
+			sweepMax = glm::vec3(-FLT_MAX);
+			sweepCount = 0;
+			for (int b = SAH_BINS - 1; b > 0; b--) {
+				sweepMin = glm::min(sweepMin, binMin[b]);
+				sweepMax = glm::max(sweepMax, binMax[b]);
+				sweepCount += binCount[b];
+				if (leftCount[b - 1] == 0 || sweepCount == 0) {
+					continue;
+				}
+				float cost = leftCount[b - 1] * leftArea[b - 1] + sweepCount * surfaceArea(sweepMin, sweepMax);
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = b;
+				}
+			}
+		}
+
+		//keep the leaf when no split beats testing every item in it
+		BVHNode& node = nodes[nodeIndex];
+		float parentArea = surfaceArea(node.min, node.max);
+		if (bestAxis < 0 || TRAVERSAL_COST * parentArea + bestCost >= count * parentArea) {
+			return;
+		}
+
+		float splitPosition = centroidMin[bestAxis] + bestBin * (centroidMax[bestAxis] - centroidMin[bestAxis]) / SAH_BINS;
+		uint32_t* begin = &items[first];
+		uint32_t* middle = std::partition(begin, begin + count, [&](uint32_t item) {
+			return centroids[item][bestAxis] < splitPosition;
+		});
+		uint32_t leftItems = (uint32_t)(middle - begin);
+		if (leftItems == 0 || leftItems == count) {
+			return;
+		}
+
+		uint32_t leftIndex = (uint32_t)nodes.size();
+		BVHNode left;
+		left.leftOrFirst = first;
+		left.count = leftItems;
+		BVHNode right;
+		right.leftOrFirst = first + leftItems;
+		right.count = count - leftItems;
+		//push_back may move the array, the node reference above is not used past this point
+		nodes.push_back(left);
+		nodes.push_back(right);
+		nodes[nodeIndex].leftOrFirst = leftIndex;
+		nodes[nodeIndex].count = 0;
+
+		updateNodeBounds(leftIndex);
+		updateNodeBounds(leftIndex + 1);
+		subdivide(leftIndex, depth + 1, centroids);
+		subdivide(leftIndex + 1, depth + 1, centroids);
+	}
+
+	size_t BVH::getItemCount() const
+	{
+		return itemBoxes.size();
+	}
+
+	size_t BVH::getNodeCount() const
+	{
+		return nodes.size();
+	}
+
+	const std::vector<BVHNode>& BVH::getNodes() const
+	{
+		return nodes;
+	}
+
+	bool BVH::intersectRay(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec3& origin,
+		const glm::vec3& inverseDirection, float maxDistance, float& entryDistance)
+	{
+		float enter = 0.0f;
+		float exit = maxDistance;
+		for (int axis = 0; axis < 3; axis++) {
+			float t0 = (boxMin[axis] - origin[axis]) * inverseDirection[axis];
+			float t1 = (boxMax[axis] - origin[axis]) * inverseDirection[axis];
+			//nan when the ray runs inside a slab plane, the comparisons below then leave the range alone
+			enter = std::max(enter, std::min(t0, t1));
+			exit = std::min(exit, std::max(t0, t1));
+		}
+		entryDistance = enter;
+		return enter <= exit;
+	}
+
+	bool BVH::overlaps(const glm::vec3& aMin, const glm::vec3& aMax, const glm::vec3& bMin, const glm::vec3& bMax)
+	{
+		return aMin.x <= bMax.x && aMax.x >= bMin.x &&
+			aMin.y <= bMax.y && aMax.y >= bMin.y &&
+			aMin.z <= bMax.z && aMax.z >= bMin.z;
+	}
+
+}
@@ -0,0 +1,194 @@
+#ifndef BVH_hpp
+#define BVH_hpp
+
+#include "Frustum.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+// World-space box of one item in a BVH
+struct BVHBox
+{
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+// 32 byte node, the two children of an interior node are stored next to each other
+struct BVHNode
+{
+    glm::vec3 min;
+    // interior: index of the left child, leaf: first entry in the item list
+    uint32_t leftOrFirst;
+    glm::vec3 max;
+    // 0 for interior nodes
+    uint32_t count;
+};
+
+// Bounding volume hierarchy over item boxes, built with the surface area heuristic
+// and flattened depth-first into one array. Items are identified by their index in the box list.
+class BVH
+{
+public:
+    // a node with at most this many items is never split
+    static const uint32_t MAX_LEAF_ITEMS = 2;
+    // update rebuilds once the refit nodes cover this many times their area after the last build
+    static const int REBUILD_AREA_RATIO = 2;
+
+    BVH();
+
+    // Builds the tree from scratch
+    void build(const std::vector<BVHBox>& boxes);
+
+    // Moves the items to new boxes and grows or shrinks the nodes around them, keeping the tree
+    // shape; rebuild instead when items travel far. boxes must have as many entries as the build.
+    void refit(const std::vector<BVHBox>& boxes);
+
+    // Refits, or rebuilds when items have travelled far enough to stretch the nodes above them
+    // past REBUILD_AREA_RATIO; builds on the first call. Returns true when it rebuilt.
+    bool update(const std::vector<BVHBox>& boxes);
+
+    // Calls visit(item) for every item whose box touches the frustum
+    template <class Visitor>
+    void queryFrustum(const Frustum& frustum, Visitor visit) const;
+
+    // Calls visit(item) for every item whose box overlaps [boxMin, boxMax]
+    template <class Visitor>
+    void queryBox(const glm::vec3& boxMin, const glm::vec3& boxMax, Visitor visit) const;
+
+    // Calls visit(item, entryDistance) for every item whose box the ray enters before maxDistance
+    template <class Visitor>
+    void queryRay(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, Visitor visit) const;
+
+    size_t getItemCount() const;
+    size_t getNodeCount() const;
+    const std::vector<BVHNode>& getNodes() const;
+
+    // Distance along the ray where it enters the box, false if it misses it before maxDistance
+    static bool intersectRay(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec3& origin,
+        const glm::vec3& inverseDirection, float maxDistance, float& entryDistance);
+
+private:
+    std::vector<BVHNode> nodes;
+    // item indices, each leaf owns a contiguous range
+    std::vector<uint32_t> items;
+    std::vector<BVHBox> itemBoxes;
+    // summed surface area of the nodes right after the last build
+    float builtArea;
+
+    void updateNodeBounds(uint32_t nodeIndex);
+    float getNodeArea() const;
+    void subdivide(uint32_t nodeIndex, int depth, const std::vector<glm::vec3>& centroids);
+
+    static bool overlaps(const glm::vec3& aMin, const glm::vec3& aMax, const glm::vec3& bMin, const glm::vec3& bMax);
+};
+
+// the build stops splitting below this depth, so the fixed traversal stacks never overflow
+const int BVH_STACK_SIZE = 64;
+
+template <class Visitor>
+void BVH::queryFrustum(const Frustum& frustum, Visitor visit) const
+{
+    if (nodes.empty())
+        return;
+
+    uint32_t stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const BVHNode& node = nodes[stack[--top]];
+        if (!frustum.intersectsBox(node.min, node.max))
+            continue;
+
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+            {
+                const BVHBox& box = itemBoxes[items[i]];
+                if (node.count == 1 || frustum.intersectsBox(box.min, box.max))
+                    visit(items[i]);
+            }
+        }
+        else
+        {
+            stack[top++] = node.leftOrFirst + 1;
+            stack[top++] = node.leftOrFirst;
+        }
+    }
+}
+
+template <class Visitor>
+void BVH::queryBox(const glm::vec3& boxMin, const glm::vec3& boxMax, Visitor visit) const
+{
+    if (nodes.empty())
+        return;
+
+    uint32_t stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const BVHNode& node = nodes[stack[--top]];
+        if (!overlaps(node.min, node.max, boxMin, boxMax))
+            continue;
+
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+            {
+                const BVHBox& box = itemBoxes[items[i]];
+                if (overlaps(box.min, box.max, boxMin, boxMax))
+                    visit(items[i]);
+            }
+        }
+        else
+        {
+            stack[top++] = node.leftOrFirst + 1;
+            stack[top++] = node.leftOrFirst;
+        }
+    }
+}
+
+template <class Visitor>
+void BVH::queryRay(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, Visitor visit) const
+{
+    if (nodes.empty())
+        return;
+
+    //division by a zero component gives an infinity, which the slab test handles
+    glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+    uint32_t stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const BVHNode& node = nodes[stack[--top]];
+        float entryDistance;
+        if (!intersectRay(node.min, node.max, origin, inverseDirection, maxDistance, entryDistance))
+            continue;
+
+        if (node.count > 0)
+        {
+            for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+            {
+                const BVHBox& box = itemBoxes[items[i]];
+                if (intersectRay(box.min, box.max, origin, inverseDirection, maxDistance, entryDistance))
+                    visit(items[i], entryDistance);
+            }
+        }
+        else
+        {
+            stack[top++] = node.leftOrFirst + 1;
+            stack[top++] = node.leftOrFirst;
+        }
+    }
+}
+
+}
+
+#endif /* BVH_hpp */
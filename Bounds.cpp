@@ -0,0 +1,52 @@
+#include "Bounds.hpp"
+
+#include <cmath>
+
+namespace gps {
+
+	Bounds::Bounds() : min(1.0f), max(-1.0f), center(0.0f), radius(0.0f)
+	{
+	}
+
+	bool Bounds::isEmpty() const
+	{
+		return min.x > max.x;
+	}
+
+	void Bounds::merge(const Bounds& other)
+	{
+		if (other.isEmpty()) {
+			return;
+		}
+		if (isEmpty()) {
+			*this = other;
+			return;
+		}
+
+		glm::vec3 oldCenter = center;
+		float oldRadius = radius;
+
+		min = glm::min(min, other.min);
+		max = glm::max(max, other.max);
+
+		//centred on the merged box, large enough for both old spheres
+		center = (min + max) * 0.5f;
+		radius = glm::max(glm::length(oldCenter - center) + oldRadius, glm::length(other.center - center) + other.radius);
+	}
+
+	void Bounds::worldBox(const glm::mat4& model, glm::vec3& worldMin, glm::vec3& worldMax) const
+	{
+		//centre moved by the matrix, half extent grown by the absolute value of its rotation and scale
+		glm::vec3 boxCenter = glm::vec3(model * glm::vec4((min + max) * 0.5f, 1.0f));
+		glm::vec3 halfExtent = (max - min) * 0.5f;
+		glm::vec3 worldExtent(0.0f);
+		for (int column = 0; column < 3; column++) {
+			for (int row = 0; row < 3; row++) {
+				worldExtent[row] += std::fabs(model[column][row]) * halfExtent[column];
+			}
+		}
+		worldMin = boxCenter - worldExtent;
+		worldMax = boxCenter + worldExtent;
+	}
+
+}
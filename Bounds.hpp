@@ -0,0 +1,30 @@
+#ifndef Bounds_hpp
+#define Bounds_hpp
+
+#include <glm/glm.hpp>
+
+namespace gps {
+
+// Axis aligned box and enclosing sphere of an object, in its own space
+struct Bounds
+{
+    glm::vec3 min;
+    glm::vec3 max;
+    glm::vec3 center;
+    float radius;
+
+    // Empty bounds, merging anything into them gives the other bounds
+    Bounds();
+
+    bool isEmpty() const;
+
+    // Box around both boxes and a sphere around both spheres
+    void merge(const Bounds& other);
+
+    // World axis aligned box around the box placed by model
+    void worldBox(const glm::mat4& model, glm::vec3& worldMin, glm::vec3& worldMax) const;
+};
+
+}
+
+#endif /* Bounds_hpp */
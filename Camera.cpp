@@ -21,6 +21,14 @@ namespace gps {
 		return view;
 	}
 
+	glm::vec3 Camera::getPosition() {
+		return cameraPosition;
+	}
+
+	void Camera::setPosition(glm::vec3 cameraPosition) {
+		this->cameraPosition = cameraPosition;
+	}
+
 	//update the camera internal parameters following a camera move event
 	void Camera::move(MOVE_DIRECTION direction, float speed) {
 
@@ -0,0 +1,114 @@
+#include "CameraTrack.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+	CameraTrack::CameraTrack(const std::vector<glm::vec3>& controlPoints, bool closed, int samplesPerSegment)
+		: controlPoints(controlPoints), closed(closed), samplesPerSegment(samplesPerSegment > 0 ? samplesPerSegment : 1)
+	{
+		int segmentCount = getSegmentCount();
+		arcLengths.push_back(0.0f);
+		if (segmentCount == 0) {
+			return;
+		}
+
+		glm::vec3 previous = evaluate(0, 0.0f);
+		for (int segment = 0; segment < segmentCount; segment++) {
+			for (int sample = 1; sample <= this->samplesPerSegment; sample++) {
+				glm::vec3 current = evaluate(segment, (float)sample / this->samplesPerSegment);
+				arcLengths.push_back(arcLengths.back() + glm::length(current - previous));
+				previous = current;
+			}
+		}
+	}
+
+	int CameraTrack::getSegmentCount() const
+	{
+		int count = (int)controlPoints.size();
+		if (count < 2) {
+			return 0;
+		}
+		return closed ? count : count - 1;
+	}
+
+	glm::vec3 CameraTrack::getControlPoint(int index) const
+	{
+		int count = (int)controlPoints.size();
+		if (closed) {
+			return controlPoints[((index % count) + count) % count];
+		}
+
+		//mirror the neighbour past the ends so the track starts and stops heading straight
+		if (index < 0) {
+			return 2.0f * controlPoints[0] - controlPoints[1];
+		}
+		if (index >= count) {
+			return 2.0f * controlPoints[count - 1] - controlPoints[count - 2];
+		}
+		return controlPoints[index];
+	}
+
+	glm::vec3 CameraTrack::evaluate(int segment, float t) const
+	{
+		glm::vec3 p0 = getControlPoint(segment - 1);
+		glm::vec3 p1 = getControlPoint(segment);
+		glm::vec3 p2 = getControlPoint(segment + 1);
+		glm::vec3 p3 = getControlPoint(segment + 2);
+
+		float t2 = t * t;
+		float t3 = t2 * t;
+
+		return 0.5f * ((2.0f * p1) +
+			(p2 - p0) * t +
+			(2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 +
+			(3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+	}
+
+	float CameraTrack::getLength() const
+	{
+		return arcLengths.back();
+	}
+
+	glm::vec3 CameraTrack::positionAt(float distance) const
+	{
+		if (controlPoints.empty()) {
+			return glm::vec3(0.0f);
+		}
+		if (getSegmentCount() == 0 || getLength() <= 0.0f) {
+			return controlPoints[0];
+		}
+
+		float length = getLength();
+		if (closed) {
+			distance = std::fmod(distance, length);
+			if (distance < 0.0f) {
+				distance += length;
+			}
+		}
+		else {
+			distance = std::min(std::max(distance, 0.0f), length);
+		}
+
+		//first sample at or past the distance, then interpolate the spline parameter between it and the previous sample
+		size_t upper = std::lower_bound(arcLengths.begin(), arcLengths.end(), distance) - arcLengths.begin();
+		if (upper == 0) {
+			return evaluate(0, 0.0f);
+		}
+		if (upper >= arcLengths.size()) {
+			upper = arcLengths.size() - 1;
+		}
+
+		size_t lower = upper - 1;
+		float span = arcLengths[upper] - arcLengths[lower];
+		float fraction = span > 0.0f ? (distance - arcLengths[lower]) / span : 0.0f;
+
+		float sample = (float)lower + fraction;
+		int segment = std::min((int)(sample / samplesPerSegment), getSegmentCount() - 1);
+		float t = (sample - (float)segment * samplesPerSegment) / samplesPerSegment;
+
+		return evaluate(segment, t);
+	}
+
+}
@@ -0,0 +1,39 @@
+#ifndef CameraTrack_hpp
+#define CameraTrack_hpp
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+// Catmull-Rom spline through camera control points, sampled by distance travelled along it
+class CameraTrack
+{
+public:
+    // A closed track joins the last control point back to the first one.
+    // samplesPerSegment sets the resolution of the arc length table.
+    CameraTrack(const std::vector<glm::vec3>& controlPoints, bool closed, int samplesPerSegment = 32);
+
+    // Length of the whole track
+    float getLength() const;
+
+    // Point at the given distance from the start, wrapped on closed tracks and clamped on open ones
+    glm::vec3 positionAt(float distance) const;
+
+private:
+    std::vector<glm::vec3> controlPoints;
+    bool closed;
+    int samplesPerSegment;
+    // arc length from the start to each sample, samplesPerSegment per segment plus the end point
+    std::vector<float> arcLengths;
+
+    int getSegmentCount() const;
+    glm::vec3 getControlPoint(int index) const;
+    // t in [0, 1] within the segment from control point segment to segment + 1
+    glm::vec3 evaluate(int segment, float t) const;
+};
+
+}
+
+#endif /* CameraTrack_hpp */
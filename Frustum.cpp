@@ -0,0 +1,71 @@
+#include "Frustum.hpp"
+
+#include <cmath>
+
+namespace gps {
+
+	Frustum::Frustum(const glm::mat4& viewProjection)
+	{
+		//rows of the column-major matrix
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; i++) {
+			rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+		}
+
+		//left, right, bottom, top, near, far
+		for (int i = 0; i < 3; i++) {
+			planes[2 * i] = rows[3] + rows[i];
+			planes[2 * i + 1] = rows[3] - rows[i];
+		}
+
+		for (int i = 0; i < 6; i++) {
+			float length = glm::length(glm::vec3(planes[i]));
+			planes[i] = planes[i] / length;
+		}
+	}
+
+	bool Frustum::intersectsSphere(const glm::vec3& center, float radius) const
+	{
+		for (int i = 0; i < 6; i++) {
+			if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool Frustum::intersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+	{
+		for (int i = 0; i < 6; i++) {
+			//the corner furthest along the normal decides, if it is outside the whole box is
+			glm::vec3 normal = glm::vec3(planes[i]);
+			glm::vec3 corner(normal.x >= 0.0f ? boxMax.x : boxMin.x,
+				normal.y >= 0.0f ? boxMax.y : boxMin.y,
+				normal.z >= 0.0f ? boxMax.z : boxMin.z);
+			if (glm::dot(normal, corner) + planes[i].w < 0.0f) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool Frustum::intersects(const Bounds& bounds, const glm::mat4& model) const
+	{
+		if (bounds.isEmpty()) {
+			return false;
+		}
+
+		//the largest axis scale keeps the sphere enclosing under non-uniform scaling
+		float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		glm::vec3 center = glm::vec3(model * glm::vec4(bounds.center, 1.0f));
+		if (!intersectsSphere(center, bounds.radius * scale)) {
+			return false;
+		}
+
+		glm::vec3 worldMin;
+		glm::vec3 worldMax;
+		bounds.worldBox(model, worldMin, worldMax);
+		return intersectsBox(worldMin, worldMax);
+	}
+
+}
@@ -0,0 +1,40 @@
+#ifndef Frustum_hpp
+#define Frustum_hpp
+
+#include "Bounds.hpp"
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+namespace gps {
+
+// Objects a pass tested against its frustum, drawn and skipped
+struct CullStats
+{
+    GLuint visible;
+    GLuint culled;
+
+    CullStats() : visible(0), culled(0) {}
+};
+
+// The six planes of a view-projection volume, in world space when built from projection * view
+class Frustum
+{
+public:
+    // Planes taken from the rows of the matrix (Gribb-Hartmann), works for perspective and ortho projections
+    explicit Frustum(const glm::mat4& viewProjection);
+
+    bool intersectsSphere(const glm::vec3& center, float radius) const;
+    bool intersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const;
+
+    // Object-space bounds placed in the world by model: sphere test first, then the box it spans
+    bool intersects(const Bounds& bounds, const glm::mat4& model) const;
+
+private:
+    // xyz is the unit normal pointing inside, w the offset: inside when dot(normal, p) + w >= 0
+    glm::vec4 planes[6];
+};
+
+}
+
+#endif /* Frustum_hpp */
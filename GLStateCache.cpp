@@ -0,0 +1,112 @@
+#include "GLStateCache.hpp"
+
+namespace gps {
+
+	// no object has this name, used for "state not known"
+	static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+	GLuint GLStateCache::issuedCalls = 0;
+	GLuint GLStateCache::skippedCalls = 0;
+
+	GLuint GLStateCache::currentProgram = UNKNOWN;
+	GLuint GLStateCache::currentVertexArray = UNKNOWN;
+	GLuint GLStateCache::currentUnit = UNKNOWN;
+	GLuint GLStateCache::boundTextures[GLStateCache::MAX_TEXTURE_UNITS] = {
+		UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN,
+		UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN,
+		UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN,
+		UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN
+	};
+
+	void GLStateCache::useProgram(GLuint program)
+	{
+		if (currentProgram == program) {
+			skippedCalls++;
+			return;
+		}
+
+		glUseProgram(program);
+		currentProgram = program;
+		issuedCalls++;
+	}
+
+	void GLStateCache::bindVertexArray(GLuint vertexArray)
+	{
+		if (currentVertexArray == vertexArray) {
+			skippedCalls++;
+			return;
+		}
+
+		glBindVertexArray(vertexArray);
+		currentVertexArray = vertexArray;
+		issuedCalls++;
+	}
+
+	void GLStateCache::activeTexture(GLuint unit)
+	{
+		if (currentUnit == unit) {
+			skippedCalls++;
+			return;
+		}
+
+		glActiveTexture(GL_TEXTURE0 + unit);
+		currentUnit = unit;
+		issuedCalls++;
+	}
+
+	void GLStateCache::bindTexture2D(GLuint unit, GLuint texture)
+	{
+		if (unit >= MAX_TEXTURE_UNITS) {
+			glActiveTexture(GL_TEXTURE0 + unit);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			currentUnit = UNKNOWN;
+			issuedCalls += 2;
+			return;
+		}
+
+		if (boundTextures[unit] == texture) {
+			skippedCalls++;
+			return;
+		}
+
+		activeTexture(unit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		boundTextures[unit] = texture;
+		issuedCalls++;
+	}
+
+	void GLStateCache::forgetProgram(GLuint program)
+	{
+		if (currentProgram == program) {
+			currentProgram = UNKNOWN;
+		}
+	}
+
+	void GLStateCache::forgetVertexArray(GLuint vertexArray)
+	{
+		if (currentVertexArray == vertexArray) {
+			currentVertexArray = UNKNOWN;
+		}
+	}
+
+	void GLStateCache::forgetTexture(GLuint texture)
+	{
+		//deleting a bound texture reverts the binding to 0, a reused name must not look bound
+		for (GLuint i = 0; i < MAX_TEXTURE_UNITS; i++) {
+			if (boundTextures[i] == texture) {
+				boundTextures[i] = UNKNOWN;
+			}
+		}
+	}
+
+	void GLStateCache::invalidate()
+	{
+		currentProgram = UNKNOWN;
+		currentVertexArray = UNKNOWN;
+		currentUnit = UNKNOWN;
+		for (GLuint i = 0; i < MAX_TEXTURE_UNITS; i++) {
+			boundTextures[i] = UNKNOWN;
+		}
+	}
+
+}
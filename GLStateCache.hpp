@@ -0,0 +1,43 @@
+#ifndef GLStateCache_hpp
+#define GLStateCache_hpp
+
+#include <GL/glew.h>
+
+namespace gps {
+
+// Tracks the bound program, vertex array, active texture unit and 2D texture
+// bindings, and drops calls that would not change any of them.
+// Code that binds these objects with raw GL calls must call invalidate().
+class GLStateCache
+{
+public:
+    static const GLuint MAX_TEXTURE_UNITS = 32;
+
+    static void useProgram(GLuint program);
+    static void bindVertexArray(GLuint vertexArray);
+    // unit is an index, not a GL_TEXTUREi enum
+    static void activeTexture(GLuint unit);
+    static void bindTexture2D(GLuint unit, GLuint texture);
+
+    // Must be called before deleting an object the cache may think is bound
+    static void forgetProgram(GLuint program);
+    static void forgetVertexArray(GLuint vertexArray);
+    static void forgetTexture(GLuint texture);
+
+    // Forgets everything, the next bind of each kind is always issued
+    static void invalidate();
+
+    // calls passed on to GL / dropped as redundant since the last reset
+    static GLuint issuedCalls;
+    static GLuint skippedCalls;
+
+private:
+    static GLuint currentProgram;
+    static GLuint currentVertexArray;
+    static GLuint currentUnit;
+    static GLuint boundTextures[MAX_TEXTURE_UNITS];
+};
+
+}
+
+#endif /* GLStateCache_hpp */
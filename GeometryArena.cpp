@@ -0,0 +1,167 @@
+#include "GeometryArena.hpp"
+#include "GLStateCache.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+	GeometryArena::GeometryArena() : drawIndexBuffer(0), shortVertexArray(0), intVertexArray(0)
+	{
+		vertices = Pool();
+		shortIndices = Pool();
+		intIndices = Pool();
+	}
+
+	void GeometryArena::initPool(Pool& pool, GLuint capacity, GLuint elementSize)
+	{
+		pool.capacity = capacity;
+		pool.used = 0;
+		pool.elementSize = elementSize;
+		glGenBuffers(1, &pool.buffer);
+		//the copy targets are used for every upload so no vertex array's element buffer is touched
+		glBindBuffer(GL_COPY_WRITE_BUFFER, pool.buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)capacity * elementSize, NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	void GeometryArena::init(GLuint vertexCapacity, GLuint indexCapacity)
+	{
+		initPool(vertices, vertexCapacity, sizeof(Vertex));
+		initPool(shortIndices, indexCapacity, sizeof(GLushort));
+		initPool(intIndices, indexCapacity / 4, sizeof(GLuint));
+
+		//entry i holds i, so an instanced draw with base instance i reads i
+		std::vector<GLuint> drawIndices(MAX_DRAW_INDICES);
+		for (GLuint i = 0; i < MAX_DRAW_INDICES; i++) {
+			drawIndices[i] = i;
+		}
+		glGenBuffers(1, &drawIndexBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, drawIndexBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, MAX_DRAW_INDICES * sizeof(GLuint), drawIndices.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		shortVertexArray = createVertexArray(GL_UNSIGNED_SHORT);
+		intVertexArray = createVertexArray(GL_UNSIGNED_INT);
+	}
+
+	void GeometryArena::reserve(Pool& pool, GLuint count)
+	{
+		if (pool.used + count <= pool.capacity) {
+			return;
+		}
+
+		GLuint capacity = pool.capacity > 0 ? pool.capacity * 2 : count;
+		while (capacity < pool.used + count) {
+			capacity *= 2;
+		}
+
+		//park the used part in a temporary buffer, reallocate the same name and copy it back
+		GLsizeiptr usedBytes = (GLsizeiptr)pool.used * pool.elementSize;
+		GLuint temporary;
+		glGenBuffers(1, &temporary);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, temporary);
+		glBufferData(GL_COPY_WRITE_BUFFER, usedBytes, NULL, GL_STREAM_COPY);
+		glBindBuffer(GL_COPY_READ_BUFFER, pool.buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedBytes);
+
+		glBindBuffer(GL_COPY_READ_BUFFER, temporary);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, pool.buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)capacity * pool.elementSize, NULL, GL_STATIC_DRAW);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedBytes);
+
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &temporary);
+		pool.capacity = capacity;
+	}
+
+	ArenaRange GeometryArena::allocate(const Vertex* vertexData, GLuint vertexCount, const void* indexData, GLenum indexType, GLuint indexCount)
+	{
+		Pool& indices = indexPool(indexType);
+		reserve(vertices, vertexCount);
+		reserve(indices, indexCount);
+
+		ArenaRange range;
+		range.baseVertex = (GLint)vertices.used;
+		range.firstIndex = indices.used;
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, vertices.buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)vertices.used * vertices.elementSize,
+			(GLsizeiptr)vertexCount * vertices.elementSize, vertexData);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, indices.buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)indices.used * indices.elementSize,
+			(GLsizeiptr)indexCount * indices.elementSize, indexData);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		vertices.used += vertexCount;
+		indices.used += indexCount;
+		return range;
+	}
+
+	GLuint GeometryArena::getVertexArray(GLenum indexType) const
+	{
+		return indexType == GL_UNSIGNED_SHORT ? shortVertexArray : intVertexArray;
+	}
+
+	GLuint GeometryArena::getVertexBuffer() const
+	{
+		return vertices.buffer;
+	}
+
+	GLuint GeometryArena::getIndexBuffer(GLenum indexType) const
+	{
+		return indexPool(indexType).buffer;
+	}
+
+	GLuint GeometryArena::createVertexArray(GLenum indexType) const
+	{
+		GLuint vertexArray;
+		glGenVertexArrays(1, &vertexArray);
+		setupVertexArray(vertexArray, indexType);
+		return vertexArray;
+	}
+
+	void GeometryArena::setupVertexArray(GLuint vertexArray, GLenum indexType) const
+	{
+		GLStateCache::bindVertexArray(vertexArray);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexPool(indexType).buffer);
+
+		//same layout as a mesh's own vertex array
+		glBindBuffer(GL_ARRAY_BUFFER, vertices.buffer);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+
+		//draw index, one per instance
+		glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+		glEnableVertexAttribArray(7);
+		glVertexAttribIPointer(7, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)0);
+		glVertexAttribDivisor(7, 1);
+
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		GLStateCache::bindVertexArray(0);
+	}
+
+	size_t GeometryArena::getGPUBytes() const
+	{
+		return (size_t)vertices.capacity * vertices.elementSize +
+			(size_t)shortIndices.capacity * shortIndices.elementSize +
+			(size_t)intIndices.capacity * intIndices.elementSize +
+			MAX_DRAW_INDICES * sizeof(GLuint);
+	}
+
+	GeometryArena::Pool& GeometryArena::indexPool(GLenum indexType)
+	{
+		return indexType == GL_UNSIGNED_SHORT ? shortIndices : intIndices;
+	}
+
+	const GeometryArena::Pool& GeometryArena::indexPool(GLenum indexType) const
+	{
+		return indexType == GL_UNSIGNED_SHORT ? shortIndices : intIndices;
+	}
+
+}
@@ -0,0 +1,73 @@
+#ifndef GeometryArena_hpp
+#define GeometryArena_hpp
+
+#include "Mesh.hpp"
+
+#include <GL/glew.h>
+
+namespace gps {
+
+// Where a mesh landed in the arena, firstIndex counts indices of the mesh's index type
+struct ArenaRange
+{
+    GLuint firstIndex;
+    GLint baseVertex;
+};
+
+// One vertex buffer and one index buffer per index type shared by every mesh placed in it,
+// so meshes drawn with the same index type need no vertex array switch between them.
+// Attribute 7 of its vertex arrays is a per-instance draw index, picked with the base instance.
+class GeometryArena
+{
+public:
+    // entries of the draw index attribute, the highest base instance an indirect draw may use plus one
+    static const GLuint MAX_DRAW_INDICES = 4096;
+
+    GeometryArena();
+
+    // Creates the buffers and vertex arrays, the capacities grow as meshes are added
+    void init(GLuint vertexCapacity = 65536, GLuint indexCapacity = 262144);
+
+    // Copies a mesh into the arena. indexType is GL_UNSIGNED_SHORT or GL_UNSIGNED_INT,
+    // the indices stay relative to the mesh's first vertex.
+    ArenaRange allocate(const Vertex* vertexData, GLuint vertexCount, const void* indexData, GLenum indexType, GLuint indexCount);
+
+    // Shared vertex array reading the indices of indexType
+    GLuint getVertexArray(GLenum indexType) const;
+    GLuint getVertexBuffer() const;
+    GLuint getIndexBuffer(GLenum indexType) const;
+
+    // New vertex array over the arena buffers, for meshes that add attributes of their own
+    GLuint createVertexArray(GLenum indexType) const;
+
+    // Bytes allocated on the GPU, including unused capacity
+    size_t getGPUBytes() const;
+
+private:
+    struct Pool
+    {
+        GLuint buffer;
+        GLuint capacity;
+        GLuint used;
+        GLuint elementSize;
+    };
+
+    Pool vertices;
+    Pool shortIndices;
+    Pool intIndices;
+    GLuint drawIndexBuffer;
+    GLuint shortVertexArray;
+    GLuint intVertexArray;
+
+    Pool& indexPool(GLenum indexType);
+    const Pool& indexPool(GLenum indexType) const;
+
+    // Makes room for count more elements, keeping the buffer name so vertex arrays stay valid
+    static void reserve(Pool& pool, GLuint count);
+    static void initPool(Pool& pool, GLuint capacity, GLuint elementSize);
+    void setupVertexArray(GLuint vertexArray, GLenum indexType) const;
+};
+
+}
+
+#endif /* GeometryArena_hpp */
@@ -0,0 +1,405 @@
+#include "ImageOps.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define IMAGE_KERNEL_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMAGE_KERNEL_SSE
+#endif
+
+namespace gps {
+
+	// steps of the linear to byte table, fine enough that every sRGB byte survives a round trip
+	static const int LINEAR_STEPS = 4096;
+	static const int KAISER_TAPS = 8;
+	static const float KAISER_BETA = 4.0f;
+
+	//the second half of each table is for alpha, which is only scaled
+	struct ConversionTables
+	{
+		float toLinear[2 * 256];
+		int32_t toByte[2 * LINEAR_STEPS];
+
+		ConversionTables() {
+			for (int i = 0; i < 256; i++) {
+				float c = i / 255.0f;
+				toLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+				toLinear[256 + i] = c;
+			}
+			for (int i = 0; i < LINEAR_STEPS; i++) {
+				float c = i / (float)(LINEAR_STEPS - 1);
+				float s = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+				toByte[i] = (int32_t)std::min(255.0f, s * 255.0f + 0.5f);
+				toByte[LINEAR_STEPS + i] = (int32_t)(c * 255.0f + 0.5f);
+			}
+		}
+	};
+
+	//built once, on whichever decode thread gets here first
+	static const ConversionTables& tables()
+	{
+		static const ConversionTables conversion;
+		return conversion;
+	}
+
+	static void swapBytes(unsigned char* a, unsigned char* b, size_t count)
+	{
+		size_t i = 0;
+#if defined(IMAGE_KERNEL_AVX2)
+		for (; i + 32 <= count; i += 32) {
+			__m256i first = _mm256_loadu_si256((const __m256i*)(a + i));
+			__m256i second = _mm256_loadu_si256((const __m256i*)(b + i));
+			_mm256_storeu_si256((__m256i*)(a + i), second);
+			_mm256_storeu_si256((__m256i*)(b + i), first);
+		}
+#elif defined(IMAGE_KERNEL_SSE)
+		for (; i + 16 <= count; i += 16) {
+			__m128i first = _mm_loadu_si128((const __m128i*)(a + i));
+			__m128i second = _mm_loadu_si128((const __m128i*)(b + i));
+			_mm_storeu_si128((__m128i*)(a + i), second);
+			_mm_storeu_si128((__m128i*)(b + i), first);
+		}
+#else
+		unsigned char chunk[256];
+		for (; i + sizeof(chunk) <= count; i += sizeof(chunk)) {
+			memcpy(chunk, a + i, sizeof(chunk));
+			memcpy(a + i, b + i, sizeof(chunk));
+			memcpy(b + i, chunk, sizeof(chunk));
+		}
+#endif
+		for (; i < count; i++) {
+			std::swap(a[i], b[i]);
+		}
+	}
+
+	void ImageOps::flipRows(unsigned char* pixels, int width, int height, int channels)
+	{
+		size_t rowBytes = (size_t)width * channels;
+		for (int row = 0; row < height / 2; row++) {
+			swapBytes(pixels + row * rowBytes, pixels + (height - row - 1) * rowBytes, rowBytes);
+		}
+	}
+
+	void ImageOps::flipRowsScalar(unsigned char* pixels, int width, int height, int channels)
+	{
+		int width_in_bytes = width * channels;
+		unsigned char *top = NULL;
+		unsigned char *bottom = NULL;
+		unsigned char temp = 0;
+
+		for (int row = 0; row < height / 2; row++) {
+			top = pixels + row * width_in_bytes;
+			bottom = pixels + (height - row - 1) * width_in_bytes;
+			for (int col = 0; col < width_in_bytes; col++) {
+				temp = *top;
+				*top = *bottom;
+				*bottom = temp;
+				top++;
+				bottom++;
+			}
+		}
+	}
+
+	void ImageOps::expandToRGBA(const unsigned char* source, int channels, unsigned char* rgba, size_t pixels)
+	{
+		if (channels == 4) {
+			memcpy(rgba, source, pixels * 4);
+			return;
+		}
+
+		size_t i = 0;
+		if (channels == 3) {
+#if defined(IMAGE_KERNEL_AVX2)
+			//four texels per shuffle; the 16 byte load reads past them, so it stops 6 texels before the end
+			const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+			const __m128i opaque = _mm_set1_epi32((int)0xFF000000);
+			for (; i + 6 <= pixels; i += 4) {
+				__m128i texels = _mm_loadu_si128((const __m128i*)(source + i * 3));
+				_mm_storeu_si128((__m128i*)(rgba + i * 4), _mm_or_si128(_mm_shuffle_epi8(texels, spread), opaque));
+			}
+#endif
+			//one 32 bit store per texel instead of four byte stores (little endian, like every target)
+			for (; i < pixels; i++) {
+				uint32_t texel = (uint32_t)source[i * 3] | ((uint32_t)source[i * 3 + 1] << 8) | ((uint32_t)source[i * 3 + 2] << 16) | 0xFF000000u;
+				memcpy(rgba + i * 4, &texel, 4);
+			}
+			return;
+		}
+
+		for (; i < pixels; i++) {
+			unsigned char grey = source[i * channels];
+			rgba[i * 4 + 0] = grey;
+			rgba[i * 4 + 1] = grey;
+			rgba[i * 4 + 2] = grey;
+			rgba[i * 4 + 3] = channels == 2 ? source[i * 2 + 1] : 255;
+		}
+	}
+
+	void ImageOps::srgbToLinear(const unsigned char* rgba, float* linear, size_t pixels)
+	{
+		const ConversionTables& conversion = tables();
+		size_t i = 0;
+#if defined(IMAGE_KERNEL_AVX2)
+		//two texels per gather, the alpha lanes look in the second half of the table
+		const __m256i alphaOffset = _mm256_setr_epi32(0, 0, 0, 256, 0, 0, 0, 256);
+		for (; i + 2 <= pixels; i += 2) {
+			__m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(rgba + i * 4)));
+			_mm256_storeu_ps(linear + i * 4, _mm256_i32gather_ps(conversion.toLinear, _mm256_add_epi32(index, alphaOffset), 4));
+		}
+#endif
+		for (; i < pixels; i++) {
+			linear[i * 4 + 0] = conversion.toLinear[rgba[i * 4 + 0]];
+			linear[i * 4 + 1] = conversion.toLinear[rgba[i * 4 + 1]];
+			linear[i * 4 + 2] = conversion.toLinear[rgba[i * 4 + 2]];
+			linear[i * 4 + 3] = conversion.toLinear[256 + rgba[i * 4 + 3]];
+		}
+	}
+
+	void ImageOps::linearToSrgb(const float* linear, unsigned char* rgba, size_t pixels)
+	{
+		const ConversionTables& conversion = tables();
+		size_t i = 0;
+#if defined(IMAGE_KERNEL_AVX2)
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256 scale = _mm256_set1_ps((float)(LINEAR_STEPS - 1));
+		const __m256 half = _mm256_set1_ps(0.5f);
+		const __m256i alphaOffset = _mm256_setr_epi32(0, 0, 0, LINEAR_STEPS, 0, 0, 0, LINEAR_STEPS);
+		for (; i + 2 <= pixels; i += 2) {
+			__m256 value = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(linear + i * 4), zero), one);
+			__m256i index = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(value, scale), half));
+			__m256i bytes = _mm256_i32gather_epi32(conversion.toByte, _mm256_add_epi32(index, alphaOffset), 4);
+			__m128i words = _mm_packus_epi32(_mm256_castsi256_si128(bytes), _mm256_extracti128_si256(bytes, 1));
+			_mm_storel_epi64((__m128i*)(rgba + i * 4), _mm_packus_epi16(words, words));
+		}
+#elif defined(IMAGE_KERNEL_SSE)
+		//no gathers before AVX2, the clamp and index math still goes four channels at a time
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 scale = _mm_set1_ps((float)(LINEAR_STEPS - 1));
+		const __m128 half = _mm_set1_ps(0.5f);
+		for (; i < pixels; i++) {
+			__m128 value = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(linear + i * 4), zero), one);
+			int32_t index[4];
+			_mm_storeu_si128((__m128i*)index, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, scale), half)));
+			rgba[i * 4 + 0] = (unsigned char)conversion.toByte[index[0]];
+			rgba[i * 4 + 1] = (unsigned char)conversion.toByte[index[1]];
+			rgba[i * 4 + 2] = (unsigned char)conversion.toByte[index[2]];
+			rgba[i * 4 + 3] = (unsigned char)conversion.toByte[LINEAR_STEPS + index[3]];
+		}
+#endif
+		for (; i < pixels; i++) {
+			for (int c = 0; c < 4; c++) {
+				float value = std::min(1.0f, std::max(0.0f, linear[i * 4 + c]));
+				int index = (int)(value * (LINEAR_STEPS - 1) + 0.5f);
+				rgba[i * 4 + c] = (unsigned char)conversion.toByte[index + (c == 3 ? LINEAR_STEPS : 0)];
+			}
+		}
+	}
+
+	//target[i] += weight * source[i]
+	static void addScaled(float* target, const float* source, float weight, size_t count)
+	{
+		size_t i = 0;
+#if defined(IMAGE_KERNEL_AVX2)
+		const __m256 weights = _mm256_set1_ps(weight);
+		for (; i + 8 <= count; i += 8) {
+			_mm256_storeu_ps(target + i, _mm256_add_ps(_mm256_loadu_ps(target + i), _mm256_mul_ps(weights, _mm256_loadu_ps(source + i))));
+		}
+#elif defined(IMAGE_KERNEL_SSE)
+		const __m128 weights = _mm_set1_ps(weight);
+		for (; i + 4 <= count; i += 4) {
+			_mm_storeu_ps(target + i, _mm_add_ps(_mm_loadu_ps(target + i), _mm_mul_ps(weights, _mm_loadu_ps(source + i))));
+		}
+#endif
+		for (; i < count; i++) {
+			target[i] += weight * source[i];
+		}
+	}
+
+	//row y in linear floats, with the last texel repeated once so texel pairs never run off the end
+	static void decodeRow(const unsigned char* source, int width, int y, float* row)
+	{
+		ImageOps::srgbToLinear(source + (size_t)y * width * 4, row, width);
+		memcpy(row + (size_t)width * 4, row + (size_t)(width - 1) * 4, 4 * sizeof(float));
+	}
+
+	static void downsampleBox(const unsigned char* source, int width, int height, unsigned char* target, int targetWidth, int targetHeight)
+	{
+		std::vector<float> rows[2];
+		rows[0].resize(((size_t)width + 1) * 4);
+		rows[1].resize(((size_t)width + 1) * 4);
+		std::vector<float> averaged((size_t)targetWidth * 4);
+
+		for (int y = 0; y < targetHeight; y++) {
+			decodeRow(source, width, std::min(2 * y, height - 1), rows[0].data());
+			decodeRow(source, width, std::min(2 * y + 1, height - 1), rows[1].data());
+			const float* row0 = rows[0].data();
+			const float* row1 = rows[1].data();
+
+			int x = 0;
+#if defined(IMAGE_KERNEL_AVX2)
+			//a texel pair fills a register, adding its halves leaves their sum
+			const __m128 quarter = _mm_set1_ps(0.25f);
+			for (; x < targetWidth; x++) {
+				__m256 sum = _mm256_add_ps(_mm256_loadu_ps(row0 + x * 8), _mm256_loadu_ps(row1 + x * 8));
+				__m128 texel = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+				_mm_storeu_ps(&averaged[x * 4], _mm_mul_ps(texel, quarter));
+			}
+#elif defined(IMAGE_KERNEL_SSE)
+			const __m128 quarter = _mm_set1_ps(0.25f);
+			for (; x < targetWidth; x++) {
+				__m128 top = _mm_add_ps(_mm_loadu_ps(row0 + x * 8), _mm_loadu_ps(row0 + x * 8 + 4));
+				__m128 bottom = _mm_add_ps(_mm_loadu_ps(row1 + x * 8), _mm_loadu_ps(row1 + x * 8 + 4));
+				_mm_storeu_ps(&averaged[x * 4], _mm_mul_ps(_mm_add_ps(top, bottom), quarter));
+			}
+#endif
+			for (; x < targetWidth; x++) {
+				for (int c = 0; c < 4; c++) {
+					averaged[x * 4 + c] = 0.25f * ((row0[x * 8 + c] + row0[x * 8 + 4 + c]) + (row1[x * 8 + c] + row1[x * 8 + 4 + c]));
+				}
+			}
+
+			ImageOps::linearToSrgb(averaged.data(), target + (size_t)y * targetWidth * 4, targetWidth);
+		}
+	}
+
+	static float besselI0(float x)
+	{
+		float sum = 1.0f;
+		float term = 1.0f;
+		for (int k = 1; k < 20; k++) {
+			term *= (x * 0.5f / k) * (x * 0.5f / k);
+			sum += term;
+		}
+		return sum;
+	}
+
+	//weights of the source texels from 3.5 texels before a target texel's centre to 3.5 after it
+	static void kaiserWeights(float* weights)
+	{
+		const float pi = 3.14159265f;
+		float total = 0.0f;
+		for (int k = 0; k < KAISER_TAPS; k++) {
+			float distance = k - (KAISER_TAPS - 1) * 0.5f;
+			float x = distance / (KAISER_TAPS * 0.5f);
+			//the sinc's zeros fall on every second source texel for a 2x reduction
+			float sinc = sinf(pi * distance * 0.5f) / (pi * distance * 0.5f);
+			float window = besselI0(KAISER_BETA * sqrtf(1.0f - x * x)) / besselI0(KAISER_BETA);
+			weights[k] = sinc * window;
+			total += weights[k];
+		}
+		for (int k = 0; k < KAISER_TAPS; k++) {
+			weights[k] /= total;
+		}
+	}
+
+	//horizontal pass of the Kaiser filter over one linear row
+	static void filterRow(const float* row, int width, const float* weights, float* filtered, int targetWidth)
+	{
+		for (int x = 0; x < targetWidth; x++) {
+			int first = 2 * x + 1 - KAISER_TAPS / 2;
+#if defined(IMAGE_KERNEL_AVX2) || defined(IMAGE_KERNEL_SSE)
+			__m128 sum = _mm_setzero_ps();
+			for (int k = 0; k < KAISER_TAPS; k++) {
+				int texel = std::min(width - 1, std::max(0, first + k));
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(row + texel * 4)));
+			}
+			_mm_storeu_ps(filtered + x * 4, sum);
+#else
+			for (int c = 0; c < 4; c++) {
+				float sum = 0.0f;
+				for (int k = 0; k < KAISER_TAPS; k++) {
+					int texel = std::min(width - 1, std::max(0, first + k));
+					sum += weights[k] * row[texel * 4 + c];
+				}
+				filtered[x * 4 + c] = sum;
+			}
+#endif
+		}
+	}
+
+	static void downsampleKaiser(const unsigned char* source, int width, int height, unsigned char* target, int targetWidth, int targetHeight)
+	{
+		float weights[KAISER_TAPS];
+		kaiserWeights(weights);
+
+		size_t rowFloats = (size_t)targetWidth * 4;
+		std::vector<float> decoded((size_t)width * 4);
+		std::vector<float> filtered(rowFloats);
+		//horizontally filtered source rows, row r lives in slot r % KAISER_TAPS; the rows of one target row are consecutive so they never share a slot
+		std::vector<float> ring(KAISER_TAPS * rowFloats);
+		int ringRows[KAISER_TAPS];
+		std::fill(ringRows, ringRows + KAISER_TAPS, -1);
+
+		for (int y = 0; y < targetHeight; y++) {
+			std::fill(filtered.begin(), filtered.end(), 0.0f);
+			int first = 2 * y + 1 - KAISER_TAPS / 2;
+			for (int k = 0; k < KAISER_TAPS; k++) {
+				int row = std::min(height - 1, std::max(0, first + k));
+				int slot = row % KAISER_TAPS;
+				if (ringRows[slot] != row) {
+					ImageOps::srgbToLinear(source + (size_t)row * width * 4, decoded.data(), width);
+					filterRow(decoded.data(), width, weights, &ring[slot * rowFloats], targetWidth);
+					ringRows[slot] = row;
+				}
+				addScaled(filtered.data(), &ring[slot * rowFloats], weights[k], rowFloats);
+			}
+			//the negative lobes can overshoot, the conversion clamps
+			ImageOps::linearToSrgb(filtered.data(), target + (size_t)y * targetWidth * 4, targetWidth);
+		}
+	}
+
+	void ImageOps::downsample(const unsigned char* source, int width, int height, unsigned char* target, MipFilter filter)
+	{
+		int targetWidth = std::max(1, width / 2);
+		int targetHeight = std::max(1, height / 2);
+		if (filter == MIP_FILTER_KAISER) {
+			downsampleKaiser(source, width, height, target, targetWidth, targetHeight);
+		}
+		else {
+			downsampleBox(source, width, height, target, targetWidth, targetHeight);
+		}
+	}
+
+	void ImageOps::downsampleScalar(const unsigned char* source, int width, int height, unsigned char* target)
+	{
+		const ConversionTables& conversion = tables();
+		int targetWidth = std::max(1, width / 2);
+		int targetHeight = std::max(1, height / 2);
+		for (int y = 0; y < targetHeight; y++) {
+			const unsigned char* row0 = source + (size_t)std::min(2 * y, height - 1) * width * 4;
+			const unsigned char* row1 = source + (size_t)std::min(2 * y + 1, height - 1) * width * 4;
+			for (int x = 0; x < targetWidth; x++) {
+				size_t x0 = (size_t)std::min(2 * x, width - 1) * 4;
+				size_t x1 = (size_t)std::min(2 * x + 1, width - 1) * 4;
+				unsigned char* texel = target + ((size_t)y * targetWidth + x) * 4;
+				for (int c = 0; c < 3; c++) {
+					float linear = 0.25f * (conversion.toLinear[row0[x0 + c]] + conversion.toLinear[row0[x1 + c]] +
+						conversion.toLinear[row1[x0 + c]] + conversion.toLinear[row1[x1 + c]]);
+					texel[c] = (unsigned char)conversion.toByte[(int)(linear * (LINEAR_STEPS - 1) + 0.5f)];
+				}
+				texel[3] = (unsigned char)((row0[x0 + 3] + row0[x1 + 3] + row1[x0 + 3] + row1[x1 + 3] + 2) / 4);
+			}
+		}
+	}
+
+	const char* ImageOps::kernelName()
+	{
+#if defined(IMAGE_KERNEL_AVX2)
+		return "AVX2";
+#elif defined(IMAGE_KERNEL_SSE)
+		return "SSE2";
+#else
+		return "scalar";
+#endif
+	}
+
+}
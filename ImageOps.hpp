@@ -0,0 +1,48 @@
+#ifndef ImageOps_hpp
+#define ImageOps_hpp
+
+#include <cstddef>
+
+namespace gps {
+
+enum MipFilter
+{
+    // 2x2 average
+    MIP_FILTER_BOX = 0,
+    // 8x8 Kaiser windowed sinc, sharper mips at the cost of slight ringing
+    MIP_FILTER_KAISER = 1
+};
+
+// Pixel loops of texture import, vectorized with the kernel selected at compile time (AVX2, SSE or scalar).
+// Colour images are RGBA8 with sRGB colour and linear alpha, like the GL_SRGB textures they become.
+class ImageOps
+{
+public:
+    // Swaps rows top to bottom in place
+    static void flipRows(unsigned char* pixels, int width, int height, int channels);
+
+    // Reference implementation of flipRows, one byte at a time
+    static void flipRowsScalar(unsigned char* pixels, int width, int height, int channels);
+
+    // Expands grey, grey+alpha or RGB texels (channels 1 to 3) to RGBA with opaque alpha where there is none
+    static void expandToRGBA(const unsigned char* source, int channels, unsigned char* rgba, size_t pixels);
+
+    // RGBA8 texels to linear floats; alpha is only scaled to [0, 1]
+    static void srgbToLinear(const unsigned char* rgba, float* linear, size_t pixels);
+
+    // Linear float RGBA back to RGBA8, clamped to [0, 1] and rounded
+    static void linearToSrgb(const float* linear, unsigned char* rgba, size_t pixels);
+
+    // Halves an RGBA8 image into target (max(1, width / 2) by max(1, height / 2)), filtering in linear space
+    static void downsample(const unsigned char* source, int width, int height, unsigned char* target, MipFilter filter);
+
+    // Reference box downsample without SIMD
+    static void downsampleScalar(const unsigned char* source, int width, int height, unsigned char* target);
+
+    // Name of the kernels selected at compile time
+    static const char* kernelName();
+};
+
+}
+
+#endif /* ImageOps_hpp */
@@ -0,0 +1,128 @@
+#include "IndirectBatch.hpp"
+#include "GeometryArena.hpp"
+#include "GLStateCache.hpp"
+
+namespace gps {
+
+	static const GLenum INDEX_TYPES[2] = { GL_UNSIGNED_SHORT, GL_UNSIGNED_INT };
+
+	IndirectBatch::IndirectBatch() : indirectBuffer(0), transformBuffer(0), transformTexture(0)
+	{
+	}
+
+	void IndirectBatch::init()
+	{
+		glGenBuffers(1, &indirectBuffer);
+		glGenBuffers(1, &transformBuffer);
+
+		glBindBuffer(GL_TEXTURE_BUFFER, transformBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		//buffer textures are not tracked by the state cache, only the unit is
+		glGenTextures(1, &transformTexture);
+		GLStateCache::activeTexture(0);
+		glBindTexture(GL_TEXTURE_BUFFER, transformTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, transformBuffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+
+	void IndirectBatch::clear()
+	{
+		commands[0].clear();
+		commands[1].clear();
+		transforms.clear();
+	}
+
+	uint32_t IndirectBatch::addTransform(const glm::mat4& model)
+	{
+		transforms.push_back(model);
+		return (uint32_t)transforms.size() - 1;
+	}
+
+	void IndirectBatch::add(gps::Mesh& mesh, uint32_t transform)
+	{
+		DrawElementsIndirectCommand command;
+		command.count = mesh.getIndexCount();
+		command.instanceCount = 1;
+		command.firstIndex = mesh.getFirstIndex();
+		command.baseVertex = mesh.getBaseVertex();
+		//the draw index attribute reads entry baseInstance, which is the transform
+		command.baseInstance = transform;
+		commands[mesh.getIndexType() == GL_UNSIGNED_SHORT ? 0 : 1].push_back(command);
+	}
+
+	void IndirectBatch::submit(gps::Shader& shader, GLuint transformUnit)
+	{
+		if (commands[0].empty() && commands[1].empty()) {
+			return;
+		}
+
+		//a mat4 is four RGBA32F texels, one per column
+		glBindBuffer(GL_TEXTURE_BUFFER, transformBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, transforms.size() * sizeof(glm::mat4), transforms.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		GLStateCache::activeTexture(transformUnit);
+		glBindTexture(GL_TEXTURE_BUFFER, transformTexture);
+		shader.setInt("drawTransforms", (GLint)transformUnit);
+
+		GeometryArena* arena = Mesh::geometryArena;
+		if (isMultiDrawSupported()) {
+			//both lists in one buffer, the 32 bit draws after the 16 bit ones
+			size_t shortBytes = commands[0].size() * sizeof(DrawElementsIndirectCommand);
+			size_t intBytes = commands[1].size() * sizeof(DrawElementsIndirectCommand);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+			glBufferData(GL_DRAW_INDIRECT_BUFFER, shortBytes + intBytes, NULL, GL_STREAM_DRAW);
+			if (shortBytes > 0) {
+				glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, shortBytes, commands[0].data());
+			}
+			if (intBytes > 0) {
+				glBufferSubData(GL_DRAW_INDIRECT_BUFFER, shortBytes, intBytes, commands[1].data());
+			}
+
+			shader.setInt("drawBase", 0);
+			size_t offset = 0;
+			for (int type = 0; type < 2; type++) {
+				if (commands[type].empty()) {
+					continue;
+				}
+				GLStateCache::bindVertexArray(arena->getVertexArray(INDEX_TYPES[type]));
+				glMultiDrawElementsIndirect(GL_TRIANGLES, INDEX_TYPES[type], (const GLvoid*)offset,
+					(GLsizei)commands[type].size(), sizeof(DrawElementsIndirectCommand));
+				offset += commands[type].size() * sizeof(DrawElementsIndirectCommand);
+				Mesh::drawCalls++;
+			}
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			return;
+		}
+
+		//GL 4.1: base instances are not honoured, so the draw index attribute reads 0 and drawBase picks the transform
+		for (int type = 0; type < 2; type++) {
+			if (commands[type].empty()) {
+				continue;
+			}
+			size_t indexSize = INDEX_TYPES[type] == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+			GLStateCache::bindVertexArray(arena->getVertexArray(INDEX_TYPES[type]));
+			for (size_t i = 0; i < commands[type].size(); i++) {
+				const DrawElementsIndirectCommand& command = commands[type][i];
+				shader.setInt("drawBase", (GLint)command.baseInstance);
+				glDrawElementsBaseVertex(GL_TRIANGLES, command.count, INDEX_TYPES[type],
+					(const GLvoid*)(command.firstIndex * indexSize), command.baseVertex);
+				Mesh::drawCalls++;
+			}
+		}
+	}
+
+	size_t IndirectBatch::size() const
+	{
+		return commands[0].size() + commands[1].size();
+	}
+
+	bool IndirectBatch::isMultiDrawSupported()
+	{
+		static const bool supported = GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+		return supported;
+	}
+
+}
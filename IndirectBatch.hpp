@@ -0,0 +1,68 @@
+#ifndef IndirectBatch_hpp
+#define IndirectBatch_hpp
+
+#include "Mesh.hpp"
+#include "Shader.hpp"
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+// Layout glMultiDrawElementsIndirect reads from the indirect buffer
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// Draws of geometry arena meshes that share one program and no textures, submitted with one
+// glMultiDrawElementsIndirect per index type. The model matrices go to a texture buffer and each
+// draw finds its matrix through the arena's draw index attribute, offset by the "drawBase" uniform.
+// Without GL 4.3 (or the multi draw indirect and base instance extensions) every draw is issued on its own.
+class IndirectBatch
+{
+public:
+    IndirectBatch();
+
+    // Creates the indirect buffer and the transform texture buffer
+    void init();
+
+    // Forgets the draws and transforms of the previous submit
+    void clear();
+
+    // Stores a model matrix for the draws that follow, returns its index.
+    // At most GeometryArena::MAX_DRAW_INDICES transforms fit in one submit.
+    uint32_t addTransform(const glm::mat4& model);
+
+    // Queues mesh, which must live in the geometry arena, drawn with the transform at index transform
+    void add(gps::Mesh& mesh, uint32_t transform);
+
+    // Uploads the commands and transforms and draws them with shader, which must be in use.
+    // The transforms are bound to transformUnit and the shader's "drawTransforms" sampler.
+    void submit(gps::Shader& shader, GLuint transformUnit);
+
+    size_t size() const;
+
+    // Multi draw indirect with base instances is available, checked once a context exists
+    static bool isMultiDrawSupported();
+
+private:
+    // 0 holds GL_UNSIGNED_SHORT draws, 1 GL_UNSIGNED_INT draws
+    std::vector<DrawElementsIndirectCommand> commands[2];
+    std::vector<glm::mat4> transforms;
+
+    GLuint indirectBuffer;
+    GLuint transformBuffer;
+    GLuint transformTexture;
+};
+
+}
+
+#endif /* IndirectBatch_hpp */
@@ -0,0 +1,166 @@
+#include "JobSystem.hpp"
+
+namespace gps {
+
+	// queue of the worker running on this thread
+	static thread_local const JobSystem* currentSystem = NULL;
+	static thread_local int currentIndex = -1;
+
+	JobSystem::JobSystem(int workerCount) : running(true), queuedJobs(0), nextQueue(0)
+	{
+		if (workerCount < 0) {
+			int hardwareThreads = (int)std::thread::hardware_concurrency();
+			workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+		}
+
+		//a pool without workers still needs a queue for the waiting thread to drain
+		int queueCount = workerCount > 0 ? workerCount : 1;
+		for (int i = 0; i < queueCount; i++) {
+			queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+		}
+
+		for (int i = 0; i < workerCount; i++) {
+			workers.push_back(std::thread(&JobSystem::workerLoop, this, i));
+		}
+	}
+
+	JobSystem::~JobSystem()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			running = false;
+		}
+		wakeUp.notify_all();
+
+		for (size_t i = 0; i < workers.size(); i++) {
+			workers[i].join();
+		}
+	}
+
+	unsigned int JobSystem::getWorkerCount() const
+	{
+		return (unsigned int)workers.size();
+	}
+
+	int JobSystem::currentWorkerIndex() const
+	{
+		return currentSystem == this ? currentIndex : -1;
+	}
+
+	void JobSystem::run(const Job& job, JobCounter* counter)
+	{
+		if (counter) {
+			counter->pending++;
+		}
+
+		//workers push to their own queue, other threads spread jobs round-robin
+		int index = currentWorkerIndex();
+		if (index < 0) {
+			index = nextQueue++ % queues.size();
+		}
+
+		Entry entry;
+		entry.job = job;
+		entry.counter = counter;
+		{
+			std::lock_guard<std::mutex> lock(queues[index]->mutex);
+			queues[index]->jobs.push_back(entry);
+		}
+
+		queuedJobs++;
+		{
+			//pairs with the predicate check in workerLoop so the wake-up is not lost
+			std::lock_guard<std::mutex> lock(sleepMutex);
+		}
+		wakeUp.notify_one();
+	}
+
+	void JobSystem::parallelFor(int count, int chunkSize, const std::function<void(int, int)>& body, JobCounter* counter)
+	{
+		if (chunkSize < 1) {
+			chunkSize = 1;
+		}
+
+		for (int begin = 0; begin < count; begin += chunkSize) {
+			int end = begin + chunkSize < count ? begin + chunkSize : count;
+			run([body, begin, end]() { body(begin, end); }, counter);
+		}
+	}
+
+	void JobSystem::wait(JobCounter* counter)
+	{
+		int index = currentWorkerIndex();
+		unsigned int preferredQueue = index < 0 ? 0 : index;
+
+		//help with the work instead of blocking
+		while (counter->pending > 0) {
+			if (!tryRunJob(preferredQueue)) {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	bool JobSystem::popBack(unsigned int queueIndex, Entry& entry)
+	{
+		WorkerQueue& queue = *queues[queueIndex];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty()) {
+			return false;
+		}
+		entry = queue.jobs.back();
+		queue.jobs.pop_back();
+		return true;
+	}
+
+	bool JobSystem::stealFront(unsigned int queueIndex, Entry& entry)
+	{
+		WorkerQueue& queue = *queues[queueIndex];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty()) {
+			return false;
+		}
+		entry = queue.jobs.front();
+		queue.jobs.pop_front();
+		return true;
+	}
+
+	bool JobSystem::tryRunJob(unsigned int preferredQueue)
+	{
+		Entry entry;
+		bool found = popBack(preferredQueue, entry);
+
+		for (unsigned int i = 1; !found && i < queues.size(); i++) {
+			found = stealFront((preferredQueue + i) % queues.size(), entry);
+		}
+
+		if (!found) {
+			return false;
+		}
+
+		queuedJobs--;
+		entry.job();
+		if (entry.counter) {
+			entry.counter->pending--;
+		}
+		return true;
+	}
+
+	void JobSystem::workerLoop(unsigned int index)
+	{
+		currentSystem = this;
+		currentIndex = index;
+
+		while (true) {
+			if (tryRunJob(index)) {
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			wakeUp.wait(lock, [this]() { return !running || queuedJobs > 0; });
+			if (!running) {
+				break;
+			}
+		}
+	}
+
+}
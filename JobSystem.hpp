@@ -0,0 +1,82 @@
+#ifndef JobSystem_hpp
+#define JobSystem_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+// Counts the unfinished jobs of a batch, JobSystem::wait blocks until it reaches zero
+struct JobCounter
+{
+    std::atomic<int> pending;
+
+    JobCounter() : pending(0) {}
+};
+
+class JobSystem
+{
+public:
+    typedef std::function<void()> Job;
+
+    // A negative workerCount starts one worker per hardware thread, minus the calling thread.
+    // With no workers every job runs on the thread that waits for it.
+    explicit JobSystem(int workerCount = -1);
+    ~JobSystem();
+
+    // Queues a job, the counter (may be NULL) is decremented when it finishes
+    void run(const Job& job, JobCounter* counter);
+
+    // Splits [0, count) into chunks of chunkSize and queues one job per chunk
+    void parallelFor(int count, int chunkSize, const std::function<void(int, int)>& body, JobCounter* counter);
+
+    // Runs queued jobs on the calling thread until the counter reaches zero
+    void wait(JobCounter* counter);
+
+    unsigned int getWorkerCount() const;
+
+private:
+    struct Entry
+    {
+        Job job;
+        JobCounter* counter;
+    };
+
+    // per-worker deque, the owner pops from the back and thieves steal from the front
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<Entry> jobs;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::atomic<bool> running;
+    std::atomic<int> queuedJobs;
+    std::atomic<unsigned int> nextQueue;
+
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+
+    void workerLoop(unsigned int index);
+
+    // Pops from the given queue or steals from the others, returns false if all are empty
+    bool tryRunJob(unsigned int preferredQueue);
+
+    bool popBack(unsigned int queueIndex, Entry& entry);
+    bool stealFront(unsigned int queueIndex, Entry& entry);
+
+    // Index of the calling thread's queue, or -1 for threads outside the pool
+    int currentWorkerIndex() const;
+};
+
+}
+
+#endif /* JobSystem_hpp */
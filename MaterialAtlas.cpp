@@ -0,0 +1,331 @@
+#include "MaterialAtlas.hpp"
+#include "GLStateCache.hpp"
+#include "TextureCompressor.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace gps {
+
+	struct AtlasTexture
+	{
+		GLuint id;
+		GLint width;
+		GLint height;
+		int sizeClass;
+		GLint layer;
+	};
+
+	static int findTexture(const std::vector<AtlasTexture>& textures, GLuint id)
+	{
+		for (size_t i = 0; i < textures.size(); i++) {
+			if (textures[i].id == id) {
+				return (int)i;
+			}
+		}
+		return -1;
+	}
+
+	//the texture of a mesh with the given sampler name, 0 if it has none
+	static GLuint meshTexture(const Mesh& mesh, const char* type)
+	{
+		for (size_t i = 0; i < mesh.textures.size(); i++) {
+			if (mesh.textures[i].type == type) {
+				return mesh.textures[i].id;
+			}
+		}
+		return 0;
+	}
+
+	MaterialAtlas::MaterialAtlas() : built(false), gpuBytes(0)
+	{
+	}
+
+	bool MaterialAtlas::build(const std::vector<Model3D*>& models)
+	{
+		//the textures the shaders sample, with their size class and layer
+		std::vector<AtlasTexture> textures;
+		arrays.clear();
+		for (size_t m = 0; m < models.size(); m++) {
+			for (size_t i = 0; i < models[m]->meshes.size(); i++) {
+				const char* types[2] = { "diffuseTexture", "specularTexture" };
+				for (int t = 0; t < 2; t++) {
+					GLuint id = meshTexture(models[m]->meshes[i], types[t]);
+					if (id == 0 || findTexture(textures, id) >= 0) {
+						continue;
+					}
+
+					AtlasTexture texture;
+					texture.id = id;
+					GLint compressed = GL_FALSE;
+					GLint internalFormat = 0;
+					GLStateCache::bindTexture2D(0, id);
+					glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &texture.width);
+					glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &texture.height);
+					glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+					glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+					if (texture.width <= 0 || texture.height <= 0) {
+						continue;
+					}
+
+					SizeClass sizeClass;
+					sizeClass.layers = 0;
+					sizeClass.texture = 0;
+					if (compressed) {
+						//blocks cannot be blitted, so compressed textures keep their format and size
+						sizeClass.format = (GLenum)internalFormat;
+						sizeClass.width = texture.width;
+						sizeClass.height = texture.height;
+					}
+					else {
+						GLint size = MIN_SIZE;
+						while (size < std::max(texture.width, texture.height) && size < MAX_SIZE) {
+							size *= 2;
+						}
+						sizeClass.format = GL_SRGB8_ALPHA8;
+						sizeClass.width = size;
+						sizeClass.height = size;
+					}
+
+					texture.sizeClass = -1;
+					for (size_t a = 0; a < arrays.size() && texture.sizeClass < 0; a++) {
+						if (arrays[a].format == sizeClass.format && arrays[a].width == sizeClass.width &&
+							arrays[a].height == sizeClass.height) {
+							texture.sizeClass = (int)a;
+						}
+					}
+					if (texture.sizeClass < 0) {
+						texture.sizeClass = (int)arrays.size();
+						arrays.push_back(sizeClass);
+					}
+					texture.layer = arrays[texture.sizeClass].layers++;
+					textures.push_back(texture);
+				}
+			}
+		}
+
+		//one table entry per distinct pair
+		std::vector<GLint> table;
+		std::vector<std::vector<GLint> > meshMaterials(models.size());
+		for (size_t m = 0; m < models.size(); m++) {
+			for (size_t i = 0; i < models[m]->meshes.size(); i++) {
+				GLint entry[4] = { -1, 0, -1, 0 };
+				int diffuse = findTexture(textures, meshTexture(models[m]->meshes[i], "diffuseTexture"));
+				int specular = findTexture(textures, meshTexture(models[m]->meshes[i], "specularTexture"));
+				if (diffuse >= 0) {
+					entry[0] = textures[diffuse].sizeClass;
+					entry[1] = textures[diffuse].layer;
+				}
+				if (specular >= 0) {
+					entry[2] = textures[specular].sizeClass;
+					entry[3] = textures[specular].layer;
+				}
+
+				GLint material = -1;
+				for (size_t e = 0; e < table.size() && material < 0; e += 4) {
+					if (std::equal(entry, entry + 4, table.begin() + e)) {
+						material = (GLint)(e / 4);
+					}
+				}
+				if (material < 0) {
+					material = (GLint)(table.size() / 4);
+					table.insert(table.end(), entry, entry + 4);
+				}
+				meshMaterials[m].push_back(material);
+			}
+		}
+		if (table.size() / 4 > (size_t)MAX_MATERIALS || arrays.size() > (size_t)MAX_ARRAYS) {
+			std::cerr << "Material atlas: " << table.size() / 4 << " materials in " << arrays.size() << " arrays, at most "
+				<< MAX_MATERIALS << " in " << MAX_ARRAYS << " fit, meshes keep their own textures" << std::endl;
+			arrays.clear();
+			return false;
+		}
+
+		gpuBytes = 0;
+		for (size_t a = 0; a < arrays.size(); a++) {
+			SizeClass& sizeClass = arrays[a];
+			glGenTextures(1, &sizeClass.texture);
+			//array textures are not tracked by the state cache, only the unit is
+			GLStateCache::activeTexture(0);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, sizeClass.texture);
+
+			if (sizeClass.format == GL_SRGB8_ALPHA8) {
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_SRGB8_ALPHA8, sizeClass.width, sizeClass.height, sizeClass.layers,
+					0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+				//4 bytes per texel and a third more for the mip chain
+				gpuBytes += (size_t)sizeClass.width * sizeClass.height * sizeClass.layers * 4 * 4 / 3;
+				continue;
+			}
+
+			//compressed arrays get every level up front, the copies fill them in
+			GLint level = 0;
+			for (GLint width = sizeClass.width, height = sizeClass.height; ; width = std::max(1, width / 2), height = std::max(1, height / 2)) {
+				size_t levelBytes = TextureCompressor::getLevelSize(width, height, sizeClass.format) * sizeClass.layers;
+				glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level++, sizeClass.format, width, height, sizeClass.layers,
+					0, (GLsizei)levelBytes, NULL);
+				gpuBytes += levelBytes;
+				if (width == 1 && height == 1) {
+					break;
+				}
+			}
+		}
+
+		//GPU copies through framebuffers, a linear blit does the resampling
+		GLint previousRead = 0;
+		GLint previousDraw = 0;
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousRead);
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousDraw);
+		//the texels are copied as stored, without a linear to sRGB round trip
+		GLboolean srgbWrites = glIsEnabled(GL_FRAMEBUFFER_SRGB);
+		glDisable(GL_FRAMEBUFFER_SRGB);
+
+		GLuint framebuffers[2];
+		GLuint pixelBuffer;
+		glGenFramebuffers(2, framebuffers);
+		glGenBuffers(1, &pixelBuffer);
+		for (size_t i = 0; i < textures.size(); i++) {
+			const AtlasTexture& texture = textures[i];
+			const SizeClass& target = arrays[texture.sizeClass];
+			if (target.format == GL_SRGB8_ALPHA8) {
+				copyLayer(texture.id, texture.width, texture.height, target, texture.layer, framebuffers[0], framebuffers[1]);
+			}
+			else {
+				copyCompressedLayer(texture.id, target, texture.layer, pixelBuffer);
+			}
+		}
+		glDeleteBuffers(1, &pixelBuffer);
+		glDeleteFramebuffers(2, framebuffers);
+
+		if (srgbWrites) {
+			glEnable(GL_FRAMEBUFFER_SRGB);
+		}
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, previousRead);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousDraw);
+
+		for (size_t a = 0; a < arrays.size(); a++) {
+			GLStateCache::activeTexture(0);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[a].texture);
+			if (arrays[a].format == GL_SRGB8_ALPHA8) {
+				glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+			}
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		}
+
+		materials = table;
+		for (size_t m = 0; m < models.size(); m++) {
+			for (size_t i = 0; i < models[m]->meshes.size(); i++) {
+				models[m]->meshes[i].materialId = meshMaterials[m][i];
+			}
+			//every mesh samples the arrays now, the originals would only double the texture memory
+			models[m]->releaseTextures();
+		}
+
+		built = true;
+		std::cout << "Material atlas: " << textures.size() << " textures in " << arrays.size() << " arrays, "
+			<< materials.size() / 4 << " materials, " << gpuBytes / (1024 * 1024) << " MB" << std::endl;
+		return true;
+	}
+
+	void MaterialAtlas::copyLayer(GLuint source, GLint width, GLint height, const SizeClass& target, GLint layer,
+		GLuint readFramebuffer, GLuint drawFramebuffer)
+	{
+		//a bilinear blit only looks at 2x2 texels, so shrink from the mip level closest to the layer size
+		GLint level = 0;
+		GLStateCache::bindTexture2D(0, source);
+		while (std::max(width, height) / 2 >= target.width) {
+			GLint nextWidth = 0;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level + 1, GL_TEXTURE_WIDTH, &nextWidth);
+			if (nextWidth <= 0) {
+				break;
+			}
+			level++;
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+		}
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, source, level);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+		glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target.texture, 0, layer);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+		glBlitFramebuffer(0, 0, width, height, 0, 0, target.width, target.height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	}
+
+	void MaterialAtlas::copyCompressedLayer(GLuint source, const SizeClass& target, GLint layer, GLuint pixelBuffer)
+	{
+		GLint level = 0;
+		for (GLint width = target.width, height = target.height; ; width = std::max(1, width / 2), height = std::max(1, height / 2)) {
+			GLint bytes = 0;
+			GLStateCache::bindTexture2D(0, source);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &bytes);
+			if (bytes <= 0) {
+				break;
+			}
+
+			//read the blocks into the buffer and write them back out of it, the texels never reach the CPU
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+			glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_COPY);
+			glGetCompressedTexImage(GL_TEXTURE_2D, level, (void*)0);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+			GLStateCache::activeTexture(0);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, target.texture);
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, target.format, bytes, (const void*)0);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+			level++;
+			if (width == 1 && height == 1) {
+				break;
+			}
+		}
+	}
+
+	bool MaterialAtlas::isBuilt() const
+	{
+		return built;
+	}
+
+	void MaterialAtlas::bind(GLuint firstUnit) const
+	{
+		for (size_t a = 0; a < arrays.size(); a++) {
+			GLStateCache::activeTexture(firstUnit + (GLuint)a);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[a].texture);
+		}
+	}
+
+	void MaterialAtlas::setUniforms(gps::Shader& shader, GLuint firstUnit) const
+	{
+		//unused samplers point at units of their own so no two sampler types share one
+		GLint units[MAX_ARRAYS];
+		for (int a = 0; a < MAX_ARRAYS; a++) {
+			units[a] = (GLint)(firstUnit + a);
+		}
+		shader.setIntArray("materialArrays", units, MAX_ARRAYS);
+		if (!materials.empty()) {
+			shader.setIVec4Array("materials", materials.data(), (GLsizei)(materials.size() / 4));
+		}
+	}
+
+	int MaterialAtlas::getArrayCount() const
+	{
+		return (int)arrays.size();
+	}
+
+	int MaterialAtlas::getMaterialCount() const
+	{
+		return (int)(materials.size() / 4);
+	}
+
+	size_t MaterialAtlas::getGPUBytes() const
+	{
+		return gpuBytes;
+	}
+
+}
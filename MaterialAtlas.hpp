@@ -0,0 +1,71 @@
+#ifndef MaterialAtlas_hpp
+#define MaterialAtlas_hpp
+
+#include "Model3D.hpp"
+#include "Shader.hpp"
+
+#include <GL/glew.h>
+
+#include <vector>
+
+namespace gps {
+
+// The diffuse and specular textures of a set of models copied into one GL_TEXTURE_2D_ARRAY per size class
+// (per format and size for block compressed textures, which cannot be resampled), with a table of (diffuse array, diffuse layer, specular array, specular layer) per distinct texture pair.
+// Once built every mesh draws with its table entry and the arrays stay bound for the whole frame.
+class MaterialAtlas
+{
+public:
+    // must match MAX_MATERIAL_ARRAYS and MAX_MATERIALS in basic.frag
+    static const int MAX_ARRAYS = 6;
+    static const int MAX_MATERIALS = 64;
+    // square size classes from MIN_SIZE to MAX_SIZE, one array each; uncompressed textures are resampled to their class
+    static const int MIN_SIZE = 64;
+    static const int MAX_SIZE = 2048;
+
+    MaterialAtlas();
+
+    // Copies the textures of the models into the arrays, sets each mesh's materialId and releases the models' own textures.
+    // The textures must hold their final images (nothing left to stream). Returns false, leaving
+    // the meshes on their own textures, when there are more than MAX_MATERIALS texture pairs or MAX_ARRAYS classes.
+    bool build(const std::vector<Model3D*>& models);
+
+    bool isBuilt() const;
+
+    // Binds array i to texture unit firstUnit + i, with raw binds the state cache does not track
+    void bind(GLuint firstUnit) const;
+
+    // Sets the "materialArrays" samplers and the "materials" table, the program must be in use
+    void setUniforms(gps::Shader& shader, GLuint firstUnit) const;
+
+    int getArrayCount() const;
+    int getMaterialCount() const;
+    size_t getGPUBytes() const;
+
+private:
+    struct SizeClass
+    {
+        // GL_SRGB8_ALPHA8, or the compressed format of the textures in it
+        GLenum format;
+        GLint width;
+        GLint height;
+        GLint layers;
+        GLuint texture;
+    };
+
+    std::vector<SizeClass> arrays;
+    // four ints per material
+    std::vector<GLint> materials;
+    bool built;
+    size_t gpuBytes;
+
+    // Copies a 2D texture into a layer, from the mip level nearest above the layer size
+    void copyLayer(GLuint source, GLint width, GLint height, const SizeClass& target, GLint layer, GLuint readFramebuffer, GLuint drawFramebuffer);
+
+    // Copies every level of a compressed 2D texture into a layer through a pixel buffer, without leaving the GPU
+    void copyCompressedLayer(GLuint source, const SizeClass& target, GLint layer, GLuint pixelBuffer);
+};
+
+}
+
+#endif /* MaterialAtlas_hpp */
@@ -1,59 +1,250 @@
 #include "Mesh.hpp"
+#include "GLStateCache.hpp"
+#include "GeometryArena.hpp"
 namespace gps {
 
+	GLuint Mesh::drawCalls = 0;
+	GeometryArena* Mesh::geometryArena = NULL;
+
 	/* Mesh Constructor */
 	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures)
 	{
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
+		this->materialId = -1;
+		this->vertexCount = this->vertices.size();
+		this->indexCount = this->indices.size();
+
+		if (this->vertexCount <= 65536) {
+			//halve the index buffer for small meshes
+			this->indexType = GL_UNSIGNED_SHORT;
+			std::vector<GLushort> shortIndices(this->indices.begin(), this->indices.end());
+			this->setupMesh(this->vertices.data(), shortIndices.data());
+		}
+		else {
+			this->indexType = GL_UNSIGNED_INT;
+			this->setupMesh(this->vertices.data(), this->indices.data());
+		}
+	}
+
+	Mesh::Mesh(const Vertex* vertexData, GLuint vertexCount, const void* indexData, GLenum indexType, GLuint indexCount, std::vector<Texture> textures)
+	{
+		this->textures = textures;
+		this->materialId = -1;
+		this->vertexCount = vertexCount;
+		this->indexCount = indexCount;
+		this->indexType = indexType;
+
+		this->setupMesh(vertexData, indexData);
+	}
 
-		this->setupMesh();
+	Mesh::Mesh(MeshData& data, std::vector<Texture> textures)
+		: Mesh(data.vertexData, data.vertexCount, data.indexData, data.indexType, data.indexCount, textures)
+	{
+		this->vertices.swap(data.vertices);
+		this->indices.swap(data.indices);
+		this->material = data.material;
+	}
+
+	MeshData::MeshData() : vertexData(NULL), vertexCount(0), indexData(NULL), indexType(GL_UNSIGNED_INT), indexCount(0), material()
+	{
+	}
+
+	void MeshData::usePackedIndices()
+	{
+		vertexData = vertices.data();
+		vertexCount = (GLuint)vertices.size();
+		indexCount = (GLuint)indices.size();
+
+		if (vertexCount <= 65536) {
+			//halve the index buffer for small meshes
+			shortIndices.assign(indices.begin(), indices.end());
+			indexType = GL_UNSIGNED_SHORT;
+			indexData = shortIndices.data();
+		}
+		else {
+			shortIndices.clear();
+			indexType = GL_UNSIGNED_INT;
+			indexData = indices.data();
+		}
 	}
 
 	Buffers Mesh::getBuffers() {
 	    return this->buffers;
 	}
 
+	GLuint Mesh::getVertexCount() {
+		return this->vertexCount;
+	}
+
+	GLuint Mesh::getIndexCount() {
+		return this->indexCount;
+	}
+
+	GLenum Mesh::getIndexType() {
+		return this->indexType;
+	}
+
+	GLuint Mesh::getFirstIndex() {
+		return this->firstIndex;
+	}
+
+	GLint Mesh::getBaseVertex() {
+		return this->baseVertex;
+	}
+
+	bool Mesh::isInArena() {
+		return this->arena != NULL;
+	}
+
+	size_t Mesh::getGPUBytes() {
+		size_t indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		return this->vertexCount * sizeof(Vertex) + this->indexCount * indexSize;
+	}
+
+	const Bounds& Mesh::getBounds() const {
+		return this->bounds;
+	}
+
 	/* Mesh drawing function - also applies associated textures */
-	void Mesh::Draw(gps::Shader shader)
+	void Mesh::Draw(gps::Shader& shader)
 	{
 		shader.useShaderProgram();
 
 		//set textures
-		for (GLuint i = 0; i < textures.size(); i++)
+		bindTextures(shader);
+
+		DrawGeometry();
+	}
+
+	void Mesh::DrawGeometry()
+	{
+		size_t indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		GLStateCache::bindVertexArray(this->buffers.VAO);
+		glDrawElementsBaseVertex(GL_TRIANGLES, this->indexCount, this->indexType,
+			(GLvoid*)(this->firstIndex * indexSize), this->baseVertex);
+		drawCalls++;
+	}
+
+	/* Instanced drawing function - one draw call for all instances */
+	void Mesh::DrawInstanced(gps::Shader& shader, GLsizei instanceCount)
+	{
+		shader.useShaderProgram();
+
+		//set textures
+		bindTextures(shader);
+
+		size_t indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		GLStateCache::bindVertexArray(this->buffers.VAO);
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, this->indexCount, this->indexType,
+			(GLvoid*)(this->firstIndex * indexSize), instanceCount, this->baseVertex);
+		drawCalls++;
+	}
+
+	void Mesh::setInstanceBuffer(GLuint instanceVBO)
+	{
+		//the instance attributes must not leak into the vertex array the arena shares with other meshes
+		if (this->arena && this->buffers.VAO == this->arena->getVertexArray(this->indexType)) {
+			this->buffers.VAO = this->arena->createVertexArray(this->indexType);
+		}
+
+		GLStateCache::bindVertexArray(this->buffers.VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+
+		// a mat4 attribute takes four consecutive vec4 locations
+		for (GLuint i = 0; i < 4; i++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+			glEnableVertexAttribArray(3 + i);
+			glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (GLvoid*)(i * sizeof(glm::vec4)));
+			glVertexAttribDivisor(3 + i, 1);
+		}
+
+		//the arena's draw index only has MAX_DRAW_INDICES entries and the instanced shaders do not read it
+		glDisableVertexAttribArray(7);
+
+		GLStateCache::bindVertexArray(0);
+	}
+
+	void Mesh::releaseBuffers()
+	{
+		if (!this->arena) {
+			glDeleteBuffers(1, &this->buffers.VBO);
+			glDeleteBuffers(1, &this->buffers.EBO);
+		}
+		//an arena mesh only owns its vertex array when instancing gave it one
+		if (!this->arena || this->buffers.VAO != this->arena->getVertexArray(this->indexType)) {
+			GLStateCache::forgetVertexArray(this->buffers.VAO);
+			glDeleteVertexArrays(1, &this->buffers.VAO);
 		}
+		this->buffers.VAO = 0;
+		this->buffers.VBO = 0;
+		this->buffers.EBO = 0;
+	}
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+	void Mesh::bindTextures(gps::Shader& shader)
+	{
+		//the atlas arrays stay bound for the whole frame, only the table entry changes
+		if (this->materialId >= 0)
+		{
+			shader.setInt("materialId", this->materialId);
+			return;
+		}
 
-        for(GLuint i = 0; i < this->textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i);
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
+		for (GLuint i = 0; i < textures.size(); i++)
+		{
+			shader.setInt(this->textures[i].type, i);
+			GLStateCache::bindTexture2D(i, this->textures[i].id);
+		}
 
-    }
+		//units this mesh does not use are left empty, as if the previous mesh had unbound them
+		for (GLuint i = textures.size(); i < MAX_MESH_TEXTURES; i++)
+		{
+			GLStateCache::bindTexture2D(i, 0);
+		}
+	}
 
 	// Initializes all the buffer objects/arrays
-	void Mesh::setupMesh(){
+	void Mesh::setupMesh(const Vertex* vertexData, const void* indexData){
+		//box first, then the sphere around its centre that reaches the furthest vertex
+		this->bounds = Bounds();
+		for (GLuint i = 0; i < this->vertexCount; i++) {
+			const glm::vec3& position = vertexData[i].Position;
+			this->bounds.min = i == 0 ? position : glm::min(this->bounds.min, position);
+			this->bounds.max = i == 0 ? position : glm::max(this->bounds.max, position);
+		}
+		this->bounds.center = (this->bounds.min + this->bounds.max) * 0.5f;
+		for (GLuint i = 0; i < this->vertexCount; i++) {
+			this->bounds.radius = glm::max(this->bounds.radius, glm::length(vertexData[i].Position - this->bounds.center));
+		}
+
+		this->arena = geometryArena;
+		if (this->arena) {
+			ArenaRange range = this->arena->allocate(vertexData, this->vertexCount, indexData, this->indexType, this->indexCount);
+			this->firstIndex = range.firstIndex;
+			this->baseVertex = range.baseVertex;
+			this->buffers.VAO = this->arena->getVertexArray(this->indexType);
+			this->buffers.VBO = this->arena->getVertexBuffer();
+			this->buffers.EBO = this->arena->getIndexBuffer(this->indexType);
+			return;
+		}
+		this->firstIndex = 0;
+		this->baseVertex = 0;
+
+		size_t indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+
 		// Create buffers/arrays
 		glGenVertexArrays(1, &this->buffers.VAO);
 		glGenBuffers(1, &this->buffers.VBO);
 		glGenBuffers(1, &this->buffers.EBO);
 
-		glBindVertexArray(this->buffers.VAO);
+		GLStateCache::bindVertexArray(this->buffers.VAO);
 		// Load data into vertex buffers
 		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, this->vertexCount * sizeof(Vertex), vertexData, GL_STATIC_DRAW);
 
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indexCount * indexSize, indexData, GL_STATIC_DRAW);
 
 		// Set the vertex attribute pointers
 		// Vertex Positions
@@ -66,6 +257,6 @@ namespace gps {
 		glEnableVertexAttribArray(2);
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
 
-		glBindVertexArray(0);
+		GLStateCache::bindVertexArray(0);
 	}
 }
@@ -5,6 +5,7 @@
 #include "glm/glm.hpp"
 
 #include "Shader.hpp"
+#include "Bounds.hpp"
 
 #include <string>
 #include <vector>
@@ -12,6 +13,8 @@
 
 namespace gps {
 
+class GeometryArena;
+
 struct Vertex
 {
     glm::vec3 Position;
@@ -34,6 +37,34 @@ struct Material
         glm::vec3 specular;
     };
 
+// ambient, diffuse and specular texture units used by a mesh
+const GLuint MAX_MESH_TEXTURES = 3;
+
+// CPU side of a mesh before upload, the geometry is either owned or points into a mapped mesh cache
+struct MeshData
+{
+    // owned geometry, empty when the mesh comes from a mesh cache
+    std::vector<Vertex> vertices;
+    std::vector<GLuint> indices;
+    std::vector<GLushort> shortIndices;
+
+    // what gets uploaded, set by usePackedIndices() or by the mesh cache reader
+    const Vertex* vertexData;
+    GLuint vertexCount;
+    const void* indexData;
+    GLenum indexType;
+    GLuint indexCount;
+
+    Material material;
+    // (type, path) of each texture
+    std::vector<std::pair<std::string, std::string> > textures;
+
+    MeshData();
+
+    // Points the upload fields at the owned vectors, packing the indices to 16 bits when they fit
+    void usePackedIndices();
+};
+
 struct Buffers {
     GLuint VAO;
     GLuint VBO;
@@ -43,22 +74,81 @@ struct Buffers {
 class Mesh
 {
 public:
+    // CPU copies of the geometry, empty for meshes uploaded straight from a mesh cache
     std::vector<Vertex> vertices;
     std::vector<GLuint> indices;
     std::vector<Texture> textures;
+    Material material;
+    // entry of the material atlas table the shaders read the textures through, -1 while the mesh binds its own
+    GLint materialId;
 
 	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
 
+	// Uploads the given vertex and index data without keeping a copy (indexType is GL_UNSIGNED_SHORT or GL_UNSIGNED_INT)
+	Mesh(const Vertex* vertexData, GLuint vertexCount, const void* indexData, GLenum indexType, GLuint indexCount, std::vector<Texture> textures);
+
+	// Uploads the CPU side mesh and takes over its owned geometry
+	Mesh(MeshData& data, std::vector<Texture> textures);
+
 	Buffers getBuffers();
 
-	void Draw(gps::Shader shader);
+	GLuint getVertexCount();
+	GLuint getIndexCount();
+
+	// GL_UNSIGNED_SHORT when every vertex can be addressed with 16 bits, GL_UNSIGNED_INT otherwise
+	GLenum getIndexType();
+
+	// Position of the mesh in its index and vertex buffers, both 0 unless it lives in a geometry arena
+	GLuint getFirstIndex();
+	GLint getBaseVertex();
+
+	// True when the geometry was placed in the geometry arena instead of buffers of its own
+	bool isInArena();
+
+	// Size in bytes of the vertex and index data uploaded to the GPU
+	size_t getGPUBytes();
+
+	// Object-space box and sphere around the vertices, computed when the mesh is uploaded
+	const Bounds& getBounds() const;
+
+	void Draw(gps::Shader& shader);
+
+	// Binds the mesh textures to consecutive texture units, or selects its material atlas entry once it has one
+	void bindTextures(gps::Shader& shader);
+
+	// Issues the draw call with the textures already bound, for callers that share bindTextures between meshes
+	void DrawGeometry();
+
+	// Draws instanceCount copies of the mesh, reading per-instance model matrices from the attached instance buffer
+	void DrawInstanced(gps::Shader& shader, GLsizei instanceCount);
+
+	// Binds a buffer of glm::mat4 model matrices to attribute locations 3..6 (one matrix per instance)
+	void setInstanceBuffer(GLuint instanceVBO);
+
+	// Deletes the buffers and vertex array the mesh owns, arena storage stays with the arena
+	void releaseBuffers();
+
+	// Number of glDrawElements* calls issued by all meshes since the last reset
+	static GLuint drawCalls;
+
+	// When set, meshes created afterwards are copied into it instead of getting their own buffers
+	static gps::GeometryArena* geometryArena;
 
 private:
     /*  Render data  */
     Buffers buffers;
+    GLenum indexType;
+    GLuint vertexCount;
+    GLuint indexCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    // arena holding the geometry, NULL when the mesh owns its buffers
+    gps::GeometryArena* arena;
+    Bounds bounds;
 
 	// Initializes all the buffer objects/arrays
-	void setupMesh();
+	void setupMesh(const Vertex* vertexData, const void* indexData);
+
 
 };
 
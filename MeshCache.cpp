@@ -0,0 +1,385 @@
+#include "MeshCache.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace gps {
+
+	static const char MAGIC[4] = { 'G', 'M', 'C', 'H' };
+	// bump whenever the layout below or the mesh processing changes
+	static const uint32_t VERSION = 1;
+	static const uint64_t BLOB_ALIGNMENT = 16;
+
+	struct FileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t cacheSize;
+		uint64_t sourceSize;
+		uint64_t sourceTimeHash;
+		uint32_t flags;
+		uint32_t meshCount;
+	};
+
+	struct MeshRecord
+	{
+		uint64_t vertexOffset;
+		uint64_t indexOffset;
+		uint64_t textureOffset;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t indexType;
+		uint32_t textureCount;
+		float ambient[3];
+		float diffuse[3];
+		float specular[3];
+		uint32_t padding;
+	};
+
+	static uint64_t alignUp(uint64_t offset)
+	{
+		return (offset + BLOB_ALIGNMENT - 1) & ~(BLOB_ALIGNMENT - 1);
+	}
+
+	static uint32_t indexSize(GLenum indexType)
+	{
+		return indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+	}
+
+	//whether bytes at offset fit in a file of size, without the sum wrapping around
+	static bool fits(uint64_t offset, uint64_t bytes, uint64_t size)
+	{
+		return offset <= size && bytes <= size - offset;
+	}
+
+	//every index must name a vertex of its own mesh, in the shared arena a stray one reads another mesh
+	static bool indicesInRange(const char* indices, GLenum indexType, uint32_t indexCount, uint32_t vertexCount)
+	{
+		for (uint32_t i = 0; i < indexCount; i++) {
+			uint32_t index;
+			if (indexType == GL_UNSIGNED_SHORT) {
+				GLushort shortIndex;
+				memcpy(&shortIndex, indices + i * sizeof(GLushort), sizeof(shortIndex));
+				index = shortIndex;
+			}
+			else {
+				memcpy(&index, indices + i * sizeof(GLuint), sizeof(index));
+			}
+			if (index >= vertexCount) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	MappedFile::MappedFile() : data(NULL), size(0)
+#ifdef _WIN32
+		, fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL)
+#else
+		, fileDescriptor(-1)
+#endif
+	{
+	}
+
+	MappedFile::~MappedFile()
+	{
+		close();
+	}
+
+	bool MappedFile::open(const std::string& fileName)
+	{
+		close();
+
+#ifdef _WIN32
+		fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (fileHandle == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+			close();
+			return false;
+		}
+
+		mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mappingHandle == NULL) {
+			close();
+			return false;
+		}
+
+		data = (const char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+		size = (size_t)fileSize.QuadPart;
+#else
+		fileDescriptor = ::open(fileName.c_str(), O_RDONLY);
+		if (fileDescriptor < 0) {
+			return false;
+		}
+
+		struct stat fileInfo;
+		if (fstat(fileDescriptor, &fileInfo) != 0 || fileInfo.st_size == 0) {
+			close();
+			return false;
+		}
+
+		void* mapping = mmap(NULL, fileInfo.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+		if (mapping == MAP_FAILED) {
+			close();
+			return false;
+		}
+
+		data = (const char*)mapping;
+		size = (size_t)fileInfo.st_size;
+#endif
+
+		if (data == NULL) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+#ifdef _WIN32
+		if (data) {
+			UnmapViewOfFile(data);
+		}
+		if (mappingHandle) {
+			CloseHandle(mappingHandle);
+		}
+		if (fileHandle != INVALID_HANDLE_VALUE) {
+			CloseHandle(fileHandle);
+		}
+		mappingHandle = NULL;
+		fileHandle = INVALID_HANDLE_VALUE;
+#else
+		if (data) {
+			munmap((void*)data, size);
+		}
+		if (fileDescriptor >= 0) {
+			::close(fileDescriptor);
+		}
+		fileDescriptor = -1;
+#endif
+		data = NULL;
+		size = 0;
+	}
+
+	const char* MappedFile::getData() const
+	{
+		return data;
+	}
+
+	size_t MappedFile::getSize() const
+	{
+		return size;
+	}
+
+	std::string MeshCache::cacheFileName(const std::string& objFileName)
+	{
+		return objFileName + ".meshcache";
+	}
+
+	bool MeshCache::readSource(const std::string& objFileName, uint32_t flags, MeshCacheSource& source)
+	{
+#ifdef _WIN32
+		struct _stat64 fileInfo;
+		if (_stat64(objFileName.c_str(), &fileInfo) != 0) {
+			return false;
+		}
+#else
+		struct stat fileInfo;
+		if (stat(objFileName.c_str(), &fileInfo) != 0) {
+			return false;
+		}
+#endif
+
+		//FNV-1a over the bytes of the modification time
+		uint64_t modificationTime = (uint64_t)fileInfo.st_mtime;
+		uint64_t hash = 14695981039346656037ull;
+		for (int i = 0; i < 8; i++) {
+			hash ^= (modificationTime >> (8 * i)) & 0xFF;
+			hash *= 1099511628211ull;
+		}
+
+		source.fileSize = (uint64_t)fileInfo.st_size;
+		source.timeHash = hash;
+		source.flags = flags;
+		return true;
+	}
+
+	bool MeshCache::read(const std::string& fileName, const MeshCacheSource& source, MappedFile& file, std::vector<MeshData>& meshes)
+	{
+		meshes.clear();
+		if (!file.open(fileName)) {
+			return false;
+		}
+
+		const char* data = file.getData();
+		uint64_t size = file.getSize();
+
+		FileHeader header;
+		if (size < sizeof(header)) {
+			return false;
+		}
+		memcpy(&header, data, sizeof(header));
+
+		if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION ||
+			header.cacheSize != size || header.sourceSize != source.fileSize ||
+			header.sourceTimeHash != source.timeHash || header.flags != source.flags) {
+			return false;
+		}
+
+		if (sizeof(header) + (uint64_t)header.meshCount * sizeof(MeshRecord) > size) {
+			return false;
+		}
+
+		for (uint32_t m = 0; m < header.meshCount; m++) {
+			MeshRecord record;
+			memcpy(&record, data + sizeof(header) + m * sizeof(MeshRecord), sizeof(record));
+
+			if (record.indexType != GL_UNSIGNED_SHORT && record.indexType != GL_UNSIGNED_INT) {
+				return false;
+			}
+			if (!fits(record.vertexOffset, (uint64_t)record.vertexCount * sizeof(Vertex), size) ||
+				!fits(record.indexOffset, (uint64_t)record.indexCount * indexSize(record.indexType), size) ||
+				!indicesInRange(data + record.indexOffset, record.indexType, record.indexCount, record.vertexCount)) {
+				return false;
+			}
+
+			MeshData mesh;
+			mesh.vertexData = (const Vertex*)(data + record.vertexOffset);
+			mesh.vertexCount = record.vertexCount;
+			mesh.indexData = data + record.indexOffset;
+			mesh.indexType = record.indexType;
+			mesh.indexCount = record.indexCount;
+			mesh.material.ambient = glm::vec3(record.ambient[0], record.ambient[1], record.ambient[2]);
+			mesh.material.diffuse = glm::vec3(record.diffuse[0], record.diffuse[1], record.diffuse[2]);
+			mesh.material.specular = glm::vec3(record.specular[0], record.specular[1], record.specular[2]);
+
+			//texture table: type length, path length, type, path
+			uint64_t offset = record.textureOffset;
+			for (uint32_t t = 0; t < record.textureCount; t++) {
+				uint32_t lengths[2];
+				if (!fits(offset, sizeof(lengths), size)) {
+					return false;
+				}
+				memcpy(lengths, data + offset, sizeof(lengths));
+				offset += sizeof(lengths);
+
+				if (!fits(offset, (uint64_t)lengths[0] + lengths[1], size)) {
+					return false;
+				}
+				std::string type(data + offset, lengths[0]);
+				std::string path(data + offset + lengths[0], lengths[1]);
+				offset += lengths[0] + lengths[1];
+
+				mesh.textures.push_back(std::make_pair(type, path));
+			}
+
+			meshes.push_back(mesh);
+		}
+
+		return true;
+	}
+
+	static void writePadding(std::ofstream& out, uint64_t& offset, uint64_t target)
+	{
+		static const char zeros[BLOB_ALIGNMENT] = { 0 };
+		out.write(zeros, target - offset);
+		offset = target;
+	}
+
+	bool MeshCache::write(const std::string& fileName, const MeshCacheSource& source, const std::vector<MeshData>& meshes)
+	{
+		//lay out the file: header, mesh records, then per mesh its texture table and aligned geometry
+		std::vector<MeshRecord> records(meshes.size());
+		uint64_t offset = sizeof(FileHeader) + meshes.size() * sizeof(MeshRecord);
+
+		for (size_t m = 0; m < meshes.size(); m++) {
+			const MeshData& mesh = meshes[m];
+			MeshRecord& record = records[m];
+			memset(&record, 0, sizeof(record));
+
+			record.vertexCount = mesh.vertexCount;
+			record.indexCount = mesh.indexCount;
+			record.indexType = mesh.indexType;
+			record.textureCount = (uint32_t)mesh.textures.size();
+			for (int c = 0; c < 3; c++) {
+				record.ambient[c] = mesh.material.ambient[c];
+				record.diffuse[c] = mesh.material.diffuse[c];
+				record.specular[c] = mesh.material.specular[c];
+			}
+
+			record.textureOffset = offset;
+			for (size_t t = 0; t < mesh.textures.size(); t++) {
+				offset += 2 * sizeof(uint32_t) + mesh.textures[t].first.size() + mesh.textures[t].second.size();
+			}
+
+			record.vertexOffset = alignUp(offset);
+			offset = record.vertexOffset + (uint64_t)record.vertexCount * sizeof(Vertex);
+			record.indexOffset = alignUp(offset);
+			offset = record.indexOffset + (uint64_t)record.indexCount * indexSize(record.indexType);
+		}
+
+		FileHeader header;
+		memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version = VERSION;
+		header.cacheSize = offset;
+		header.sourceSize = source.fileSize;
+		header.sourceTimeHash = source.timeHash;
+		header.flags = source.flags;
+		header.meshCount = (uint32_t)meshes.size();
+
+		std::ofstream out(fileName.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out) {
+			return false;
+		}
+
+		out.write((const char*)&header, sizeof(header));
+		if (!records.empty()) {
+			out.write((const char*)&records[0], records.size() * sizeof(MeshRecord));
+		}
+
+		offset = sizeof(FileHeader) + meshes.size() * sizeof(MeshRecord);
+		for (size_t m = 0; m < meshes.size(); m++) {
+			const MeshData& mesh = meshes[m];
+			const MeshRecord& record = records[m];
+
+			for (size_t t = 0; t < mesh.textures.size(); t++) {
+				uint32_t lengths[2] = { (uint32_t)mesh.textures[t].first.size(), (uint32_t)mesh.textures[t].second.size() };
+				out.write((const char*)lengths, sizeof(lengths));
+				out.write(mesh.textures[t].first.data(), lengths[0]);
+				out.write(mesh.textures[t].second.data(), lengths[1]);
+				offset += sizeof(lengths) + lengths[0] + lengths[1];
+			}
+
+			writePadding(out, offset, record.vertexOffset);
+			if (record.vertexCount > 0) {
+				out.write((const char*)mesh.vertexData, (uint64_t)record.vertexCount * sizeof(Vertex));
+			}
+			offset += (uint64_t)record.vertexCount * sizeof(Vertex);
+
+			writePadding(out, offset, record.indexOffset);
+			if (record.indexCount > 0) {
+				out.write((const char*)mesh.indexData, (uint64_t)record.indexCount * indexSize(record.indexType));
+			}
+			offset += (uint64_t)record.indexCount * indexSize(record.indexType);
+		}
+
+		return out.good();
+	}
+
+}
@@ -0,0 +1,65 @@
+#ifndef MeshCache_hpp
+#define MeshCache_hpp
+
+#include "Mesh.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool open(const std::string& fileName);
+    void close();
+
+    const char* getData() const;
+    size_t getSize() const;
+
+private:
+    const char* data;
+    size_t size;
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#else
+    int fileDescriptor;
+#endif
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
+
+// Identifies the .obj a cache was built from, and how it was processed
+struct MeshCacheSource
+{
+    uint64_t fileSize;
+    uint64_t timeHash;
+    uint32_t flags;
+};
+
+// Binary copy of a loaded model, stored next to the .obj as <name>.obj.meshcache
+class MeshCache
+{
+public:
+    static std::string cacheFileName(const std::string& objFileName);
+
+    // Size and modification time of the source file, false if it cannot be read
+    static bool readSource(const std::string& objFileName, uint32_t flags, MeshCacheSource& source);
+
+    // Maps the cache and points the meshes into it (valid while the file stays mapped), false if it is missing, stale or damaged
+    static bool read(const std::string& fileName, const MeshCacheSource& source, MappedFile& file, std::vector<MeshData>& meshes);
+
+    // Writes the upload data of the meshes, false on I/O errors
+    static bool write(const std::string& fileName, const MeshCacheSource& source, const std::vector<MeshData>& meshes);
+};
+
+}
+
+#endif /* MeshCache_hpp */
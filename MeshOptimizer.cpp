@@ -0,0 +1,170 @@
+#include "MeshOptimizer.hpp"
+
+namespace gps {
+
+	float MeshOptimizer::computeACMR(const std::vector<GLuint>& indices, size_t vertexCount, int cacheSize)
+	{
+		if (indices.size() < 3) {
+			return 0.0f;
+		}
+
+		//FIFO cache, a vertex is in the cache if it entered less than cacheSize misses ago
+		std::vector<size_t> entered(vertexCount, 0);
+		size_t misses = 0;
+
+		for (size_t i = 0; i < indices.size(); i++) {
+			GLuint v = indices[i];
+			if (entered[v] == 0 || misses - entered[v] >= (size_t)cacheSize) {
+				misses++;
+				entered[v] = misses;
+			}
+		}
+
+		return (float)misses / (float)(indices.size() / 3);
+	}
+
+	// Next fanning vertex: the candidate that will stay in the cache longest, else a dead-end vertex
+	static int nextVertex(const std::vector<GLuint>& candidates, const std::vector<int>& cacheTime,
+		const std::vector<int>& liveTriangles, std::vector<GLuint>& deadEnd, int timeStamp, int cacheSize,
+		size_t& cursor)
+	{
+		int best = -1;
+		int bestPriority = -1;
+
+		for (size_t i = 0; i < candidates.size(); i++) {
+			GLuint v = candidates[i];
+			if (liveTriangles[v] <= 0) {
+				continue;
+			}
+
+			int priority = 0;
+			//still in the cache after fanning all of its remaining triangles
+			if (timeStamp - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) {
+				priority = timeStamp - cacheTime[v];
+			}
+
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				best = v;
+			}
+		}
+
+		if (best != -1) {
+			return best;
+		}
+
+		//dead end, try recently used vertices first
+		while (!deadEnd.empty()) {
+			GLuint v = deadEnd.back();
+			deadEnd.pop_back();
+			if (liveTriangles[v] > 0) {
+				return v;
+			}
+		}
+
+		//then continue in input order
+		while (cursor < liveTriangles.size()) {
+			if (liveTriangles[cursor] > 0) {
+				return (int)cursor;
+			}
+			cursor++;
+		}
+
+		return -1;
+	}
+
+	void MeshOptimizer::optimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount, int cacheSize)
+	{
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0 || vertexCount == 0) {
+			return;
+		}
+
+		//vertex -> triangles adjacency, stored as offsets into one array
+		std::vector<int> liveTriangles(vertexCount, 0);
+		for (size_t i = 0; i < triangleCount * 3; i++) {
+			liveTriangles[indices[i]]++;
+		}
+
+		std::vector<size_t> adjacencyOffset(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; v++) {
+			adjacencyOffset[v + 1] = adjacencyOffset[v] + liveTriangles[v];
+		}
+
+		std::vector<GLuint> adjacency(adjacencyOffset[vertexCount]);
+		std::vector<size_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+		for (size_t t = 0; t < triangleCount; t++) {
+			for (int corner = 0; corner < 3; corner++) {
+				adjacency[fill[indices[3 * t + corner]]++] = (GLuint)t;
+			}
+		}
+
+		std::vector<int> cacheTime(vertexCount, 0);
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<GLuint> deadEnd;
+		std::vector<GLuint> candidates;
+		std::vector<GLuint> output;
+		output.reserve(triangleCount * 3);
+
+		int timeStamp = cacheSize + 1;
+		size_t cursor = 0;
+		int fanning = nextVertex(candidates, cacheTime, liveTriangles, deadEnd, timeStamp, cacheSize, cursor);
+
+		while (fanning >= 0) {
+			candidates.clear();
+
+			for (size_t a = adjacencyOffset[fanning]; a < adjacencyOffset[fanning + 1]; a++) {
+				GLuint t = adjacency[a];
+				if (emitted[t]) {
+					continue;
+				}
+
+				for (int corner = 0; corner < 3; corner++) {
+					GLuint v = indices[3 * t + corner];
+					output.push_back(v);
+					deadEnd.push_back(v);
+					candidates.push_back(v);
+					liveTriangles[v]--;
+
+					//not in the cache any more, it is transformed again
+					if (timeStamp - cacheTime[v] > cacheSize) {
+						cacheTime[v] = timeStamp;
+						timeStamp++;
+					}
+				}
+
+				emitted[t] = true;
+			}
+
+			fanning = nextVertex(candidates, cacheTime, liveTriangles, deadEnd, timeStamp, cacheSize, cursor);
+		}
+
+		//keep any trailing indices that do not form a triangle
+		for (size_t i = triangleCount * 3; i < indices.size(); i++) {
+			output.push_back(indices[i]);
+		}
+
+		indices.swap(output);
+	}
+
+	void MeshOptimizer::optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices)
+	{
+		const GLuint UNUSED = 0xFFFFFFFFu;
+		std::vector<GLuint> remap(vertices.size(), UNUSED);
+		std::vector<Vertex> reordered;
+		reordered.reserve(vertices.size());
+
+		for (size_t i = 0; i < indices.size(); i++) {
+			GLuint v = indices[i];
+			if (remap[v] == UNUSED) {
+				remap[v] = (GLuint)reordered.size();
+				reordered.push_back(vertices[v]);
+			}
+			indices[i] = remap[v];
+		}
+
+		//vertices no triangle refers to are dropped
+		vertices.swap(reordered);
+	}
+
+}
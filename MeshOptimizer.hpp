@@ -0,0 +1,29 @@
+#ifndef MeshOptimizer_hpp
+#define MeshOptimizer_hpp
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+// Reorders welded triangle lists for the post-transform vertex cache and for vertex fetch
+class MeshOptimizer
+{
+public:
+    // cache size the reordering targets and ACMR is measured against
+    static const int CACHE_SIZE = 16;
+
+    // Average cache miss ratio (transformed vertices per triangle) of a FIFO cache
+    static float computeACMR(const std::vector<GLuint>& indices, size_t vertexCount, int cacheSize = CACHE_SIZE);
+
+    // Reorders triangles with Tipsify for better vertex cache hit rate
+    static void optimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount, int cacheSize = CACHE_SIZE);
+
+    // Renumbers vertices in first-use order so the fetch walks memory forwards
+    static void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
+};
+
+}
+
+#endif /* MeshOptimizer_hpp */
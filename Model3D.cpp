@@ -1,29 +1,179 @@
 #include "Model3D.hpp"
+#include "GLStateCache.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshCache.hpp"
+#include "TextureStreamer.hpp"
+#include "TextureCache.hpp"
+#include "ImageOps.hpp"
+
+#include <chrono>
+#include <sstream>
+#include <unordered_map>
 
 namespace gps {
 
+	bool Model3D::optimizeMeshes = true;
+	TextureStreamer* Model3D::textureStreamer = NULL;
+	TextureCompression Model3D::textureCompression = TEXTURE_COMPRESSION_BC1_BC3;
+	MipFilter Model3D::textureMipFilter = MIP_FILTER_BOX;
+
+	// OBJ face corners with the same position, normal and texcoord indices share one vertex
+	struct VertexKey
+	{
+		int vertex;
+		int normal;
+		int texcoord;
+
+		bool operator==(const VertexKey& other) const {
+			return vertex == other.vertex && normal == other.normal && texcoord == other.texcoord;
+		}
+	};
+
+	struct VertexKeyHash
+	{
+		size_t operator()(const VertexKey& key) const {
+			size_t hash = (size_t)key.vertex * 73856093u;
+			hash ^= (size_t)key.normal * 19349663u;
+			hash ^= (size_t)key.texcoord * 83492791u;
+			return hash;
+		}
+	};
+
+	static double millisecondsSince(std::chrono::high_resolution_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
 	void Model3D::LoadModel(std::string fileName)
 	{
         std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
-		ReadOBJ(fileName, basePath);
+		LoadModel(fileName, basePath);
 	}
 
     void Model3D::LoadModel(std::string fileName, std::string basePath)
 	{
-		ReadOBJ(fileName, basePath);
+		ModelData data;
+		ReadModelData(fileName, basePath, data);
+		for (size_t i = 0; i < data.images.size(); i++) {
+			DecodeImage(data.images[i]);
+		}
+		Upload(data);
 	}
 
 	// Draw each mesh from the model
-	void Model3D::Draw(gps::Shader shaderProgram)
+	void Model3D::Draw(gps::Shader& shaderProgram)
 	{
 		for (int i = 0; i < meshes.size(); i++)
 			meshes[i].Draw(shaderProgram);
 	}
 
+	void Model3D::Draw(gps::Shader& shaderProgram, const gps::Frustum& frustum, const glm::mat4& model, gps::CullStats& stats)
+	{
+		//one test for the whole model saves testing each of its meshes
+		if (!frustum.intersects(bounds, model)) {
+			stats.culled += (GLuint)meshes.size();
+			return;
+		}
+
+		for (int i = 0; i < meshes.size(); i++) {
+			if (meshes.size() > 1 && !frustum.intersects(meshes[i].getBounds(), model)) {
+				stats.culled++;
+				continue;
+			}
+			stats.visible++;
+			meshes[i].Draw(shaderProgram);
+		}
+	}
+
+	// Draw each mesh from the model once for all instances
+	void Model3D::DrawInstanced(gps::Shader& shaderProgram, GLsizei instanceCount)
+	{
+		for (int i = 0; i < meshes.size(); i++)
+			meshes[i].DrawInstanced(shaderProgram, instanceCount);
+	}
+
+	void Model3D::setInstanceBuffer(GLuint instanceVBO)
+	{
+		for (int i = 0; i < meshes.size(); i++)
+			meshes[i].setInstanceBuffer(instanceVBO);
+	}
+
+	void Model3D::releaseTextures()
+	{
+		for (size_t i = 0; i < loadedTextures.size(); i++) {
+			GLStateCache::forgetTexture(loadedTextures[i].id);
+			glDeleteTextures(1, &loadedTextures[i].id);
+		}
+		//the destructor must not delete them again
+		loadedTextures.clear();
+	}
+
+	const gps::Bounds& Model3D::getBounds() const
+	{
+		return bounds;
+	}
+
+	// Loads the model from its mesh cache, or parses the .obj and writes the cache
+	void Model3D::ReadModelData(std::string fileName, std::string basePath, ModelData& data){
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+		data.fileName = fileName;
+		data.meshes.clear();
+		data.images.clear();
+		data.log.clear();
+
+		//the cache holds optimized or unoptimized meshes, it must match the current setting
+		MeshCacheSource source;
+		bool hasSource = MeshCache::readSource(fileName, optimizeMeshes ? 1 : 0, source);
+		std::string cacheFileName = MeshCache::cacheFileName(fileName);
+
+		//geometry is uploaded from the mapped file straight into the buffers
+		data.cacheFile = std::make_shared<MappedFile>();
+		data.cacheHit = hasSource && MeshCache::read(cacheFileName, source, *data.cacheFile, data.meshes);
+
+		if (data.cacheHit) {
+			data.log += "Loading : " + fileName + " (from " + cacheFileName + ")\n";
+		}
+		else {
+			data.cacheFile.reset();
+			ParseOBJ(fileName, basePath, data);
+
+			if (hasSource && !MeshCache::write(cacheFileName, source, data.meshes)) {
+				data.log += "WARNING: could not write mesh cache " + cacheFileName + "\n";
+			}
+		}
+
+		//each texture is decoded once even if several meshes use it, a texture streamer decodes them itself
+		for (size_t m = 0; m < data.meshes.size() && textureStreamer == NULL; m++) {
+			for (size_t t = 0; t < data.meshes[m].textures.size(); t++) {
+				const std::string& path = data.meshes[m].textures[t].second;
+
+				bool listed = false;
+				for (size_t i = 0; i < data.images.size() && !listed; i++) {
+					listed = data.images[i].path == path;
+				}
+
+				if (!listed) {
+					gps::ImageData image;
+					image.path = path;
+					image.width = 0;
+					image.height = 0;
+					image.decodeMs = 0.0;
+					data.images.push_back(image);
+				}
+			}
+		}
+
+		data.readMs = millisecondsSince(start);
+	}
+
 	// Does the parsing of the .obj file and fills in the data structure
-	void Model3D::ReadOBJ(std::string fileName, std::string basePath){
+	void Model3D::ParseOBJ(std::string fileName, std::string basePath, ModelData& data){
 
-        std::cout << "Loading : " << fileName << std::endl;
+		//this runs on loader threads, the messages are printed when the model is uploaded
+		std::ostringstream log;
+        log << "Loading : " << fileName << std::endl;
 		tinyobj::attrib_t attrib;
 		std::vector<tinyobj::shape_t> shapes;
 		std::vector<tinyobj::material_t> materials;
@@ -33,21 +183,30 @@ namespace gps {
 		bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
 
 		if (!err.empty()) { // `err` may contain warning message.
-			std::cerr << err << std::endl;
+			log << err << std::endl;
 		}
 
 		if (!ret) {
+			std::cerr << log.str();
 			exit(1);
 		}
 
-		std::cout << "# of shapes    : " << shapes.size() << std::endl;
-		std::cout << "# of materials : " << materials.size() << std::endl;
+		log << "# of shapes    : " << shapes.size() << std::endl;
+		log << "# of materials : " << materials.size() << std::endl;
+
+		size_t cornerCount = 0;
+		size_t weldedVertexCount = 0;
+		size_t weldedBytes = 0;
 
 		// Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) {
-			std::vector<gps::Vertex> vertices;
-			std::vector<GLuint> indices;
-			std::vector<gps::Texture> textures;
+			data.meshes.push_back(gps::MeshData());
+			gps::MeshData& mesh = data.meshes.back();
+			std::vector<gps::Vertex>& vertices = mesh.vertices;
+			std::vector<GLuint>& indices = mesh.indices;
+			std::vector<std::pair<std::string, std::string> >& textures = mesh.textures;
+			gps::Material material = gps::Material();
+			std::unordered_map<VertexKey, GLuint, VertexKeyHash> uniqueVertices;
 
 			// Loop over faces(polygon)
 			size_t index_offset = 0;
@@ -62,6 +221,17 @@ namespace gps {
 					// access to vertex
 					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
 
+					VertexKey key;
+					key.vertex = idx.vertex_index;
+					key.normal = idx.normal_index;
+					key.texcoord = idx.texcoord_index;
+
+					std::unordered_map<VertexKey, GLuint, VertexKeyHash>::iterator welded = uniqueVertices.find(key);
+					if (welded != uniqueVertices.end()) {
+						indices.push_back(welded->second);
+						continue;
+					}
+
 					float vx = attrib.vertices[3 * idx.vertex_index + 0];
 					float vy = attrib.vertices[3 * idx.vertex_index + 1];
 					float vz = attrib.vertices[3 * idx.vertex_index + 2];
@@ -84,9 +254,9 @@ namespace gps {
 					currentVertex.Normal = vertexNormal;
 					currentVertex.TexCoords = vertexTexCoords;
 
+					uniqueVertices[key] = vertices.size();
+					indices.push_back(vertices.size());
 					vertices.push_back(currentVertex);
-
-					indices.push_back(index_offset + v);
 				}
 
 				index_offset += fv;
@@ -102,42 +272,81 @@ namespace gps {
 					currentMaterial.ambient = glm::vec3(materials[materialId].ambient[0], materials[materialId].ambient[1], materials[materialId].ambient[2]);
 					currentMaterial.diffuse = glm::vec3(materials[materialId].diffuse[0], materials[materialId].diffuse[1], materials[materialId].diffuse[2]);
 					currentMaterial.specular = glm::vec3(materials[materialId].specular[0], materials[materialId].specular[1], materials[materialId].specular[2]);
+					material = currentMaterial;
 
 					//ambient texture
 					std::string ambientTexturePath = materials[materialId].ambient_texname;
 					if (!ambientTexturePath.empty())
 					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + ambientTexturePath, "ambientTexture");
-						textures.push_back(currentTexture);
+						textures.push_back(std::make_pair(std::string("ambientTexture"), basePath + ambientTexturePath));
 					}
 
 					//diffuse texture
 					std::string diffuseTexturePath = materials[materialId].diffuse_texname;
 					if (!diffuseTexturePath.empty())
 					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + diffuseTexturePath, "diffuseTexture");
-						textures.push_back(currentTexture);
+						textures.push_back(std::make_pair(std::string("diffuseTexture"), basePath + diffuseTexturePath));
 					}
 
 					//specular texture
 					std::string specularTexturePath = materials[materialId].specular_texname;
 					if (!specularTexturePath.empty())
 					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + specularTexturePath, "specularTexture");
-						textures.push_back(currentTexture);
+						textures.push_back(std::make_pair(std::string("specularTexture"), basePath + specularTexturePath));
 					}
 				}
 			}
 
-			meshes.push_back(gps::Mesh(vertices, indices, textures));
+			if (optimizeMeshes) {
+				float acmrBefore = MeshOptimizer::computeACMR(indices, vertices.size());
+				MeshOptimizer::optimizeVertexCache(indices, vertices.size());
+				MeshOptimizer::optimizeVertexFetch(vertices, indices);
+				float acmrAfter = MeshOptimizer::computeACMR(indices, vertices.size());
+				log << "  mesh " << s << " ACMR : " << acmrBefore << " -> " << acmrAfter << std::endl;
+			}
+
+			mesh.material = material;
+			mesh.usePackedIndices();
+
+			size_t indexSize = mesh.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+			cornerCount += indices.size();
+			weldedVertexCount += vertices.size();
+			weldedBytes += vertices.size() * sizeof(gps::Vertex) + indices.size() * indexSize;
 		}
+
+		//one vertex and one 32-bit index per face corner before welding
+		size_t unweldedBytes = cornerCount * (sizeof(gps::Vertex) + sizeof(GLuint));
+		log << "# of vertices  : " << cornerCount << " -> " << weldedVertexCount << " after welding" << std::endl;
+		log << "# of bytes     : " << unweldedBytes << " -> " << weldedBytes << std::endl;
+		data.log += log.str();
+	}
+
+	// Creates the GL objects for data read on any thread
+	void Model3D::Upload(ModelData& data) {
+
+		for (size_t m = 0; m < data.meshes.size(); m++) {
+			gps::MeshData& mesh = data.meshes[m];
+
+			std::vector<gps::Texture> textures;
+			for (size_t t = 0; t < mesh.textures.size(); t++) {
+				textures.push_back(LoadTexture(mesh.textures[t].second, mesh.textures[t].first, data));
+			}
+
+			meshes.push_back(gps::Mesh(mesh, textures));
+			bounds.merge(meshes.back().getBounds());
+		}
+
+		std::cout << data.log;
+		std::cout << "Loaded " << data.fileName << " in " << data.readMs << " ms (" << (data.cacheHit ? "warm, mesh cache" : "cold, .obj") << ")" << std::endl;
+
+		//the pixels and the cache mapping are not needed once they are in video memory
+		data.meshes.clear();
+		data.images.clear();
+		data.cacheFile.reset();
 	}
 
 	// Retrieves a texture associated with the object - by its name and type
-	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
+	gps::Texture Model3D::LoadTexture(std::string path, std::string type, const ModelData& data) {
 
 			for (int i = 0; i < loadedTextures.size(); i++) {
 				if (loadedTextures[i].path == path)
@@ -148,7 +357,16 @@ namespace gps {
 			}
 
 			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
+			currentTexture.id = 0;
+			if (textureStreamer) {
+				currentTexture.id = textureStreamer->request(path);
+			}
+			for (size_t i = 0; i < data.images.size(); i++) {
+				if (data.images[i].path == path) {
+					currentTexture.id = ReadTextureFromImage(data.images[i]);
+					break;
+				}
+			}
 			currentTexture.type = std::string(type);
 			currentTexture.path = path;
 
@@ -157,14 +375,38 @@ namespace gps {
 			return currentTexture;
 		}
 
-	// Reads the pixel data from an image file and loads it into the video memory
-	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
+	// Reads the pixel data from an image file and flips it for OpenGL
+	void Model3D::DecodeImage(ImageData& image, bool flipRows) {
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		const char* file_name = image.path.c_str();
+		image.compressed.reset();
+
+		//a warm texture cache is uploaded as it is mapped, nothing is decoded
+		MeshCacheSource source;
+		//a cache built with another compression or mip filter is stale
+		bool hasSource = textureCompression != TEXTURE_COMPRESSION_NONE &&
+			MeshCache::readSource(image.path, textureCompression | (textureMipFilter << 8), source);
+		std::string cacheFileName = TextureCache::cacheFileName(image.path);
+		if (hasSource) {
+			std::shared_ptr<CompressedImage> compressed = std::make_shared<CompressedImage>();
+			if (TextureCache::read(cacheFileName, source, *compressed)) {
+				image.width = compressed->levels[0].width;
+				image.height = compressed->levels[0].height;
+				image.pixels.reset();
+				image.compressed = compressed;
+				image.decodeMs = millisecondsSince(start);
+				return;
+			}
+		}
+
+		//decoded in the file's own channel count, the expansion to RGBA is vectorized
 		int x, y, n;
-		int force_channels = 4;
-		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
+		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, 0);
 		if (!image_data) {
 			fprintf(stderr, "ERROR: could not load %s\n", file_name);
-			return false;
+			image.pixels.reset();
+			image.decodeMs = millisecondsSince(start);
+			return;
 		}
 		// NPOT check
 		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
@@ -173,61 +415,89 @@ namespace gps {
 			);
 		}
 
-		int width_in_bytes = x * 4;
-		unsigned char *top = NULL;
-		unsigned char *bottom = NULL;
-		unsigned char temp = 0;
-		int half_height = y / 2;
-
-		for (int row = 0; row < half_height; row++) {
-			top = image_data + row * width_in_bytes;
-			bottom = image_data + (y - row - 1) * width_in_bytes;
-			for (int col = 0; col < width_in_bytes; col++) {
-				temp = *top;
-				*top = *bottom;
-				*bottom = temp;
-				top++;
-				bottom++;
+		if (n == 4) {
+			image.pixels.reset(image_data, stbi_image_free);
+		}
+		else {
+			image.pixels.reset(new unsigned char[(size_t)x * y * 4], std::default_delete<unsigned char[]>());
+			ImageOps::expandToRGBA(image_data, n, image.pixels.get(), (size_t)x * y);
+			stbi_image_free(image_data);
+		}
+		image_data = image.pixels.get();
+
+		//blocks are encoded bottom row first whatever the caller asked for; stbi's own flip is a
+		//process-wide setting, while the decode jobs of the streamer and the loader want different orders
+		bool compress = textureCompression != TEXTURE_COMPRESSION_NONE;
+		if (flipRows || compress) {
+			ImageOps::flipRows(image_data, x, y, 4);
+		}
+
+		image.width = x;
+		image.height = y;
+
+		//cold: encode the mip chain once and keep it for the next run
+		if (compress) {
+			std::shared_ptr<CompressedImage> compressed = std::make_shared<CompressedImage>();
+			if (TextureCompressor::compress(image_data, x, y, textureCompression, textureMipFilter, *compressed)) {
+				if (hasSource && !TextureCache::write(cacheFileName, source, *compressed)) {
+					fprintf(stderr, "WARNING: could not write texture cache %s\n", cacheFileName.c_str());
+				}
+				image.pixels.reset();
+				image.compressed = compressed;
 			}
 		}
+		image.decodeMs = millisecondsSince(start);
+	}
+
+	// Loads decoded pixel data into the video memory
+	GLuint Model3D::ReadTextureFromImage(const ImageData& image) {
+		if (!image.pixels && !image.compressed) {
+			return 0;
+		}
 
 		GLuint textureID;
 		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_SRGB, //GL_SRGB,//GL_RGBA,
-			x,
-			y,
-			0,
-			GL_RGBA,
-			GL_UNSIGNED_BYTE,
-			image_data
-		);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		GLStateCache::bindTexture2D(0, textureID);
+		if (image.compressed) {
+			//the whole chain comes from the cache, the driver generates nothing
+			const CompressedImage& compressed = *image.compressed;
+			for (size_t l = 0; l < compressed.levels.size(); l++) {
+				const CompressedLevel& level = compressed.levels[l];
+				glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)l, compressed.format, level.width, level.height, 0,
+					(GLsizei)level.size, compressed.data + level.offset);
+			}
+		}
+		else {
+			glTexImage2D(
+				GL_TEXTURE_2D,
+				0,
+				GL_SRGB, //GL_SRGB,//GL_RGBA,
+				image.width,
+				image.height,
+				0,
+				GL_RGBA,
+				GL_UNSIGNED_BYTE,
+				image.pixels.get()
+			);
+			glGenerateMipmap(GL_TEXTURE_2D);
+		}
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glBindTexture(GL_TEXTURE_2D, 0);
 
 		return textureID;
 	}
 
 	Model3D::~Model3D() {
         for (size_t i = 0; i < loadedTextures.size(); i++) {
+            GLStateCache::forgetTexture(loadedTextures.at(i).id);
             glDeleteTextures(1, &loadedTextures.at(i).id);
         }
 
         for (size_t i = 0; i < meshes.size(); i++) {
-            GLuint VBO = meshes.at(i).getBuffers().VBO;
-            GLuint EBO = meshes.at(i).getBuffers().EBO;
-            GLuint VAO = meshes.at(i).getBuffers().VAO;
-            glDeleteBuffers(1, &VBO);
-            glDeleteBuffers(1, &EBO);
-            glDeleteVertexArrays(1, &VAO);
+            meshes.at(i).releaseBuffers();
         }
 	}
 }
@@ -2,16 +2,51 @@
 #define Model3D_hpp
 
 #include "Mesh.hpp"
+#include "MeshCache.hpp"
+#include "Frustum.hpp"
+#include "TextureCompressor.hpp"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
 
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace gps {
 
+	class TextureStreamer;
+
+	// RGBA8 image decoded from disk, rows flipped for OpenGL unless decoded with flipRows false,
+	// or its block compressed mip chain when textures are compressed
+	struct ImageData
+	{
+		std::string path;
+		int width;
+		int height;
+		// NULL when the file could not be decoded or the image is compressed
+		std::shared_ptr<unsigned char> pixels;
+		// set instead of pixels when textures are compressed, always bottom row first
+		std::shared_ptr<gps::CompressedImage> compressed;
+		double decodeMs;
+	};
+
+	// Everything a model needs from disk, read without any GL calls
+	struct ModelData
+	{
+		std::string fileName;
+		std::vector<gps::MeshData> meshes;
+		// one entry per distinct texture path, decoded separately with DecodeImage
+		std::vector<gps::ImageData> images;
+		// keeps meshes read from the mesh cache mapped until they are uploaded
+		std::shared_ptr<gps::MappedFile> cacheFile;
+		bool cacheHit;
+		double readMs;
+		// loading messages, printed when the model is uploaded
+		std::string log;
+	};
+
     class Model3D
     {
 
@@ -22,24 +57,64 @@ namespace gps {
 
 		void LoadModel(std::string fileName, std::string basePath);
 
-		void Draw(gps::Shader shaderProgram);
+		// Parses the .obj, or maps its mesh cache, and lists the textures; makes no GL calls so it can run on any thread
+		static void ReadModelData(std::string fileName, std::string basePath, ModelData& data);
+
+		// Decodes image.path into image (bottom row first unless flipRows is false), makes no GL calls so it can run on any thread.
+		// With textureCompression set it maps the image's texture cache instead, or encodes the image and writes the cache.
+		static void DecodeImage(ImageData& image, bool flipRows = true);
+
+		// Creates the meshes and textures on the GL thread and releases the CPU side data
+		void Upload(ModelData& data);
+
+		void Draw(gps::Shader& shaderProgram);
+
+		// Draws only the meshes that, placed by model, touch the frustum, and counts them in stats
+		void Draw(gps::Shader& shaderProgram, const gps::Frustum& frustum, const glm::mat4& model, gps::CullStats& stats);
+
+		// Draws instanceCount copies of every mesh with a single call per mesh
+		void DrawInstanced(gps::Shader& shaderProgram, GLsizei instanceCount);
+
+		// Attaches a per-instance model matrix buffer to every mesh
+		void setInstanceBuffer(GLuint instanceVBO);
+
+		// Deletes the textures once nothing samples them (the material atlas holds copies);
+		// the meshes keep the names only as render queue sort keys
+		void releaseTextures();
+
+		// Object-space bounds around every mesh, set by Upload
+		const gps::Bounds& getBounds() const;
 
 		// Component meshes - group of objects
 		std::vector<gps::Mesh> meshes;
 
+		// Reorder loaded meshes for the vertex cache and vertex fetch (on by default)
+		static bool optimizeMeshes;
+
+		// Block compression of the textures, set to TEXTURE_COMPRESSION_NONE when the context cannot sample it (BC1/BC3 by default)
+		static gps::TextureCompression textureCompression;
+
+		// Filter of the mip chains built for compressed textures (box by default)
+		static gps::MipFilter textureMipFilter;
+
+		// When set, textures start as placeholders and are streamed in by it instead of being decoded while loading
+		static gps::TextureStreamer* textureStreamer;
+
     private:
 		
 		// Associated textures
         std::vector<gps::Texture> loadedTextures;
 
+		gps::Bounds bounds;
+
 		// Does the parsing of the .obj file and fills in the data structure
-		void ReadOBJ(std::string fileName, std::string basePath);
+		static void ParseOBJ(std::string fileName, std::string basePath, ModelData& data);
 
 		// Retrieves a texture associated with the object - by its name and type
-		gps::Texture LoadTexture(std::string path, std::string type);
+		gps::Texture LoadTexture(std::string path, std::string type, const ModelData& data);
 
-		// Reads the pixel data from an image file and loads it into the video memory
-		GLuint ReadTextureFromFile(const char* file_name);
+		// Loads decoded pixel data into the video memory
+		GLuint ReadTextureFromImage(const ImageData& image);
     };
 }
 
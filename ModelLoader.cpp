@@ -0,0 +1,91 @@
+#include "ModelLoader.hpp"
+
+#include <chrono>
+#include <cstdio>
+
+namespace gps {
+
+	static double millisecondsSince(std::chrono::high_resolution_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	ModelLoader::ModelLoader(JobSystem& jobSystem) : jobSystem(jobSystem)
+	{
+	}
+
+	void ModelLoader::add(Model3D& model, const std::string& fileName)
+	{
+		add(model, fileName, fileName.substr(0, fileName.find_last_of('/')) + "/");
+	}
+
+	void ModelLoader::add(Model3D& model, const std::string& fileName, const std::string& basePath)
+	{
+		std::unique_ptr<Entry> entry(new Entry());
+		entry->model = &model;
+		entry->fileName = fileName;
+		entry->basePath = basePath;
+		entry->decodeMs = 0.0;
+		entry->imageCount = 0;
+		entry->uploadMs = 0.0;
+		entries.push_back(std::move(entry));
+	}
+
+	void ModelLoader::readEntry(Entry* entry)
+	{
+		Model3D::ReadModelData(entry->fileName, entry->basePath, entry->data);
+
+		//the texture list is only known after parsing, decode each image as its own job
+		for (size_t i = 0; i < entry->data.images.size(); i++) {
+			ImageData* image = &entry->data.images[i];
+			jobSystem.run([image]() { Model3D::DecodeImage(*image); }, &entry->counter);
+		}
+	}
+
+	void ModelLoader::loadAll()
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+		for (size_t i = 0; i < entries.size(); i++) {
+			Entry* entry = entries[i].get();
+			jobSystem.run([this, entry]() { readEntry(entry); }, &entry->counter);
+		}
+
+		//upload in order, the waits run queued reads and decodes on this thread too
+		for (size_t i = 0; i < entries.size(); i++) {
+			Entry* entry = entries[i].get();
+			jobSystem.wait(&entry->counter);
+
+			//the images are released by the upload
+			entry->imageCount = entry->data.images.size();
+			for (size_t t = 0; t < entry->data.images.size(); t++) {
+				entry->decodeMs += entry->data.images[t].decodeMs;
+			}
+
+			std::chrono::high_resolution_clock::time_point uploadStart = std::chrono::high_resolution_clock::now();
+			entry->model->Upload(entry->data);
+			entry->uploadMs = millisecondsSince(uploadStart);
+		}
+
+		printReport(millisecondsSince(start));
+		entries.clear();
+	}
+
+	void ModelLoader::printReport(double wallMs) const
+	{
+		double serialMs = 0.0;
+
+		printf("%-40s %10s %10s %8s %10s\n", "asset", "read ms", "decode ms", "images", "upload ms");
+		for (size_t i = 0; i < entries.size(); i++) {
+			const Entry& entry = *entries[i];
+			printf("%-40s %10.2f %10.2f %8u %10.2f\n", entry.fileName.c_str(), entry.data.readMs, entry.decodeMs,
+				(unsigned int)entry.imageCount, entry.uploadMs);
+			serialMs += entry.data.readMs + entry.decodeMs + entry.uploadMs;
+		}
+
+		//with free cores the per-asset times add up to roughly what loading them one after another costs
+		printf("Loaded %u models in %.2f ms wall clock (per-asset times sum to %.2f ms, %u workers)\n",
+			(unsigned int)entries.size(), wallMs, serialMs, jobSystem.getWorkerCount());
+	}
+
+}
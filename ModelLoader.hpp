@@ -0,0 +1,50 @@
+#ifndef ModelLoader_hpp
+#define ModelLoader_hpp
+
+#include "Model3D.hpp"
+#include "JobSystem.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+// Loads a batch of models: .obj parsing and image decoding run on the job system,
+// only the GL uploads run on the thread that calls loadAll
+class ModelLoader
+{
+public:
+    explicit ModelLoader(JobSystem& jobSystem);
+
+    // Queues a model, the textures are looked up next to the .obj
+    void add(Model3D& model, const std::string& fileName);
+
+    void add(Model3D& model, const std::string& fileName, const std::string& basePath);
+
+    // Loads every queued model, uploading each one as soon as its data is ready; must be called with the GL context current
+    void loadAll();
+
+private:
+    struct Entry
+    {
+        Model3D* model;
+        std::string fileName;
+        std::string basePath;
+        ModelData data;
+        JobCounter counter;
+        double decodeMs;
+        size_t imageCount;
+        double uploadMs;
+    };
+
+    JobSystem& jobSystem;
+    std::vector<std::unique_ptr<Entry> > entries;
+
+    void readEntry(Entry* entry);
+    void printReport(double wallMs) const;
+};
+
+}
+
+#endif /* ModelLoader_hpp */
@@ -0,0 +1,314 @@
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace gps {
+
+	Profiler::Profiler() : enabled(false), initialized(false), gpuEpoch(0), currentSlot(0), droppedGPUFrames(0)
+	{
+		for (int i = 0; i < FRAME_LATENCY; i++) {
+			slots[i].usedQueries = 0;
+			slots[i].pending = false;
+		}
+	}
+
+	void Profiler::setEnabled(bool enabled)
+	{
+		this->enabled = enabled;
+	}
+
+	bool Profiler::isEnabled() const
+	{
+		return enabled;
+	}
+
+	double Profiler::nowUs() const
+	{
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	int Profiler::findScope(int parent, const char* name)
+	{
+		for (size_t i = 0; i < scopes.size(); i++) {
+			if (scopes[i].parent == parent && (scopes[i].name == name || strcmp(scopes[i].name, name) == 0)) {
+				return (int)i;
+			}
+		}
+
+		ScopeInfo scope;
+		scope.parent = parent;
+		scope.name = name;
+		scope.path = parent >= 0 ? scopes[parent].path + "/" + name : std::string(name);
+		scope.cpuSamples = 0;
+		scope.gpuSamples = 0;
+		scopes.push_back(scope);
+		return (int)scopes.size() - 1;
+	}
+
+	GLuint Profiler::nextQuery(FrameSlot& slot)
+	{
+		if (slot.usedQueries == slot.queries.size()) {
+			//grow the pool in blocks, the first frames settle how many scopes a frame has
+			size_t oldSize = slot.queries.size();
+			slot.queries.resize(oldSize + 32);
+			glGenQueries(32, &slot.queries[oldSize]);
+		}
+		return slot.queries[slot.usedQueries++];
+	}
+
+	void Profiler::beginFrame()
+	{
+		if (!enabled) {
+			return;
+		}
+
+		if (!initialized) {
+			epoch = std::chrono::steady_clock::now();
+			glGetInteger64v(GL_TIMESTAMP, &gpuEpoch);
+			initialized = true;
+		}
+
+		currentSlot = (currentSlot + 1) % FRAME_LATENCY;
+		FrameSlot& slot = slots[currentSlot];
+		if (slot.pending) {
+			collect(slot);
+		}
+
+		slot.samples.clear();
+		slot.usedQueries = 0;
+		slot.pending = true;
+		openScopes.clear();
+
+		beginScope("frame");
+	}
+
+	void Profiler::endFrame()
+	{
+		if (!enabled || !initialized) {
+			return;
+		}
+
+		while (!openScopes.empty()) {
+			endScope();
+		}
+	}
+
+	void Profiler::beginScope(const char* name)
+	{
+		if (!enabled || !initialized) {
+			return;
+		}
+
+		FrameSlot& slot = slots[currentSlot];
+		int parent = openScopes.empty() ? -1 : slot.samples[openScopes.back()].scope;
+
+		Sample sample;
+		sample.scope = findScope(parent, name);
+		sample.gpuBegin = nextQuery(slot);
+		sample.gpuEnd = 0;
+		glQueryCounter(sample.gpuBegin, GL_TIMESTAMP);
+		sample.cpuBeginUs = nowUs();
+		sample.cpuEndUs = sample.cpuBeginUs;
+
+		openScopes.push_back(slot.samples.size());
+		slot.samples.push_back(sample);
+	}
+
+	void Profiler::endScope()
+	{
+		if (!enabled || !initialized || openScopes.empty()) {
+			return;
+		}
+
+		FrameSlot& slot = slots[currentSlot];
+		Sample& sample = slot.samples[openScopes.back()];
+		openScopes.pop_back();
+
+		sample.cpuEndUs = nowUs();
+		sample.gpuEnd = nextQuery(slot);
+		glQueryCounter(sample.gpuEnd, GL_TIMESTAMP);
+	}
+
+	void Profiler::addSample(std::vector<float>& history, size_t sampleIndex, float value)
+	{
+		if (history.size() < (size_t)HISTORY) {
+			history.push_back(value);
+		}
+		else {
+			history[sampleIndex % HISTORY] = value;
+		}
+	}
+
+	void Profiler::collect(FrameSlot& slot)
+	{
+		slot.pending = false;
+		if (slot.samples.empty()) {
+			return;
+		}
+
+		//timestamps complete in submission order, so the last query tells about all of them
+		GLint available = 0;
+		glGetQueryObjectiv(slot.queries[slot.usedQueries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			//the GPU is more than FRAME_LATENCY frames behind, keep the CPU times only
+			droppedGPUFrames++;
+		}
+
+		for (size_t i = 0; i < slot.samples.size(); i++) {
+			const Sample& sample = slot.samples[i];
+			ScopeInfo& scope = scopes[sample.scope];
+
+			double cpuUs = sample.cpuEndUs - sample.cpuBeginUs;
+			addSample(scope.cpuHistory, scope.cpuSamples++, (float)(cpuUs / 1000.0));
+			addTraceEvent(sample.scope, false, sample.cpuBeginUs, cpuUs);
+
+			if (available && sample.gpuEnd != 0) {
+				GLuint64 gpuBegin = 0;
+				GLuint64 gpuEnd = 0;
+				glGetQueryObjectui64v(sample.gpuBegin, GL_QUERY_RESULT, &gpuBegin);
+				glGetQueryObjectui64v(sample.gpuEnd, GL_QUERY_RESULT, &gpuEnd);
+
+				double gpuUs = (double)(gpuEnd - gpuBegin) / 1000.0;
+				addSample(scope.gpuHistory, scope.gpuSamples++, (float)(gpuUs / 1000.0));
+				addTraceEvent(sample.scope, true, (double)((GLint64)gpuBegin - gpuEpoch) / 1000.0, gpuUs);
+			}
+		}
+	}
+
+	void Profiler::addTraceEvent(int scope, bool gpu, double beginUs, double durationUs)
+	{
+		TraceEvent event;
+		event.scope = scope;
+		event.gpu = gpu;
+		event.beginUs = beginUs;
+		event.durationUs = durationUs;
+		trace.push_back(event);
+
+		if (trace.size() > MAX_TRACE_EVENTS) {
+			trace.pop_front();
+		}
+	}
+
+	void Profiler::computeStats(const std::vector<float>& history, double& minimum, double& average, double& p99)
+	{
+		minimum = average = p99 = 0.0;
+		if (history.empty()) {
+			return;
+		}
+
+		std::vector<float> sorted(history);
+		std::sort(sorted.begin(), sorted.end());
+
+		double sum = 0.0;
+		for (size_t i = 0; i < sorted.size(); i++) {
+			sum += sorted[i];
+		}
+
+		//nearest-rank percentile
+		size_t rank = (size_t)(0.99 * sorted.size() + 0.999999);
+		minimum = sorted.front();
+		average = sum / sorted.size();
+		p99 = sorted[rank > 0 ? rank - 1 : 0];
+	}
+
+	std::vector<ProfileStats> Profiler::getStats() const
+	{
+		std::vector<ProfileStats> stats;
+		for (size_t i = 0; i < scopes.size(); i++) {
+			ProfileStats entry;
+			entry.path = scopes[i].path;
+			entry.samples = scopes[i].cpuSamples;
+			computeStats(scopes[i].cpuHistory, entry.cpuMin, entry.cpuAvg, entry.cpuP99);
+			computeStats(scopes[i].gpuHistory, entry.gpuMin, entry.gpuAvg, entry.gpuP99);
+			stats.push_back(entry);
+		}
+		return stats;
+	}
+
+	void Profiler::resetStats()
+	{
+		for (size_t i = 0; i < scopes.size(); i++) {
+			scopes[i].cpuHistory.clear();
+			scopes[i].gpuHistory.clear();
+			scopes[i].cpuSamples = 0;
+			scopes[i].gpuSamples = 0;
+		}
+		droppedGPUFrames = 0;
+	}
+
+	bool Profiler::writeCSV(const std::string& fileName) const
+	{
+		std::ofstream out(fileName.c_str());
+		if (!out) {
+			return false;
+		}
+
+		out << "scope,samples,cpu_min_ms,cpu_avg_ms,cpu_p99_ms,gpu_min_ms,gpu_avg_ms,gpu_p99_ms\n";
+		std::vector<ProfileStats> stats = getStats();
+		for (size_t i = 0; i < stats.size(); i++) {
+			const ProfileStats& entry = stats[i];
+			out << entry.path << "," << entry.samples << ","
+				<< entry.cpuMin << "," << entry.cpuAvg << "," << entry.cpuP99 << ","
+				<< entry.gpuMin << "," << entry.gpuAvg << "," << entry.gpuP99 << "\n";
+		}
+
+		return out.good();
+	}
+
+	bool Profiler::writeChromeTrace(const std::string& fileName) const
+	{
+		std::ofstream out(fileName.c_str());
+		if (!out) {
+			return false;
+		}
+
+		out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+
+		char line[256];
+		for (std::deque<TraceEvent>::const_iterator event = trace.begin(); event != trace.end(); ++event) {
+			//scope names are identifiers, they need no JSON escaping
+			snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				scopes[event->scope].name, event->gpu ? "gpu" : "cpu", event->gpu ? 2 : 1, event->beginUs, event->durationUs);
+			out << line;
+		}
+		out << "\n]}\n";
+
+		return out.good();
+	}
+
+	void Profiler::printSummary() const
+	{
+		std::vector<ProfileStats> stats = getStats();
+
+		printf("%-48s %8s %22s %22s\n", "scope (last samples, ms)", "samples", "cpu min/avg/p99", "gpu min/avg/p99");
+		for (size_t i = 0; i < stats.size(); i++) {
+			const ProfileStats& entry = stats[i];
+			printf("%-48s %8u %6.3f/%6.3f/%6.3f   %6.3f/%6.3f/%6.3f\n", entry.path.c_str(), (unsigned int)entry.samples,
+				entry.cpuMin, entry.cpuAvg, entry.cpuP99, entry.gpuMin, entry.gpuAvg, entry.gpuP99);
+		}
+
+		if (droppedGPUFrames > 0) {
+			printf("%u frames had no GPU times, the GPU was more than %d frames behind\n", (unsigned int)droppedGPUFrames, FRAME_LATENCY);
+		}
+	}
+
+	void Profiler::release()
+	{
+		for (int i = 0; i < FRAME_LATENCY; i++) {
+			if (!slots[i].queries.empty()) {
+				glDeleteQueries((GLsizei)slots[i].queries.size(), &slots[i].queries[0]);
+			}
+			slots[i].queries.clear();
+			slots[i].samples.clear();
+			slots[i].usedQueries = 0;
+			slots[i].pending = false;
+		}
+		initialized = false;
+	}
+
+}
@@ -0,0 +1,151 @@
+#ifndef Profiler_hpp
+#define Profiler_hpp
+
+#include <GL/glew.h>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+// Rolling statistics of one timed scope, in milliseconds
+struct ProfileStats
+{
+    std::string path;
+    size_t samples;
+    double cpuMin, cpuAvg, cpuP99;
+    double gpuMin, gpuAvg, gpuP99;
+};
+
+// Nested CPU and GPU timings per frame. GPU times come from GL_TIMESTAMP query pairs that are
+// read FRAME_LATENCY frames later, so reading them never waits on the GPU.
+// All calls must come from the thread that owns the GL context.
+class Profiler
+{
+public:
+    // frames whose queries can be in flight at once
+    static const int FRAME_LATENCY = 3;
+    // samples per scope kept for min/avg/p99
+    static const int HISTORY = 512;
+    // events kept for the Chrome trace, the oldest are dropped
+    static const size_t MAX_TRACE_EVENTS = 200000;
+
+    Profiler();
+
+    // Nothing is measured while disabled, scopes then cost one branch
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+
+    // Collects the finished timings of an older frame and opens the "frame" scope
+    void beginFrame();
+    void endFrame();
+
+    // Scopes nest, a scope's statistics are kept per parent path ("frame/shadowPass/renderGround").
+    // name must outlive the profiler (a string literal).
+    void beginScope(const char* name);
+    void endScope();
+
+    std::vector<ProfileStats> getStats() const;
+
+    // Forgets the samples behind getStats, the trace is kept
+    void resetStats();
+
+    // One row per scope: path, samples, then CPU and GPU min/avg/p99 in ms
+    bool writeCSV(const std::string& fileName) const;
+
+    // chrome://tracing / Perfetto JSON, CPU scopes on one track and GPU scopes on another
+    bool writeChromeTrace(const std::string& fileName) const;
+
+    void printSummary() const;
+
+    // Deletes the queries, call while the context is still current
+    void release();
+
+private:
+    struct ScopeInfo
+    {
+        int parent;
+        const char* name;
+        std::string path;
+        std::vector<float> cpuHistory;
+        std::vector<float> gpuHistory;
+        size_t cpuSamples;
+        size_t gpuSamples;
+    };
+
+    struct Sample
+    {
+        int scope;
+        double cpuBeginUs;
+        double cpuEndUs;
+        GLuint gpuBegin;
+        GLuint gpuEnd;
+    };
+
+    struct FrameSlot
+    {
+        std::vector<Sample> samples;
+        std::vector<GLuint> queries;
+        size_t usedQueries;
+        bool pending;
+    };
+
+    struct TraceEvent
+    {
+        int scope;
+        bool gpu;
+        double beginUs;
+        double durationUs;
+    };
+
+    bool enabled;
+    bool initialized;
+    std::chrono::steady_clock::time_point epoch;
+    // GL timestamp, in ns, taken at the same moment as epoch
+    GLint64 gpuEpoch;
+
+    std::vector<ScopeInfo> scopes;
+    FrameSlot slots[FRAME_LATENCY];
+    unsigned int currentSlot;
+    // indices into the current slot's samples of the open scopes
+    std::vector<size_t> openScopes;
+    size_t droppedGPUFrames;
+
+    std::deque<TraceEvent> trace;
+
+    double nowUs() const;
+    int findScope(int parent, const char* name);
+    GLuint nextQuery(FrameSlot& slot);
+    void collect(FrameSlot& slot);
+    void addTraceEvent(int scope, bool gpu, double beginUs, double durationUs);
+    static void addSample(std::vector<float>& history, size_t sampleIndex, float value);
+    static void computeStats(const std::vector<float>& history, double& minimum, double& average, double& p99);
+};
+
+// Times the enclosing block
+class ProfileScope
+{
+public:
+    ProfileScope(Profiler& profiler, const char* name) : profiler(profiler)
+    {
+        profiler.beginScope(name);
+    }
+
+    ~ProfileScope()
+    {
+        profiler.endScope();
+    }
+
+private:
+    Profiler& profiler;
+
+    ProfileScope(const ProfileScope&);
+    ProfileScope& operator=(const ProfileScope&);
+};
+
+}
+
+#endif /* Profiler_hpp */
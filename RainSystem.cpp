@@ -0,0 +1,350 @@
+#include "RainSystem.hpp"
+
+#include <cstdlib>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define RAIN_KERNEL_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RAIN_KERNEL_SSE
+#endif
+
+namespace gps {
+
+	const float RainSystem::SPAWN_HEIGHT = 8.081f;
+	const float RainSystem::FALL_STEP = 0.1f;
+	const float RainSystem::WIND_STEP = 0.04f;
+
+	// at most this many colliders are kept in registers by the SIMD kernels, past that drops go through the collider tree
+	static const int MAX_COLLIDERS = 8;
+
+	static void cross(const float a[3], const float b[3], float out[3])
+	{
+		out[0] = a[1] * b[2] - a[2] * b[1];
+		out[1] = a[2] * b[0] - a[0] * b[2];
+		out[2] = a[0] * b[1] - a[1] * b[0];
+	}
+
+	// plane through p with normal cross(a - o, b - o), matching the old per-drop test
+	static RainCollider makeCollider(const float a[3], const float b[3], const float o[3], const float p[3],
+		float minX, float maxX, float minY, float maxY, float minZ, float maxZ)
+	{
+		float u[3] = { a[0] - o[0], a[1] - o[1], a[2] - o[2] };
+		float v[3] = { b[0] - o[0], b[1] - o[1], b[2] - o[2] };
+		float n[3];
+		cross(u, v, n);
+
+		RainCollider collider;
+		collider.nx = n[0];
+		collider.ny = n[1];
+		collider.nz = n[2];
+		collider.d = -(n[0] * p[0] + n[1] * p[1] + n[2] * p[2]);
+		collider.minX = minX;
+		collider.maxX = maxX;
+		collider.minY = minY;
+		collider.maxY = maxY;
+		collider.minZ = minZ;
+		collider.maxZ = maxZ;
+		return collider;
+	}
+
+	RainSystem::RainSystem()
+	{
+		initColliders();
+	}
+
+	void RainSystem::initColliders()
+	{
+		const float A[3] = { 8.45154f, 3.58871f, 2.47549f };  //top-front vertex of roof
+		const float C[3] = { 8.40777f, 1.63252f, 3.92667f };  //top-front vertex of right wall
+		const float D[3] = { 12.8452f, 1.63252f, 4.00412f };  //top-back vertex of right wall
+		const float E[3] = { 8.47413f, 1.63252f, 1.04179f };  //top-front vertex of left wall
+		const float F[3] = { 12.9299f, 1.59839f, 1.10053f };  //top-back vertex of left wall
+		const float G[3] = { 8.45149f, 0.007231f, 3.904f };   //bottom-front vertex of right wall
+		const float H[3] = { 12.8534f, 0.007231f, 3.99226f }; //bottom-back vertex of right wall
+		const float I[3] = { 8.46879f, 0.007231f, 1.07433f }; //bottom-front vertex of left-wall
+		const float J[3] = { 12.9299f, 0.007231f, 1.11824f }; //bottom-back vertex of left-wall
+
+		colliders.clear();
+		//right roof
+		colliders.push_back(makeCollider(A, D, C, A, 8.40777f, 12.8966f, 1.63252f, 3.62955f, 2.47549f, 4.00412f));
+		//left roof
+		colliders.push_back(makeCollider(A, F, E, A, 8.45154f, 12.9299f, 1.59839f, 3.62955f, 1.04179f, 2.55956f));
+		//right wall
+		colliders.push_back(makeCollider(C, H, G, C, 8.40777f, 12.8534f, 0.007231f, 1.63252f, 3.904f, 4.00412f));
+		//left wall
+		colliders.push_back(makeCollider(E, J, I, E, 8.46879f, 12.9299f, 0.007231f, 1.63252f, 1.04179f, 1.11824f));
+		buildColliderTree();
+	}
+
+	void RainSystem::addCollider(const RainCollider& collider)
+	{
+		colliders.push_back(collider);
+		buildColliderTree();
+	}
+
+	void RainSystem::buildColliderTree()
+	{
+		std::vector<BVHBox> boxes(colliders.size());
+		for (size_t c = 0; c < colliders.size(); c++) {
+			boxes[c].min = glm::vec3(colliders[c].minX, colliders[c].minY, colliders[c].minZ);
+			boxes[c].max = glm::vec3(colliders[c].maxX, colliders[c].maxY, colliders[c].maxZ);
+		}
+		colliderTree.build(boxes);
+	}
+
+	void RainSystem::init(int count)
+	{
+		x.resize(count);
+		y.resize(count);
+		z.resize(count);
+		initialX.resize(count);
+		initialZ.resize(count);
+
+		for (int i = 0; i < count; i++) {
+			float initialPosX = (rand() % 14476 + 1874) / 1000.0f;
+			float initialPosY = ((rand() % 18304) - 11712) / 1000.0f;
+			float initialPosZ = (rand() % 8081) / 1000.0f;
+
+			initialX[i] = initialPosX;
+			initialZ[i] = -initialPosY;
+
+			x[i] = initialPosX;
+			y[i] = initialPosZ;
+			z[i] = -initialPosY;
+		}
+	}
+
+	int RainSystem::size() const
+	{
+		return (int)x.size();
+	}
+
+	static bool hits(const RainCollider& collider, float px, float py, float pz)
+	{
+		//same evaluation order as the SIMD kernels
+		float dist = collider.nx * px + collider.d;
+		dist = collider.ny * py + dist;
+		dist = collider.nz * pz + dist;
+
+		return px > collider.minX && px < collider.maxX &&
+			py > collider.minY && py < collider.maxY &&
+			pz > collider.minZ && pz < collider.maxZ &&
+			dist < 0.0f;
+	}
+
+	bool RainSystem::collides(float px, float py, float pz) const
+	{
+		if (colliders.size() <= (size_t)MAX_COLLIDERS) {
+			for (size_t c = 0; c < colliders.size(); c++) {
+				if (hits(colliders[c], px, py, pz)) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		//only the colliders whose box holds the point can be hit
+		bool hit = false;
+		glm::vec3 point(px, py, pz);
+		colliderTree.queryBox(point, point, [&](uint32_t c) {
+			hit = hit || hits(colliders[c], px, py, pz);
+		});
+		return hit;
+	}
+
+	void RainSystem::update(bool wind)
+	{
+		update(0, size(), wind);
+	}
+
+	void RainSystem::updateScalar(int begin, int end, bool wind)
+	{
+		const float windStep = wind ? WIND_STEP : 0.0f;
+
+		for (int i = begin; i < end; i++) {
+			y[i] -= FALL_STEP;
+			z[i] -= windStep;
+
+			if (y[i] < 0.0f || collides(x[i], y[i], z[i])) {
+				x[i] = initialX[i];
+				y[i] = SPAWN_HEIGHT;
+				z[i] = initialZ[i];
+			}
+		}
+	}
+
+#if defined(RAIN_KERNEL_AVX2)
+
+	const char* RainSystem::kernelName()
+	{
+		return "AVX2";
+	}
+
+	struct ColliderLanes
+	{
+		__m256 nx, ny, nz, d;
+		__m256 minX, maxX, minY, maxY, minZ, maxZ;
+	};
+
+	void RainSystem::update(int begin, int end, bool wind)
+	{
+		int colliderCount = (int)colliders.size();
+		if (colliderCount > MAX_COLLIDERS) {
+			updateScalar(begin, end, wind);
+			return;
+		}
+
+		ColliderLanes lanes[MAX_COLLIDERS];
+		for (int c = 0; c < colliderCount; c++) {
+			lanes[c].nx = _mm256_set1_ps(colliders[c].nx);
+			lanes[c].ny = _mm256_set1_ps(colliders[c].ny);
+			lanes[c].nz = _mm256_set1_ps(colliders[c].nz);
+			lanes[c].d = _mm256_set1_ps(colliders[c].d);
+			lanes[c].minX = _mm256_set1_ps(colliders[c].minX);
+			lanes[c].maxX = _mm256_set1_ps(colliders[c].maxX);
+			lanes[c].minY = _mm256_set1_ps(colliders[c].minY);
+			lanes[c].maxY = _mm256_set1_ps(colliders[c].maxY);
+			lanes[c].minZ = _mm256_set1_ps(colliders[c].minZ);
+			lanes[c].maxZ = _mm256_set1_ps(colliders[c].maxZ);
+		}
+
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 fallStep = _mm256_set1_ps(FALL_STEP);
+		const __m256 windStep = _mm256_set1_ps(wind ? WIND_STEP : 0.0f);
+		const __m256 spawnHeight = _mm256_set1_ps(SPAWN_HEIGHT);
+
+		int i = begin;
+		for (; i + 8 <= end; i += 8) {
+			__m256 px = _mm256_loadu_ps(&x[i]);
+			__m256 py = _mm256_sub_ps(_mm256_loadu_ps(&y[i]), fallStep);
+			__m256 pz = _mm256_sub_ps(_mm256_loadu_ps(&z[i]), windStep);
+
+			//drops that reached the ground
+			__m256 respawn = _mm256_cmp_ps(py, zero, _CMP_LT_OQ);
+
+			for (int c = 0; c < colliderCount; c++) {
+				const ColliderLanes& l = lanes[c];
+				__m256 inside = _mm256_and_ps(_mm256_cmp_ps(px, l.minX, _CMP_GT_OQ), _mm256_cmp_ps(px, l.maxX, _CMP_LT_OQ));
+				inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(py, l.minY, _CMP_GT_OQ), _mm256_cmp_ps(py, l.maxY, _CMP_LT_OQ)));
+				inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(pz, l.minZ, _CMP_GT_OQ), _mm256_cmp_ps(pz, l.maxZ, _CMP_LT_OQ)));
+
+				__m256 dist = _mm256_add_ps(_mm256_mul_ps(l.nx, px), l.d);
+				dist = _mm256_add_ps(_mm256_mul_ps(l.ny, py), dist);
+				dist = _mm256_add_ps(_mm256_mul_ps(l.nz, pz), dist);
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(dist, zero, _CMP_LT_OQ));
+
+				respawn = _mm256_or_ps(respawn, inside);
+			}
+
+			px = _mm256_blendv_ps(px, _mm256_loadu_ps(&initialX[i]), respawn);
+			py = _mm256_blendv_ps(py, spawnHeight, respawn);
+			pz = _mm256_blendv_ps(pz, _mm256_loadu_ps(&initialZ[i]), respawn);
+
+			_mm256_storeu_ps(&x[i], px);
+			_mm256_storeu_ps(&y[i], py);
+			_mm256_storeu_ps(&z[i], pz);
+		}
+
+		//remaining drops
+		updateScalar(i, end, wind);
+	}
+
+#elif defined(RAIN_KERNEL_SSE)
+
+	const char* RainSystem::kernelName()
+	{
+		return "SSE2";
+	}
+
+	struct ColliderLanes
+	{
+		__m128 nx, ny, nz, d;
+		__m128 minX, maxX, minY, maxY, minZ, maxZ;
+	};
+
+	// SSE2 has no blendv, select with masks instead
+	static inline __m128 select(__m128 a, __m128 b, __m128 mask)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+	}
+
+	void RainSystem::update(int begin, int end, bool wind)
+	{
+		int colliderCount = (int)colliders.size();
+		if (colliderCount > MAX_COLLIDERS) {
+			updateScalar(begin, end, wind);
+			return;
+		}
+
+		ColliderLanes lanes[MAX_COLLIDERS];
+		for (int c = 0; c < colliderCount; c++) {
+			lanes[c].nx = _mm_set1_ps(colliders[c].nx);
+			lanes[c].ny = _mm_set1_ps(colliders[c].ny);
+			lanes[c].nz = _mm_set1_ps(colliders[c].nz);
+			lanes[c].d = _mm_set1_ps(colliders[c].d);
+			lanes[c].minX = _mm_set1_ps(colliders[c].minX);
+			lanes[c].maxX = _mm_set1_ps(colliders[c].maxX);
+			lanes[c].minY = _mm_set1_ps(colliders[c].minY);
+			lanes[c].maxY = _mm_set1_ps(colliders[c].maxY);
+			lanes[c].minZ = _mm_set1_ps(colliders[c].minZ);
+			lanes[c].maxZ = _mm_set1_ps(colliders[c].maxZ);
+		}
+
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 fallStep = _mm_set1_ps(FALL_STEP);
+		const __m128 windStep = _mm_set1_ps(wind ? WIND_STEP : 0.0f);
+		const __m128 spawnHeight = _mm_set1_ps(SPAWN_HEIGHT);
+
+		int i = begin;
+		for (; i + 4 <= end; i += 4) {
+			__m128 px = _mm_loadu_ps(&x[i]);
+			__m128 py = _mm_sub_ps(_mm_loadu_ps(&y[i]), fallStep);
+			__m128 pz = _mm_sub_ps(_mm_loadu_ps(&z[i]), windStep);
+
+			//drops that reached the ground
+			__m128 respawn = _mm_cmplt_ps(py, zero);
+
+			for (int c = 0; c < colliderCount; c++) {
+				const ColliderLanes& l = lanes[c];
+				__m128 inside = _mm_and_ps(_mm_cmpgt_ps(px, l.minX), _mm_cmplt_ps(px, l.maxX));
+				inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpgt_ps(py, l.minY), _mm_cmplt_ps(py, l.maxY)));
+				inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpgt_ps(pz, l.minZ), _mm_cmplt_ps(pz, l.maxZ)));
+
+				__m128 dist = _mm_add_ps(_mm_mul_ps(l.nx, px), l.d);
+				dist = _mm_add_ps(_mm_mul_ps(l.ny, py), dist);
+				dist = _mm_add_ps(_mm_mul_ps(l.nz, pz), dist);
+				inside = _mm_and_ps(inside, _mm_cmplt_ps(dist, zero));
+
+				respawn = _mm_or_ps(respawn, inside);
+			}
+
+			px = select(px, _mm_loadu_ps(&initialX[i]), respawn);
+			py = select(py, spawnHeight, respawn);
+			pz = select(pz, _mm_loadu_ps(&initialZ[i]), respawn);
+
+			_mm_storeu_ps(&x[i], px);
+			_mm_storeu_ps(&y[i], py);
+			_mm_storeu_ps(&z[i], pz);
+		}
+
+		//remaining drops
+		updateScalar(i, end, wind);
+	}
+
+#else
+
+	const char* RainSystem::kernelName()
+	{
+		return "scalar";
+	}
+
+	void RainSystem::update(int begin, int end, bool wind)
+	{
+		updateScalar(begin, end, wind);
+	}
+
+#endif
+
+}
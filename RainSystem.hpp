@@ -0,0 +1,73 @@
+#ifndef RainSystem_hpp
+#define RainSystem_hpp
+
+#include "BVH.hpp"
+
+#include <vector>
+
+namespace gps {
+
+// A plane the drops collide with, restricted to an axis aligned box.
+// A drop inside the box with nx*x + ny*y + nz*z + d < 0 is behind the plane.
+struct RainCollider
+{
+    float nx, ny, nz, d;
+    float minX, maxX;
+    float minY, maxY;
+    float minZ, maxZ;
+};
+
+class RainSystem
+{
+public:
+    // drop positions, one array per axis (structure of arrays)
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+
+    RainSystem();
+
+    // Spawns count drops at random positions over the graveyard
+    void init(int count);
+
+    // Steps, collides and respawns every drop
+    void update(bool wind);
+
+    // Steps, collides and respawns the drops in [begin, end)
+    void update(int begin, int end, bool wind);
+
+    // Reference implementation of update without SIMD
+    void updateScalar(int begin, int end, bool wind);
+
+    // Returns true if the point is inside the crypt roof or walls
+    bool collides(float px, float py, float pz) const;
+
+    // Adds a plane for the drops to hit, e.g. the top of a gravestone
+    void addCollider(const RainCollider& collider);
+
+    int size() const;
+
+    // Name of the update kernel selected at compile time
+    static const char* kernelName();
+
+    static const float SPAWN_HEIGHT;
+    static const float FALL_STEP;
+    static const float WIND_STEP;
+
+private:
+    // respawn positions
+    std::vector<float> initialX;
+    std::vector<float> initialZ;
+
+    std::vector<RainCollider> colliders;
+    // broadphase over the collider boxes, used once there are too many to test them all per drop
+    BVH colliderTree;
+
+    // Precomputes the plane equations of the crypt roof and walls
+    void initColliders();
+    void buildColliderTree();
+};
+
+}
+
+#endif /* RainSystem_hpp */
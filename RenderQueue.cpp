@@ -0,0 +1,187 @@
+#include "RenderQueue.hpp"
+
+#include <cstring>
+
+namespace gps {
+
+	static const int LAYER_SHIFT = 60;
+	static const int SHADER_SHIFT = 52;
+	static const int TEXTURE_SHIFT = 32;
+	static const uint32_t TEXTURE_MASK = (1u << 20) - 1;
+
+	RenderQueue::RenderQueue()
+	{
+	}
+
+	void RenderQueue::clear()
+	{
+		packets.clear();
+		commands.clear();
+		transforms.clear();
+	}
+
+	uint32_t RenderQueue::addTransform(const glm::mat4& model)
+	{
+		transforms.push_back(model);
+		return (uint32_t)transforms.size() - 1;
+	}
+
+	void RenderQueue::push(RenderLayer layer, gps::Shader& shader, gps::Mesh& mesh, uint32_t transform, float depth)
+	{
+		DrawCommand command;
+		command.shader = &shader;
+		command.mesh = &mesh;
+		command.transform = transform;
+
+		DrawPacket packet;
+		packet.key = makeKey(layer, shader.shaderProgram, textureSetHash(mesh), depth);
+		packet.command = (uint32_t)commands.size();
+
+		commands.push_back(command);
+		packets.push_back(packet);
+	}
+
+	uint64_t RenderQueue::makeKey(RenderLayer layer, GLuint shaderProgram, uint32_t textureSet, float depth)
+	{
+		//the bits of a non-negative float order like the float itself
+		if (!(depth > 0.0f)) {
+			depth = 0.0f;
+		}
+		uint32_t depthBits;
+		memcpy(&depthBits, &depth, sizeof(depthBits));
+
+		return ((uint64_t)(layer & 0xF) << LAYER_SHIFT) |
+			((uint64_t)(shaderProgram & 0xFF) << SHADER_SHIFT) |
+			((uint64_t)(textureSet & TEXTURE_MASK) << TEXTURE_SHIFT) |
+			depthBits;
+	}
+
+	void RenderQueue::sort()
+	{
+		//least significant byte first, each pass is a stable counting sort
+		size_t count = packets.size();
+		sortBuffer.resize(count);
+		for (int shift = 0; shift < 64; shift += 8) {
+			size_t offsets[256] = { 0 };
+			for (size_t i = 0; i < count; i++) {
+				offsets[(packets[i].key >> shift) & 0xFF]++;
+			}
+
+			//every key has the same byte here, the pass would not move anything
+			if (count == 0 || offsets[(packets[0].key >> shift) & 0xFF] == count) {
+				continue;
+			}
+
+			size_t sum = 0;
+			for (int digit = 0; digit < 256; digit++) {
+				size_t digitCount = offsets[digit];
+				offsets[digit] = sum;
+				sum += digitCount;
+			}
+			for (size_t i = 0; i < count; i++) {
+				sortBuffer[offsets[(packets[i].key >> shift) & 0xFF]++] = packets[i];
+			}
+			packets.swap(sortBuffer);
+		}
+	}
+
+	void RenderQueue::submit()
+	{
+		stats = RenderQueueStats();
+
+		const gps::Shader* currentShader = NULL;
+		const gps::Mesh* currentTextures = NULL;
+		uint32_t currentTransform = 0;
+		int currentLayer = -1;
+
+		for (size_t i = 0; i < packets.size(); i++) {
+			const DrawCommand& command = commands[packets[i].command];
+
+			int layer = (int)(packets[i].key >> LAYER_SHIFT);
+			if (layer != currentLayer) {
+				applyLayerState((RenderLayer)layer);
+				currentLayer = layer;
+			}
+
+			if (command.shader != currentShader) {
+				command.shader->useShaderProgram();
+				currentShader = command.shader;
+				//the new program has its own textures and model matrix uniforms
+				currentTextures = NULL;
+				currentTransform = (uint32_t)-1;
+				stats.shaderChanges++;
+			}
+
+			if (currentTextures == NULL || !sameTextures(*currentTextures, *command.mesh)) {
+				command.mesh->bindTextures(*command.shader);
+				currentTextures = command.mesh;
+				stats.textureChanges++;
+			}
+
+			if (command.transform != currentTransform) {
+				command.shader->setMat4("model", transforms[command.transform]);
+				currentTransform = command.transform;
+				stats.transformChanges++;
+			}
+
+			command.mesh->DrawGeometry();
+			stats.draws++;
+		}
+
+		if (currentLayer != RENDER_LAYER_OPAQUE) {
+			applyLayerState(RENDER_LAYER_OPAQUE);
+		}
+	}
+
+	size_t RenderQueue::size() const
+	{
+		return packets.size();
+	}
+
+	const RenderQueueStats& RenderQueue::getStats() const
+	{
+		return stats;
+	}
+
+	uint32_t RenderQueue::textureSetHash(const gps::Mesh& mesh)
+	{
+		//FNV-1a over the texture names, collisions only cost a few extra texture binds
+		uint32_t hash = 2166136261u;
+		for (size_t i = 0; i < mesh.textures.size(); i++) {
+			GLuint id = mesh.textures[i].id;
+			for (int b = 0; b < 4; b++) {
+				hash ^= (id >> (8 * b)) & 0xFF;
+				hash *= 16777619u;
+			}
+		}
+		//fold the high bits in instead of dropping them
+		return (hash ^ (hash >> 20)) & TEXTURE_MASK;
+	}
+
+	bool RenderQueue::sameTextures(const gps::Mesh& a, const gps::Mesh& b)
+	{
+		if (a.textures.size() != b.textures.size()) {
+			return false;
+		}
+		for (size_t i = 0; i < a.textures.size(); i++) {
+			if (a.textures[i].id != b.textures[i].id || a.textures[i].type != b.textures[i].type) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void RenderQueue::applyLayerState(RenderLayer layer)
+	{
+		if (layer == RENDER_LAYER_SKY) {
+			//drawn last, the sky only shades the pixels no opaque draw covered, and nothing after it needs its depth
+			glDepthFunc(GL_LEQUAL);
+			glDepthMask(GL_FALSE);
+		}
+		else {
+			glDepthFunc(GL_LESS);
+			glDepthMask(GL_TRUE);
+		}
+	}
+
+}
@@ -0,0 +1,90 @@
+#ifndef RenderQueue_hpp
+#define RenderQueue_hpp
+
+#include "Mesh.hpp"
+#include "Shader.hpp"
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+// Groups of draws submitted in this order, each with its own depth state
+enum RenderLayer
+{
+    // depth tested and written, front to back
+    RENDER_LAYER_OPAQUE = 0,
+    // drawn behind everything, only where nothing else wrote depth
+    RENDER_LAYER_SKY = 1
+};
+
+// State changes made by the last submit
+struct RenderQueueStats
+{
+    GLuint draws;
+    GLuint shaderChanges;
+    GLuint textureChanges;
+    GLuint transformChanges;
+
+    RenderQueueStats() : draws(0), shaderChanges(0), textureChanges(0), transformChanges(0) {}
+};
+
+// Draws collected for one pass, sorted by a 64 bit key and submitted with as few state changes as the order allows.
+// Key, high bits first: layer (4), shader (8), texture set (20), view depth (32).
+class RenderQueue
+{
+public:
+    RenderQueue();
+
+    // Forgets the draws and transforms of the previous pass
+    void clear();
+
+    // Stores a model matrix for the draws that follow, returns its index
+    uint32_t addTransform(const glm::mat4& model);
+
+    // Queues one mesh drawn with the transform at index transform, depth is its distance in front of the camera
+    void push(RenderLayer layer, gps::Shader& shader, gps::Mesh& mesh, uint32_t transform, float depth);
+
+    // Radix sorts the draws by key
+    void sort();
+
+    // Draws everything in key order, setting "model" whenever the transform changes
+    void submit();
+
+    size_t size() const;
+    const RenderQueueStats& getStats() const;
+
+    static uint64_t makeKey(RenderLayer layer, GLuint shaderProgram, uint32_t textureSet, float depth);
+
+private:
+    struct DrawPacket
+    {
+        uint64_t key;
+        uint32_t command;
+    };
+
+    struct DrawCommand
+    {
+        gps::Shader* shader;
+        gps::Mesh* mesh;
+        uint32_t transform;
+    };
+
+    std::vector<DrawPacket> packets;
+    // second buffer the radix sort ping-pongs with
+    std::vector<DrawPacket> sortBuffer;
+    std::vector<DrawCommand> commands;
+    std::vector<glm::mat4> transforms;
+    RenderQueueStats stats;
+
+    static uint32_t textureSetHash(const gps::Mesh& mesh);
+    static bool sameTextures(const gps::Mesh& a, const gps::Mesh& b);
+    static void applyLayerState(RenderLayer layer);
+};
+
+}
+
+#endif /* RenderQueue_hpp */
@@ -1,6 +1,13 @@
 #include "Shader.hpp"
+#include "GLStateCache.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
 
 namespace gps {
+    GLuint Shader::driverLookups = 0;
+
     std::string Shader::readShaderFile(std::string fileName)
     {
         std::ifstream shaderFile;
@@ -49,42 +56,176 @@ namespace gps {
         }
     }
 
-    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName)
+    GLuint Shader::compileShader(GLenum type, std::string fileName, const std::vector<std::string>& defines)
     {
-        //read, parse and compile the vertex shader
-        std::string v = readShaderFile(vertexShaderFileName);
-        const GLchar* vertexShaderString = v.c_str();
-        GLuint vertexShader;
-        vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderString, NULL);
-        glCompileShader(vertexShader);
-        //check compilation status
-        shaderCompileLog(vertexShader);
-
-        //read, parse and compile the vertex shader
-        std::string f = readShaderFile(fragmentShaderFileName);
-        const GLchar* fragmentShaderString = f.c_str();
-        GLuint fragmentShader;
-        fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderString, NULL);
-        glCompileShader(fragmentShader);
+        //read, parse and compile the shader
+        std::string source = readShaderFile(fileName);
+
+        //defines must follow the #version line, #line keeps the compiler's line numbers matching the file
+        if (!defines.empty())
+        {
+            size_t versionEnd = source.find('\n', source.find("#version"));
+            std::string header;
+            for (size_t i = 0; i < defines.size(); i++)
+                header += "#define " + defines[i] + "\n";
+            header += "#line 2\n";
+            source.insert(versionEnd == std::string::npos ? source.size() : versionEnd + 1, header);
+        }
+
+        const GLchar* shaderString = source.c_str();
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &shaderString, NULL);
+        glCompileShader(shader);
         //check compilation status
-        shaderCompileLog(fragmentShader);
+        shaderCompileLog(shader);
+        return shader;
+    }
 
+    void Shader::linkProgram(const std::vector<GLuint>& shaders)
+    {
         //attach and link the shader programs
         this->shaderProgram = glCreateProgram();
-        glAttachShader(this->shaderProgram, vertexShader);
-        glAttachShader(this->shaderProgram, fragmentShader);
+        for (size_t i = 0; i < shaders.size(); i++)
+            glAttachShader(this->shaderProgram, shaders[i]);
         glLinkProgram(this->shaderProgram);
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
+        for (size_t i = 0; i < shaders.size(); i++)
+            glDeleteShader(shaders[i]);
         //check linking info
         shaderLinkLog(this->shaderProgram);
+
+        buildUniformTable();
+    }
+
+    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName)
+    {
+        std::vector<GLuint> shaders;
+        shaders.push_back(compileShader(GL_VERTEX_SHADER, vertexShaderFileName));
+        shaders.push_back(compileShader(GL_FRAGMENT_SHADER, fragmentShaderFileName));
+        linkProgram(shaders);
+    }
+
+    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, const std::vector<std::string>& defines)
+    {
+        std::vector<GLuint> shaders;
+        shaders.push_back(compileShader(GL_VERTEX_SHADER, vertexShaderFileName, defines));
+        shaders.push_back(compileShader(GL_FRAGMENT_SHADER, fragmentShaderFileName, defines));
+        linkProgram(shaders);
+    }
+
+    void Shader::loadShader(std::string vertexShaderFileName, std::string geometryShaderFileName, std::string fragmentShaderFileName)
+    {
+        std::vector<GLuint> shaders;
+        shaders.push_back(compileShader(GL_VERTEX_SHADER, vertexShaderFileName));
+        shaders.push_back(compileShader(GL_GEOMETRY_SHADER, geometryShaderFileName));
+        shaders.push_back(compileShader(GL_FRAGMENT_SHADER, fragmentShaderFileName));
+        linkProgram(shaders);
+    }
+
+    void Shader::buildUniformTable()
+    {
+        uniforms.clear();
+
+        GLint uniformCount = 0;
+        GLint maxNameLength = 0;
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORMS, &uniformCount);
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+        std::vector<GLchar> nameBuffer(maxNameLength + 1);
+        for (GLint i = 0; i < uniformCount; i++)
+        {
+            GLsizei nameLength = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(this->shaderProgram, i, (GLsizei)nameBuffer.size(), &nameLength, &size, &type, nameBuffer.data());
+
+            std::string name(nameBuffer.data(), nameLength);
+            GLint location = glGetUniformLocation(this->shaderProgram, name.c_str());
+            driverLookups++;
+            //uniform block members have no location
+            if (location < 0)
+                continue;
+
+            //arrays are reported as "name[0]", make them reachable by their plain name
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+                name.erase(name.size() - 3);
+
+            UniformSlot slot;
+            slot.hash = hashUniformName(name.c_str());
+            slot.location = location;
+            uniforms.push_back(slot);
+        }
+
+        std::sort(uniforms.begin(), uniforms.end(), [](const UniformSlot& a, const UniformSlot& b) {
+            return a.hash < b.hash;
+        });
+
+        for (size_t i = 1; i < uniforms.size(); i++)
+        {
+            if (uniforms[i].hash == uniforms[i - 1].hash)
+                std::cout << "Shader warning: two uniforms share the hash " << uniforms[i].hash << std::endl;
+        }
+    }
+
+    GLint Shader::getUniformLocation(UniformName name) const
+    {
+        UniformSlot key;
+        key.hash = name.hash;
+        std::vector<UniformSlot>::const_iterator it = std::lower_bound(uniforms.begin(), uniforms.end(), key,
+            [](const UniformSlot& a, const UniformSlot& b) { return a.hash < b.hash; });
+
+        if (it == uniforms.end() || it->hash != name.hash)
+            return -1;
+        return it->location;
+    }
+
+    void Shader::setMat4(UniformName name, const glm::mat4& value) const
+    {
+        glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, glm::value_ptr(value));
+    }
+
+    void Shader::setMat3(UniformName name, const glm::mat3& value) const
+    {
+        glUniformMatrix3fv(getUniformLocation(name), 1, GL_FALSE, glm::value_ptr(value));
+    }
+
+    void Shader::setVec3(UniformName name, const glm::vec3& value) const
+    {
+        glUniform3fv(getUniformLocation(name), 1, glm::value_ptr(value));
+    }
+
+    void Shader::setInt(UniformName name, GLint value) const
+    {
+        glUniform1i(getUniformLocation(name), value);
+    }
+
+    void Shader::setFloat(UniformName name, GLfloat value) const
+    {
+        glUniform1f(getUniformLocation(name), value);
+    }
+
+    void Shader::setMat4Array(UniformName name, const glm::mat4* values, GLsizei count) const
+    {
+        glUniformMatrix4fv(getUniformLocation(name), count, GL_FALSE, glm::value_ptr(values[0]));
+    }
+
+    void Shader::setFloatArray(UniformName name, const GLfloat* values, GLsizei count) const
+    {
+        glUniform1fv(getUniformLocation(name), count, values);
+    }
+
+    void Shader::setIntArray(UniformName name, const GLint* values, GLsizei count) const
+    {
+        glUniform1iv(getUniformLocation(name), count, values);
+    }
+
+    void Shader::setIVec4Array(UniformName name, const GLint* values, GLsizei count) const
+    {
+        glUniform4iv(getUniformLocation(name), count, values);
     }
 
     void Shader::useShaderProgram()
     {
-        glUseProgram(this->shaderProgram);
+        GLStateCache::useProgram(this->shaderProgram);
     }
 
 }
@@ -2,26 +2,83 @@
 #define Shader_hpp
 
 #include <GL/glew.h>
+#include <glm/glm.hpp>
 
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <vector>
 
 namespace gps {
 
+// FNV-1a hash of a uniform name, folded at compile time for string literals
+constexpr GLuint hashUniformName(const char* name, GLuint hash = 2166136261u)
+{
+    return *name ? hashUniformName(name + 1, (hash ^ (GLuint)(unsigned char)*name) * 16777619u) : hash;
+}
+
+// Uniform name together with its hash
+struct UniformName
+{
+    GLuint hash;
+    const char* name;
+
+    template <size_t N>
+    constexpr UniformName(const char (&literal)[N]) : hash(hashUniformName(literal)), name(literal) {}
+
+    UniformName(const std::string& runtimeName) : hash(hashUniformName(runtimeName.c_str())), name(runtimeName.c_str()) {}
+};
+
 class Shader
 {
 public:
     GLuint shaderProgram;
     void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
+    // Program with a geometry stage between the vertex and the fragment shader
+    void loadShader(std::string vertexShaderFileName, std::string geometryShaderFileName, std::string fragmentShaderFileName);
+    // Program built with a "#define <entry>" line per define in both stages, e.g. "POISSON_TAPS 16"
+    void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, const std::vector<std::string>& defines);
     void useShaderProgram();
 
+    // Location of an active uniform from the table built at link time, -1 if the program does not use it
+    GLint getUniformLocation(UniformName name) const;
+
+    // Typed uniform setters, the program must be in use
+    void setMat4(UniformName name, const glm::mat4& value) const;
+    void setMat3(UniformName name, const glm::mat3& value) const;
+    void setVec3(UniformName name, const glm::vec3& value) const;
+    void setInt(UniformName name, GLint value) const;
+    void setFloat(UniformName name, GLfloat value) const;
+    // Array setters, name is the array without "[0]"
+    void setMat4Array(UniformName name, const glm::mat4* values, GLsizei count) const;
+    void setFloatArray(UniformName name, const GLfloat* values, GLsizei count) const;
+    void setIntArray(UniformName name, const GLint* values, GLsizei count) const;
+    // count ivec4s, four ints each
+    void setIVec4Array(UniformName name, const GLint* values, GLsizei count) const;
+
+    // Number of glGetUniformLocation calls made by all shaders since the last reset
+    static GLuint driverLookups;
+
 private:
+    struct UniformSlot
+    {
+        GLuint hash;
+        GLint location;
+    };
+
+    // active uniforms sorted by name hash
+    std::vector<UniformSlot> uniforms;
+
     std::string readShaderFile(std::string fileName);
     void shaderCompileLog(GLuint shaderId);
     void shaderLinkLog(GLuint shaderProgramId);
+    GLuint compileShader(GLenum type, std::string fileName, const std::vector<std::string>& defines = std::vector<std::string>());
+    // Links the compiled stages into shaderProgram and deletes them
+    void linkProgram(const std::vector<GLuint>& shaders);
+    // Queries the location of every active uniform once, after linking
+    void buildUniformTable();
 };
 
 }
@@ -0,0 +1,126 @@
+#include "ShadowCascades.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+
+namespace gps {
+
+	//blend between logarithmic (1) and uniform (0) split distances
+	static const float SPLIT_LAMBDA = 0.75f;
+	//how far behind a slice, towards the light, casters are still caught
+	static const float CASTER_MARGIN = 10.0f;
+	//smallest depth offset in world units, whatever the cascade resolution
+	static const float MIN_WORLD_BIAS = 0.02f;
+
+	ShadowCascades::ShadowCascades(int cascadeCount, int resolution)
+	{
+		setCascadeCount(cascadeCount);
+		setResolution(resolution);
+		for (int i = 0; i < MAX_CASCADES; i++) {
+			matrices[i] = glm::mat4(1.0f);
+			splitDepths[i] = 0.0f;
+			depthBiases[i] = 0.0f;
+			depthToUVScales[i] = 0.0f;
+		}
+	}
+
+	void ShadowCascades::setCascadeCount(int cascadeCount)
+	{
+		this->cascadeCount = cascadeCount < 1 ? 1 : (cascadeCount > MAX_CASCADES ? MAX_CASCADES : cascadeCount);
+	}
+
+	void ShadowCascades::setResolution(int resolution)
+	{
+		this->resolution = resolution < 16 ? 16 : resolution;
+	}
+
+	int ShadowCascades::getCascadeCount() const
+	{
+		return cascadeCount;
+	}
+
+	int ShadowCascades::getResolution() const
+	{
+		return resolution;
+	}
+
+	void ShadowCascades::update(const glm::mat4& view, float fovY, float aspect, float nearPlane, float shadowDistance,
+		const glm::vec3& lightDirection)
+	{
+		glm::mat4 inverseView = glm::inverse(view);
+		float tanHalfY = tanf(fovY * 0.5f);
+		float tanHalfX = tanHalfY * aspect;
+
+		//rotation into light space, shared by all cascades so only their boxes differ
+		glm::vec3 direction = glm::normalize(lightDirection);
+		glm::vec3 up = fabsf(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), direction, up);
+
+		float sliceNear = nearPlane;
+		for (int i = 0; i < cascadeCount; i++) {
+			float p = (float)(i + 1) / cascadeCount;
+			float logSplit = nearPlane * powf(shadowDistance / nearPlane, p);
+			float uniformSplit = nearPlane + (shadowDistance - nearPlane) * p;
+			float sliceFar = SPLIT_LAMBDA * logSplit + (1.0f - SPLIT_LAMBDA) * uniformSplit;
+
+			//bounding sphere of the slice, it lies on the view axis so it does not change size as the camera turns
+			float centerDepth = 0.5f * (sliceNear + sliceFar);
+			float radius = 0.0f;
+			for (int corner = 0; corner < 2; corner++) {
+				float depth = corner == 0 ? sliceNear : sliceFar;
+				glm::vec3 offset(tanHalfX * depth, tanHalfY * depth, depth - centerDepth);
+				radius = glm::max(radius, glm::length(offset));
+			}
+			//round up so float noise does not change the texel size from frame to frame
+			radius = ceilf(radius * 16.0f) / 16.0f;
+
+			glm::vec4 center = lightRotation * inverseView * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f);
+
+			//move the box in whole texels so static edges do not crawl while the camera moves
+			float texelSize = 2.0f * radius / resolution;
+			center.x = floorf(center.x / texelSize) * texelSize;
+			center.y = floorf(center.y / texelSize) * texelSize;
+			center.z = floorf(center.z / texelSize) * texelSize;
+
+			//light space looks down -z, casters between the light and the slice sit at larger z
+			float depthRange = 2.0f * radius + CASTER_MARGIN;
+			glm::mat4 lightProjection = glm::ortho(center.x - radius, center.x + radius,
+				center.y - radius, center.y + radius,
+				-(center.z + radius + CASTER_MARGIN), -(center.z - radius));
+
+			matrices[i] = lightProjection * lightRotation;
+			splitDepths[i] = sliceFar;
+			depthBiases[i] = glm::max(1.5f * texelSize, MIN_WORLD_BIAS) / depthRange;
+			depthToUVScales[i] = depthRange / (2.0f * radius);
+
+			sliceNear = sliceFar;
+		}
+	}
+
+	const glm::mat4& ShadowCascades::getMatrix(int cascade) const
+	{
+		return matrices[cascade];
+	}
+
+	const glm::mat4* ShadowCascades::getMatrices() const
+	{
+		return matrices;
+	}
+
+	const float* ShadowCascades::getSplitDepths() const
+	{
+		return splitDepths;
+	}
+
+	const float* ShadowCascades::getDepthBiases() const
+	{
+		return depthBiases;
+	}
+
+	const float* ShadowCascades::getDepthToUVScales() const
+	{
+		return depthToUVScales;
+	}
+
+}
@@ -0,0 +1,49 @@
+#ifndef ShadowCascades_hpp
+#define ShadowCascades_hpp
+
+#include <glm/glm.hpp>
+
+namespace gps {
+
+// Splits the camera frustum into depth slices and fits a directional light projection around each one
+class ShadowCascades
+{
+public:
+    // must match MAX_CASCADES in basic.frag
+    static const int MAX_CASCADES = 4;
+
+    // cascadeCount is clamped to [1, MAX_CASCADES], resolution is the side of each cascade's depth map
+    ShadowCascades(int cascadeCount = MAX_CASCADES, int resolution = 2048);
+
+    void setCascadeCount(int cascadeCount);
+    void setResolution(int resolution);
+    int getCascadeCount() const;
+    int getResolution() const;
+
+    // Refits every cascade for the camera. lightDirection points from the light into the scene.
+    // Shadows end shadowDistance in front of the camera.
+    void update(const glm::mat4& view, float fovY, float aspect, float nearPlane, float shadowDistance,
+        const glm::vec3& lightDirection);
+
+    // Light view-projection of a cascade
+    const glm::mat4& getMatrix(int cascade) const;
+    const glm::mat4* getMatrices() const;
+    // View-space depth where each cascade ends
+    const float* getSplitDepths() const;
+    // Depth bias of each cascade in [0, 1] depth units, about the same world distance for all of them
+    const float* getDepthBiases() const;
+    // Depth range over width of each cascade, turns [0, 1] depth differences into shadow map UV distances
+    const float* getDepthToUVScales() const;
+
+private:
+    int cascadeCount;
+    int resolution;
+    glm::mat4 matrices[MAX_CASCADES];
+    float splitDepths[MAX_CASCADES];
+    float depthBiases[MAX_CASCADES];
+    float depthToUVScales[MAX_CASCADES];
+};
+
+}
+
+#endif /* ShadowCascades_hpp */
@@ -0,0 +1,167 @@
+#include "TextureCache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace gps {
+
+	static const char MAGIC[4] = { 'G', 'T', 'X', 'C' };
+	// bump whenever the layout below or the encoders change
+	static const uint32_t VERSION = 1;
+	static const uint64_t DATA_ALIGNMENT = 16;
+	// larger than any texture size a GL 4.1 context accepts
+	static const uint32_t MAX_LEVEL_SIZE = 32768;
+
+	struct FileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t cacheSize;
+		uint64_t sourceSize;
+		uint64_t sourceTimeHash;
+		uint32_t flags;
+		uint32_t format;
+		uint32_t levelCount;
+		uint32_t padding;
+		uint64_t dataOffset;
+	};
+
+	struct LevelRecord
+	{
+		uint64_t offset;
+		uint64_t size;
+		uint32_t width;
+		uint32_t height;
+	};
+
+	//the formats TextureCompressor produces for the compression in the low byte of the flags
+	static bool isExpectedFormat(uint32_t format, uint32_t flags)
+	{
+		switch ((TextureCompression)(flags & 0xFF)) {
+		case TEXTURE_COMPRESSION_BC1_BC3:
+			return format == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+		case TEXTURE_COMPRESSION_BC7:
+			return format == GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+		default:
+			return false;
+		}
+	}
+
+	std::string TextureCache::cacheFileName(const std::string& imageFileName)
+	{
+		return imageFileName + ".texcache";
+	}
+
+	bool TextureCache::read(const std::string& fileName, const MeshCacheSource& source, CompressedImage& image)
+	{
+		image.levels.clear();
+		if (!image.file.open(fileName)) {
+			return false;
+		}
+
+		const char* data = image.file.getData();
+		uint64_t size = image.file.getSize();
+
+		FileHeader header;
+		if (size < sizeof(header)) {
+			return false;
+		}
+		memcpy(&header, data, sizeof(header));
+
+		if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION ||
+			header.cacheSize != size || header.sourceSize != source.fileSize ||
+			header.sourceTimeHash != source.timeHash || header.flags != source.flags) {
+			return false;
+		}
+
+		if (!isExpectedFormat(header.format, header.flags)) {
+			return false;
+		}
+
+		if (header.levelCount == 0 || sizeof(header) + (uint64_t)header.levelCount * sizeof(LevelRecord) > header.dataOffset ||
+			header.dataOffset > size) {
+			return false;
+		}
+
+		for (uint32_t l = 0; l < header.levelCount; l++) {
+			LevelRecord record;
+			memcpy(&record, data + sizeof(header) + l * sizeof(LevelRecord), sizeof(record));
+
+			//a full chain: a non-empty level 0, then each level half the one before down to 1x1
+			bool chained;
+			if (l == 0) {
+				chained = record.width > 0 && record.height > 0 && record.width <= MAX_LEVEL_SIZE && record.height <= MAX_LEVEL_SIZE;
+			}
+			else {
+				const CompressedLevel& previous = image.levels.back();
+				chained = (previous.width > 1 || previous.height > 1) &&
+					record.width == (uint32_t)std::max(1, previous.width / 2) && record.height == (uint32_t)std::max(1, previous.height / 2);
+			}
+			if (!chained || record.size != TextureCompressor::getLevelSize(record.width, record.height, header.format) ||
+				record.offset > size - header.dataOffset || record.size > size - header.dataOffset - record.offset) {
+				image.levels.clear();
+				return false;
+			}
+
+			CompressedLevel level;
+			level.width = (int)record.width;
+			level.height = (int)record.height;
+			level.offset = (size_t)record.offset;
+			level.size = (size_t)record.size;
+			image.levels.push_back(level);
+		}
+
+		//a chain that stops early leaves the texture mip-incomplete
+		if (image.levels.back().width != 1 || image.levels.back().height != 1) {
+			image.levels.clear();
+			return false;
+		}
+
+		image.format = header.format;
+		image.data = (const unsigned char*)data + header.dataOffset;
+		image.size = (size_t)(size - header.dataOffset);
+		return true;
+	}
+
+	bool TextureCache::write(const std::string& fileName, const MeshCacheSource& source, const CompressedImage& image)
+	{
+		uint64_t recordsEnd = sizeof(FileHeader) + image.levels.size() * sizeof(LevelRecord);
+
+		FileHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.version = VERSION;
+		header.sourceSize = source.fileSize;
+		header.sourceTimeHash = source.timeHash;
+		header.flags = source.flags;
+		header.format = image.format;
+		header.levelCount = (uint32_t)image.levels.size();
+		header.dataOffset = (recordsEnd + DATA_ALIGNMENT - 1) & ~(DATA_ALIGNMENT - 1);
+		header.cacheSize = header.dataOffset + image.size;
+
+		std::ofstream out(fileName.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out) {
+			return false;
+		}
+
+		out.write((const char*)&header, sizeof(header));
+		for (size_t l = 0; l < image.levels.size(); l++) {
+			LevelRecord record;
+			record.offset = image.levels[l].offset;
+			record.size = image.levels[l].size;
+			record.width = (uint32_t)image.levels[l].width;
+			record.height = (uint32_t)image.levels[l].height;
+			out.write((const char*)&record, sizeof(record));
+		}
+
+		static const char zeros[DATA_ALIGNMENT] = { 0 };
+		out.write(zeros, header.dataOffset - recordsEnd);
+		if (image.size > 0) {
+			out.write((const char*)image.data, image.size);
+		}
+
+		return out.good();
+	}
+
+}
@@ -0,0 +1,28 @@
+#ifndef TextureCache_hpp
+#define TextureCache_hpp
+
+#include "MeshCache.hpp"
+#include "TextureCompressor.hpp"
+
+#include <string>
+
+namespace gps {
+
+// Block compressed mip chain of an image, stored next to it as <name>.texcache (a DDS-like
+// header, one record per level, then the levels back to back ready for glCompressedTexImage2D)
+class TextureCache
+{
+public:
+    static std::string cacheFileName(const std::string& imageFileName);
+
+    // Maps the cache into image.file and points the levels into it, false if it is missing, stale or damaged.
+    // source comes from MeshCache::readSource with the TextureCompression and the MipFilter (shifted by 8) as flags.
+    static bool read(const std::string& fileName, const MeshCacheSource& source, CompressedImage& image);
+
+    // Writes the levels of image, false on I/O errors
+    static bool write(const std::string& fileName, const MeshCacheSource& source, const CompressedImage& image);
+};
+
+}
+
+#endif /* TextureCache_hpp */
@@ -0,0 +1,495 @@
+#include "TextureCompressor.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace gps {
+
+	static const int BLOCK_TEXELS = 16;
+
+	// BC7 4-bit index weights, out of 64
+	static const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	CompressedImage::CompressedImage() : format(0), data(NULL), size(0)
+	{
+	}
+
+	static int clampInt(int value, int low, int high)
+	{
+		return std::min(high, std::max(low, value));
+	}
+
+	//mean and dominant direction of 16 points with channels components, by power iteration on the covariance
+	static void principalAxis(const float* points, int channels, float* mean, float* axis)
+	{
+		for (int c = 0; c < channels; c++) {
+			mean[c] = 0.0f;
+			for (int i = 0; i < BLOCK_TEXELS; i++) {
+				mean[c] += points[i * channels + c];
+			}
+			mean[c] /= BLOCK_TEXELS;
+		}
+
+		float covariance[4][4] = { { 0.0f } };
+		float low[4] = { FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX };
+		float high[4] = { -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (int i = 0; i < BLOCK_TEXELS; i++) {
+			for (int a = 0; a < channels; a++) {
+				float da = points[i * channels + a] - mean[a];
+				low[a] = std::min(low[a], points[i * channels + a]);
+				high[a] = std::max(high[a], points[i * channels + a]);
+				for (int b = a; b < channels; b++) {
+					covariance[a][b] += da * (points[i * channels + b] - mean[b]);
+				}
+			}
+		}
+		for (int a = 0; a < channels; a++) {
+			for (int b = 0; b < a; b++) {
+				covariance[a][b] = covariance[b][a];
+			}
+		}
+
+		//the bounding box diagonal is a good first guess and converges in a few steps
+		for (int c = 0; c < channels; c++) {
+			axis[c] = high[c] - low[c];
+		}
+		for (int iteration = 0; iteration < 8; iteration++) {
+			float next[4] = { 0.0f };
+			float length = 0.0f;
+			for (int a = 0; a < channels; a++) {
+				for (int b = 0; b < channels; b++) {
+					next[a] += covariance[a][b] * axis[b];
+				}
+				length += next[a] * next[a];
+			}
+			if (length < 1e-12f) {
+				break;
+			}
+			length = 1.0f / sqrtf(length);
+			for (int c = 0; c < channels; c++) {
+				axis[c] = next[c] * length;
+			}
+		}
+	}
+
+	//farthest points of the block along its axis, first and second endpoint
+	static void fitEndpoints(const float* points, int channels, float endpoints[2][4])
+	{
+		float mean[4];
+		float axis[4];
+		principalAxis(points, channels, mean, axis);
+
+		float minT = FLT_MAX;
+		float maxT = -FLT_MAX;
+		for (int i = 0; i < BLOCK_TEXELS; i++) {
+			float t = 0.0f;
+			for (int c = 0; c < channels; c++) {
+				t += (points[i * channels + c] - mean[c]) * axis[c];
+			}
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+
+		for (int c = 0; c < channels; c++) {
+			endpoints[0][c] = mean[c] + axis[c] * maxT;
+			endpoints[1][c] = mean[c] + axis[c] * minT;
+		}
+	}
+
+	static uint16_t pack565(const float* color)
+	{
+		int r = clampInt((int)(color[0] + 0.5f), 0, 255);
+		int g = clampInt((int)(color[1] + 0.5f), 0, 255);
+		int b = clampInt((int)(color[2] + 0.5f), 0, 255);
+		return (uint16_t)((((r * 31 + 127) / 255) << 11) | (((g * 63 + 127) / 255) << 5) | ((b * 31 + 127) / 255));
+	}
+
+	static void unpack565(uint16_t packed, int* color)
+	{
+		int r = (packed >> 11) & 31;
+		int g = (packed >> 5) & 63;
+		int b = packed & 31;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+	}
+
+	//picks the nearest of the four colours for each texel, returns the squared error
+	static int fitColorIndices(const unsigned char* texels, uint16_t color0, uint16_t color1, uint32_t& indices)
+	{
+		int palette[4][3];
+		unpack565(color0, palette[0]);
+		unpack565(color1, palette[1]);
+		for (int c = 0; c < 3; c++) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		int error = 0;
+		indices = 0;
+		for (int i = 0; i < BLOCK_TEXELS; i++) {
+			int bestIndex = 0;
+			int bestError = INT32_MAX;
+			for (int p = 0; p < 4; p++) {
+				int dr = texels[i * 4 + 0] - palette[p][0];
+				int dg = texels[i * 4 + 1] - palette[p][1];
+				int db = texels[i * 4 + 2] - palette[p][2];
+				int texelError = dr * dr + dg * dg + db * db;
+				if (texelError < bestError) {
+					bestError = texelError;
+					bestIndex = p;
+				}
+			}
+			indices |= (uint32_t)bestIndex << (2 * i);
+			error += bestError;
+		}
+		return error;
+	}
+
+	//least squares endpoints for fixed indices, false when the indices do not pin both endpoints down
+	static bool refineColorEndpoints(const unsigned char* texels, uint32_t indices, float endpoints[2][4])
+	{
+		//fraction of the second endpoint in each palette entry
+		static const float SECOND_WEIGHT[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ax[3] = { 0.0f }, bx[3] = { 0.0f };
+		for (int i = 0; i < BLOCK_TEXELS; i++) {
+			float b = SECOND_WEIGHT[(indices >> (2 * i)) & 3];
+			float a = 1.0f - b;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int c = 0; c < 3; c++) {
+				ax[c] += a * texels[i * 4 + c];
+				bx[c] += b * texels[i * 4 + c];
+			}
+		}
+
+		float determinant = aa * bb - ab * ab;
+		if (fabsf(determinant) < 1e-6f) {
+			return false;
+		}
+		float inverse = 1.0f / determinant;
+		for (int c = 0; c < 3; c++) {
+			endpoints[0][c] = (ax[c] * bb - bx[c] * ab) * inverse;
+			endpoints[1][c] = (bx[c] * aa - ax[c] * ab) * inverse;
+		}
+		return true;
+	}
+
+	//the colour half shared by BC1 and BC3, always in four colour mode
+	static void encodeColorBlock(const unsigned char* texels, unsigned char* block)
+	{
+		float points[BLOCK_TEXELS * 3];
+		for (int i = 0; i < BLOCK_TEXELS; i++) {
+			for (int c = 0; c < 3; c++) {
+				points[i * 3 + c] = texels[i * 4 + c];
+			}
+		}
+
+		float endpoints[2][4];
+		fitEndpoints(points, 3, endpoints);
+		uint16_t color0 = pack565(endpoints[0]);
+		uint16_t color1 = pack565(endpoints[1]);
+		uint32_t indices;
+		int error = fitColorIndices(texels, color0, color1, indices);
+
+		//one least squares pass usually moves the endpoints off the block's extremes to where the texels cluster
+		if (error > 0 && refineColorEndpoints(texels, indices, endpoints)) {
+			uint16_t refined0 = pack565(endpoints[0]);
+			uint16_t refined1 = pack565(endpoints[1]);
+			uint32_t refinedIndices;
+			if (fitColorIndices(texels, refined0, refined1, refinedIndices) < error) {
+				color0 = refined0;
+				color1 = refined1;
+				indices = refinedIndices;
+			}
+		}
+
+		//four colour mode needs color0 > color1, swapping the endpoints swaps indices 0/1 and 2/3
+		if (color0 < color1) {
+			std::swap(color0, color1);
+			indices ^= 0x55555555u;
+		}
+		else if (color0 == color1) {
+			//three colour mode, where index 3 would be black
+			indices = 0;
+		}
+
+		block[0] = (unsigned char)(color0 & 0xFF);
+		block[1] = (unsigned char)(color0 >> 8);
+		block[2] = (unsigned char)(color1 & 0xFF);
+		block[3] = (unsigned char)(color1 >> 8);
+		for (int i = 0; i < 4; i++) {
+			block[4 + i] = (unsigned char)(indices >> (8 * i));
+		}
+	}
+
+	void TextureCompressor::encodeBC1(const unsigned char* texels, unsigned char* block)
+	{
+		encodeColorBlock(texels, block);
+	}
+
+	void TextureCompressor::encodeBC3(const unsigned char* texels, unsigned char* block)
+	{
+		int minAlpha = 255;
+		int maxAlpha = 0;
+		for (int i = 0; i < BLOCK_TEXELS; i++) {
+			minAlpha = std::min(minAlpha, (int)texels[i * 4 + 3]);
+			maxAlpha = std::max(maxAlpha, (int)texels[i * 4 + 3]);
+		}
+
+		//eight value mode: alpha0 > alpha1 with six steps between them
+		uint64_t indices = 0;
+		if (maxAlpha > minAlpha) {
+			int range = maxAlpha - minAlpha;
+			for (int i = 0; i < BLOCK_TEXELS; i++) {
+				int step = ((maxAlpha - texels[i * 4 + 3]) * 7 + range / 2) / range;
+				int index = step == 0 ? 0 : (step == 7 ? 1 : step + 1);
+				indices |= (uint64_t)index << (3 * i);
+			}
+		}
+
+		block[0] = (unsigned char)maxAlpha;
+		block[1] = (unsigned char)minAlpha;
+		for (int i = 0; i < 6; i++) {
+			block[2 + i] = (unsigned char)(indices >> (8 * i));
+		}
+		encodeColorBlock(texels, block + 8);
+	}
+
+	//writes fields into a 128-bit block least significant bit first
+	struct BlockWriter
+	{
+		unsigned char* block;
+		int bit;
+
+		explicit BlockWriter(unsigned char* block) : block(block), bit(0) {
+			memset(block, 0, 16);
+		}
+
+		void write(uint32_t value, int bits) {
+			for (int i = 0; i < bits; i++, bit++) {
+				block[bit >> 3] |= (unsigned char)(((value >> i) & 1) << (bit & 7));
+			}
+		}
+	};
+
+	//BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a shared low bit each, 4-bit indices
+	void TextureCompressor::encodeBC7(const unsigned char* texels, unsigned char* block)
+	{
+		float points[BLOCK_TEXELS * 4];
+		for (int i = 0; i < BLOCK_TEXELS * 4; i++) {
+			points[i] = texels[i];
+		}
+		float fitted[2][4];
+		fitEndpoints(points, 4, fitted);
+
+		int bestError = INT32_MAX;
+		int bestEndpoints[2][4] = { { 0 } };
+		int bestBits[2] = { 0, 0 };
+		int bestIndices[BLOCK_TEXELS] = { 0 };
+
+		//each endpoint's low bit is shared by its four channels, so try all four combinations
+		for (int combination = 0; combination < 4; combination++) {
+			int bits[2] = { combination & 1, combination >> 1 };
+			int endpoints[2][4];
+			for (int e = 0; e < 2; e++) {
+				for (int c = 0; c < 4; c++) {
+					int high = clampInt((int)floorf((fitted[e][c] - bits[e]) * 0.5f + 0.5f), 0, 127);
+					endpoints[e][c] = (high << 1) | bits[e];
+				}
+			}
+
+			int direction[4];
+			int lengthSquared = 0;
+			for (int c = 0; c < 4; c++) {
+				direction[c] = endpoints[1][c] - endpoints[0][c];
+				lengthSquared += direction[c] * direction[c];
+			}
+
+			int error = 0;
+			int indices[BLOCK_TEXELS];
+			for (int i = 0; i < BLOCK_TEXELS; i++) {
+				//project onto the segment for a first index, then settle between it and its neighbours
+				int guess = 0;
+				if (lengthSquared > 0) {
+					int dot = 0;
+					for (int c = 0; c < 4; c++) {
+						dot += (texels[i * 4 + c] - endpoints[0][c]) * direction[c];
+					}
+					float weight = 64.0f * dot / lengthSquared;
+					for (int w = 1; w < 16; w++) {
+						if (fabsf(BC7_WEIGHTS[w] - weight) < fabsf(BC7_WEIGHTS[guess] - weight)) {
+							guess = w;
+						}
+					}
+				}
+
+				int bestTexelError = INT32_MAX;
+				for (int w = std::max(0, guess - 1); w <= std::min(15, guess + 1); w++) {
+					int texelError = 0;
+					for (int c = 0; c < 4; c++) {
+						int value = ((64 - BC7_WEIGHTS[w]) * endpoints[0][c] + BC7_WEIGHTS[w] * endpoints[1][c] + 32) >> 6;
+						int difference = texels[i * 4 + c] - value;
+						texelError += difference * difference;
+					}
+					if (texelError < bestTexelError) {
+						bestTexelError = texelError;
+						indices[i] = w;
+					}
+				}
+				error += bestTexelError;
+			}
+
+			if (error < bestError) {
+				bestError = error;
+				memcpy(bestEndpoints, endpoints, sizeof(endpoints));
+				memcpy(bestIndices, indices, sizeof(indices));
+				bestBits[0] = bits[0];
+				bestBits[1] = bits[1];
+			}
+		}
+
+		//the first index is stored without its top bit, so it must be below 8; the weights are symmetric
+		if (bestIndices[0] >= 8) {
+			for (int c = 0; c < 4; c++) {
+				std::swap(bestEndpoints[0][c], bestEndpoints[1][c]);
+			}
+			std::swap(bestBits[0], bestBits[1]);
+			for (int i = 0; i < BLOCK_TEXELS; i++) {
+				bestIndices[i] = 15 - bestIndices[i];
+			}
+		}
+
+		BlockWriter writer(block);
+		writer.write(1 << 6, 7);
+		for (int c = 0; c < 4; c++) {
+			writer.write(bestEndpoints[0][c] >> 1, 7);
+			writer.write(bestEndpoints[1][c] >> 1, 7);
+		}
+		writer.write(bestBits[0], 1);
+		writer.write(bestBits[1], 1);
+		writer.write(bestIndices[0], 3);
+		for (int i = 1; i < BLOCK_TEXELS; i++) {
+			writer.write(bestIndices[i], 4);
+		}
+	}
+
+	size_t TextureCompressor::getLevelSize(int width, int height, GLenum format)
+	{
+		size_t blockBytes = format == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT ? 8 : 16;
+		return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+	}
+
+	void TextureCompressor::encodeLevel(const unsigned char* pixels, int width, int height, GLenum format, unsigned char* out)
+	{
+		size_t blockBytes = format == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT ? 8 : 16;
+		unsigned char texels[BLOCK_TEXELS * 4];
+
+		for (int blockY = 0; blockY < height; blockY += 4) {
+			for (int blockX = 0; blockX < width; blockX += 4) {
+				for (int y = 0; y < 4; y++) {
+					const unsigned char* row = pixels + (size_t)std::min(blockY + y, height - 1) * width * 4;
+					for (int x = 0; x < 4; x++) {
+						memcpy(texels + (y * 4 + x) * 4, row + (size_t)std::min(blockX + x, width - 1) * 4, 4);
+					}
+				}
+
+				if (format == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT) {
+					encodeBC1(texels, out);
+				}
+				else if (format == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT) {
+					encodeBC3(texels, out);
+				}
+				else {
+					encodeBC7(texels, out);
+				}
+				out += blockBytes;
+			}
+		}
+	}
+
+	bool TextureCompressor::compress(const unsigned char* pixels, int width, int height, TextureCompression compression, MipFilter mipFilter,
+		CompressedImage& image)
+	{
+		if (compression == TEXTURE_COMPRESSION_NONE || pixels == NULL || width <= 0 || height <= 0) {
+			return false;
+		}
+
+		if (compression == TEXTURE_COMPRESSION_BC7) {
+			image.format = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+		}
+		else {
+			//BC1 has no alpha worth keeping, so it is only used when every texel is opaque
+			bool opaque = true;
+			for (size_t i = 0; i < (size_t)width * height && opaque; i++) {
+				opaque = pixels[i * 4 + 3] == 255;
+			}
+			image.format = opaque ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+		}
+
+		//the whole chain down to 1x1, back to back
+		image.levels.clear();
+		size_t offset = 0;
+		for (int levelWidth = width, levelHeight = height; ; levelWidth = std::max(1, levelWidth / 2), levelHeight = std::max(1, levelHeight / 2)) {
+			CompressedLevel level;
+			level.width = levelWidth;
+			level.height = levelHeight;
+			level.offset = offset;
+			level.size = getLevelSize(levelWidth, levelHeight, image.format);
+			image.levels.push_back(level);
+			offset += level.size;
+			if (levelWidth == 1 && levelHeight == 1) {
+				break;
+			}
+		}
+		image.storage.resize(offset);
+		image.data = image.storage.data();
+		image.size = offset;
+
+		std::vector<unsigned char> mips[2];
+		const unsigned char* levelPixels = pixels;
+		for (size_t l = 0; l < image.levels.size(); l++) {
+			const CompressedLevel& level = image.levels[l];
+			if (l > 0) {
+				const CompressedLevel& previous = image.levels[l - 1];
+				std::vector<unsigned char>& target = mips[l & 1];
+				target.resize((size_t)level.width * level.height * 4);
+				ImageOps::downsample(levelPixels, previous.width, previous.height, target.data(), mipFilter);
+				levelPixels = target.data();
+			}
+			encodeLevel(levelPixels, level.width, level.height, image.format, image.storage.data() + level.offset);
+		}
+		return true;
+	}
+
+	bool TextureCompressor::isSupported(TextureCompression compression)
+	{
+		if (compression == TEXTURE_COMPRESSION_BC1_BC3) {
+			//the sRGB S3TC formats come from EXT_texture_sRGB
+			return GLEW_EXT_texture_compression_s3tc && GLEW_EXT_texture_sRGB;
+		}
+		if (compression == TEXTURE_COMPRESSION_BC7) {
+			return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+		}
+		return true;
+	}
+
+	const char* TextureCompressor::getName(TextureCompression compression)
+	{
+		switch (compression) {
+		case TEXTURE_COMPRESSION_BC1_BC3:
+			return "bc1/bc3";
+		case TEXTURE_COMPRESSION_BC7:
+			return "bc7";
+		default:
+			return "none";
+		}
+	}
+
+}
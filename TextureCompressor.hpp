@@ -0,0 +1,79 @@
+#ifndef TextureCompressor_hpp
+#define TextureCompressor_hpp
+
+#include "ImageOps.hpp"
+#include "MeshCache.hpp"
+
+#include <GL/glew.h>
+
+#include <memory>
+#include <vector>
+
+namespace gps {
+
+enum TextureCompression
+{
+    // RGBA8 uploads with mipmaps generated by the driver
+    TEXTURE_COMPRESSION_NONE = 0,
+    // BC1 for opaque images, BC3 when some texel is not fully opaque
+    TEXTURE_COMPRESSION_BC1_BC3 = 1,
+    // BC7 mode 6 for every image, twice the size of BC1 for much less banding
+    TEXTURE_COMPRESSION_BC7 = 2
+};
+
+// One mip level of a block compressed image
+struct CompressedLevel
+{
+    int width;
+    int height;
+    // bytes from the start of the image data
+    size_t offset;
+    size_t size;
+};
+
+// Block compressed image with its whole mip chain, bottom row first like glCompressedTexImage2D expects.
+// The levels are stored back to back, either in storage or in a mapped texture cache.
+struct CompressedImage
+{
+    // sRGB BC1, BC3 or BC7 internal format
+    GLenum format;
+    std::vector<CompressedLevel> levels;
+    const unsigned char* data;
+    size_t size;
+
+    std::vector<unsigned char> storage;
+    MappedFile file;
+
+    CompressedImage();
+};
+
+// CPU encoder for the BC formats, since the textures are compressed before any GL context exists
+class TextureCompressor
+{
+public:
+    // Encodes one 4x4 block of RGBA8 texels, given row by row, into 8 (BC1) or 16 (BC3, BC7) bytes
+    static void encodeBC1(const unsigned char* texels, unsigned char* block);
+    static void encodeBC3(const unsigned char* texels, unsigned char* block);
+    static void encodeBC7(const unsigned char* texels, unsigned char* block);
+
+    // Bytes of one level of the given size, partial blocks count as whole ones
+    static size_t getLevelSize(int width, int height, GLenum format);
+
+    // Builds the mip chain of an RGBA8 image (rows in the order they will be uploaded) with mipFilter
+    // and encodes every level; false for TEXTURE_COMPRESSION_NONE or an empty image
+    static bool compress(const unsigned char* pixels, int width, int height, TextureCompression compression, MipFilter mipFilter,
+        CompressedImage& image);
+
+    // The context can sample the formats the compression produces
+    static bool isSupported(TextureCompression compression);
+
+    static const char* getName(TextureCompression compression);
+
+private:
+    // Encodes a whole RGBA8 level block by block, repeating the edge texels to fill partial blocks
+    static void encodeLevel(const unsigned char* pixels, int width, int height, GLenum format, unsigned char* out);
+};
+
+}
+
+#endif /* TextureCompressor_hpp */
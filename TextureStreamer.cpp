@@ -0,0 +1,233 @@
+#include "TextureStreamer.hpp"
+#include "GLStateCache.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+namespace gps {
+
+	// mid grey, so untextured surfaces do not flash black or white while streaming
+	static const unsigned char PLACEHOLDER_PIXEL[4] = { 128, 128, 128, 255 };
+
+	static void setTextureParameters()
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+
+	//bytes an image puts through a pixel buffer
+	static size_t uploadBytes(const ImageData& image)
+	{
+		if (image.compressed) {
+			return image.compressed->size;
+		}
+		return (size_t)image.width * image.height * 4;
+	}
+
+	TextureStreamer::TextureStreamer(JobSystem& jobSystem, int ringSize)
+		: jobSystem(jobSystem), ringSize(ringSize > 0 ? ringSize : 1), nextSlot(0), pendingCount(0),
+		lastUpdateMs(0.0), maxUpdateMs(0.0)
+	{
+	}
+
+	TextureStreamer::~TextureStreamer()
+	{
+		//the decode jobs write into requests owned by this object
+		jobSystem.wait(&decodeCounter);
+	}
+
+	void TextureStreamer::createRing()
+	{
+		ring.resize(ringSize);
+		for (size_t i = 0; i < ring.size(); i++) {
+			glGenBuffers(1, &ring[i].buffer);
+			ring[i].fence = 0;
+			ring[i].capacity = 0;
+		}
+	}
+
+	GLuint TextureStreamer::request(const std::string& path)
+	{
+		if (ring.empty()) {
+			createRing();
+		}
+
+		GLuint textureID;
+		glGenTextures(1, &textureID);
+		GLStateCache::bindTexture2D(0, textureID);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, PLACEHOLDER_PIXEL);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		setTextureParameters();
+
+		pendingCount++;
+
+		Request* pending = new Request();
+		pending->texture = textureID;
+		pending->image.path = path;
+		pending->image.width = 0;
+		pending->image.height = 0;
+		pending->image.decodeMs = 0.0;
+
+		jobSystem.run([this, pending]() {
+			//the rows are flipped while copying into the pixel buffer
+			Model3D::DecodeImage(pending->image, false);
+
+			std::lock_guard<std::mutex> lock(decodedMutex);
+			decoded.push_back(std::unique_ptr<Request>(pending));
+		}, &decodeCounter);
+
+		return textureID;
+	}
+
+	bool TextureStreamer::isSlotFree(Slot& slot)
+	{
+		if (slot.fence == 0) {
+			return true;
+		}
+
+		GLenum status = glClientWaitSync(slot.fence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED) {
+			return false;
+		}
+
+		glDeleteSync(slot.fence);
+		slot.fence = 0;
+		return true;
+	}
+
+	void TextureStreamer::upload(Slot& slot, const Request& request)
+	{
+		const ImageData& image = request.image;
+		size_t rowBytes = (size_t)image.width * 4;
+		size_t bytes = uploadBytes(image);
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+		if (slot.capacity < bytes) {
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+			slot.capacity = bytes;
+		}
+
+		//the fence said the previous upload is done with this buffer, so mapping does not stall
+		unsigned char* mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (mapped && image.compressed) {
+			//the levels are already bottom row first and back to back, so they go in with one copy
+			const CompressedImage& compressed = *image.compressed;
+			memcpy(mapped, compressed.data, bytes);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+			GLStateCache::bindTexture2D(0, request.texture);
+			for (size_t l = 0; l < compressed.levels.size(); l++) {
+				const CompressedLevel& level = compressed.levels[l];
+				glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)l, compressed.format, level.width, level.height, 0,
+					(GLsizei)level.size, (const void*)level.offset);
+			}
+		}
+		else if (mapped) {
+			//OpenGL wants the bottom row first
+			const unsigned char* pixels = image.pixels.get();
+			for (int row = 0; row < image.height; row++) {
+				memcpy(mapped + row * rowBytes, pixels + (image.height - row - 1) * rowBytes, rowBytes);
+			}
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+			//respecifying the same id keeps every mesh that holds it pointing at the real image
+			GLStateCache::bindTexture2D(0, request.texture);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, (const void*)0);
+			glGenerateMipmap(GL_TEXTURE_2D);
+		}
+		else {
+			fprintf(stderr, "ERROR: could not map the pixel buffer for %s\n", image.path.c_str());
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	void TextureStreamer::update(size_t budgetBytes)
+	{
+		if (pendingCount == 0) {
+			lastUpdateMs = 0.0;
+			return;
+		}
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		size_t uploadedBytes = 0;
+
+		while (uploadedBytes == 0 || uploadedBytes < budgetBytes) {
+			Slot& slot = ring[nextSlot];
+			if (!isSlotFree(slot)) {
+				//every buffer is still being read by the GPU, try again next frame
+				break;
+			}
+
+			std::unique_ptr<Request> next;
+			{
+				std::lock_guard<std::mutex> lock(decodedMutex);
+				if (decoded.empty()) {
+					break;
+				}
+				next = std::move(decoded.front());
+				decoded.pop_front();
+			}
+
+			pendingCount--;
+			if (!next->image.pixels && !next->image.compressed) {
+				//DecodeImage reported the error, the placeholder stays
+				continue;
+			}
+
+			upload(slot, *next);
+			uploadedBytes += uploadBytes(next->image);
+			nextSlot = (nextSlot + 1) % ring.size();
+		}
+
+		lastUpdateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		if (lastUpdateMs > maxUpdateMs) {
+			maxUpdateMs = lastUpdateMs;
+		}
+	}
+
+	int TextureStreamer::getPendingCount() const
+	{
+		return pendingCount;
+	}
+
+	double TextureStreamer::getLastUpdateMs() const
+	{
+		return lastUpdateMs;
+	}
+
+	double TextureStreamer::getMaxUpdateMs() const
+	{
+		return maxUpdateMs;
+	}
+
+	void TextureStreamer::resetStats()
+	{
+		maxUpdateMs = 0.0;
+	}
+
+	void TextureStreamer::release()
+	{
+		jobSystem.wait(&decodeCounter);
+		{
+			std::lock_guard<std::mutex> lock(decodedMutex);
+			decoded.clear();
+		}
+		pendingCount = 0;
+
+		for (size_t i = 0; i < ring.size(); i++) {
+			if (ring[i].fence) {
+				glDeleteSync(ring[i].fence);
+			}
+			glDeleteBuffers(1, &ring[i].buffer);
+		}
+		//the textures belong to the models that requested them
+		ring.clear();
+	}
+
+}
@@ -0,0 +1,84 @@
+#ifndef TextureStreamer_hpp
+#define TextureStreamer_hpp
+
+#include <GL/glew.h>
+
+#include "Model3D.hpp"
+#include "JobSystem.hpp"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+// Hands out textures that show a 1x1 placeholder right away, decodes the images on the job system
+// and uploads them a few per frame through a ring of pixel buffer objects guarded by fences
+class TextureStreamer
+{
+public:
+    // ringSize pixel buffers can be in flight at once; no GL calls are made until the first request
+    explicit TextureStreamer(JobSystem& jobSystem, int ringSize = 4);
+    ~TextureStreamer();
+
+    // New texture id that shows the placeholder until the image at path has been uploaded into it,
+    // the caller owns the texture
+    GLuint request(const std::string& path);
+
+    // Uploads decoded images while less than budgetBytes have been copied this call (at least one
+    // image goes through so large ones are not starved); call once per frame on the GL thread
+    void update(size_t budgetBytes);
+
+    // Textures still waiting to be decoded or uploaded
+    int getPendingCount() const;
+
+    // Time spent in the last update and the longest update since the last call to resetStats
+    double getLastUpdateMs() const;
+    double getMaxUpdateMs() const;
+    void resetStats();
+
+    // Deletes the GL objects, call while the context is still current
+    void release();
+
+private:
+    struct Request
+    {
+        GLuint texture;
+        ImageData image;
+    };
+
+    struct Slot
+    {
+        GLuint buffer;
+        GLsync fence;
+        size_t capacity;
+    };
+
+    JobSystem& jobSystem;
+    JobCounter decodeCounter;
+    int ringSize;
+    std::vector<Slot> ring;
+    unsigned int nextSlot;
+
+    int pendingCount;
+
+    // decoded images waiting for a pixel buffer, filled by the decode jobs
+    std::mutex decodedMutex;
+    std::deque<std::unique_ptr<Request> > decoded;
+
+    double lastUpdateMs;
+    double maxUpdateMs;
+
+    void createRing();
+
+    // True when the slot's previous upload has finished reading from its buffer
+    bool isSlotFree(Slot& slot);
+
+    void upload(Slot& slot, const Request& request);
+};
+
+}
+
+#endif /* TextureStreamer_hpp */
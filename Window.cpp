@@ -2,7 +2,7 @@
 
 namespace gps {
 
-    void Window::Create(int width, int height, const char *title) {
+    void Window::Create(int width, int height, const char *title, WindowOptions options) {
         if (!glfwInit()) {
             throw std::runtime_error("Could not start GLFW3!");
         }
@@ -19,6 +19,15 @@ namespace gps {
         // for multisampling/antialising
         glfwWindowHint(GLFW_SAMPLES, 4);
 
+        glfwWindowHint(GLFW_VISIBLE, options.visible ? GLFW_TRUE : GLFW_FALSE);
+        if (options.egl) {
+#ifdef GLFW_EGL_CONTEXT_API
+            glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+#else
+            std::cerr << "WARNING: this GLFW cannot create EGL contexts, using the native API" << std::endl;
+#endif
+        }
+
         this->window = glfwCreateWindow(width, height, title, NULL, NULL);
         if (!this->window) {
             throw std::runtime_error("Could not create GLFW3 window!");
@@ -26,7 +35,7 @@ namespace gps {
 
         glfwMakeContextCurrent(window);
 
-        glfwSwapInterval(1);
+        glfwSwapInterval(options.vsync ? 1 : 0);
 
         // start GLEW extension handler
         glewExperimental = GL_TRUE;
@@ -42,7 +51,9 @@ namespace gps {
         glfwGetFramebufferSize(window, &this->dimensions.width, &this->dimensions.height);
 
 		//CURSOR IN WINDOW
-		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+		if (options.visible) {
+			glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+		}
     }
 
     void Window::Delete() {
@@ -13,10 +13,20 @@ struct WindowDimensions {
 
 namespace gps {
 
+    struct WindowOptions {
+        // a hidden window still has a context, for offscreen runs
+        bool visible;
+        bool vsync;
+        // create the context through EGL instead of GLX/WGL (e.g. Mesa llvmpipe on build machines)
+        bool egl;
+
+        WindowOptions() : visible(true), vsync(true), egl(false) {}
+    };
+
     class Window {
 
     public:
-        void Create(int width=800, int height=600, const char *title="OpenGL Project");
+        void Create(int width=800, int height=600, const char *title="OpenGL Project", WindowOptions options=WindowOptions());
         void Delete();
 
         GLFWwindow* getWindow();
@@ -10,9 +10,29 @@
 #include "Window.h"
 #include "Shader.hpp"
 #include "Camera.hpp"
+#include "CameraTrack.hpp"
 #include "Model3D.hpp"
+#include "ModelLoader.hpp"
+#include "RainSystem.hpp"
+#include "JobSystem.hpp"
+#include "TextureStreamer.hpp"
+#include "Profiler.hpp"
+#include "GLStateCache.hpp"
+#include "ShadowCascades.hpp"
+#include "Frustum.hpp"
+#include "BVH.hpp"
+#include "RenderQueue.hpp"
+#include "GeometryArena.hpp"
+#include "IndirectBatch.hpp"
+#include "MaterialAtlas.hpp"
+#include "ImageOps.hpp"
 
 #include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
 
 // window
 gps::Window myWindow;
@@ -30,26 +50,59 @@ glm::vec3 lightColor;
 
 glm::vec3 pLightPos;
 
-// shader uniform locations
-GLuint modelLoc;
-GLuint viewLoc;
-GLuint projectionLoc;
-GLuint normalMatrixLoc;
-GLuint lightDirLoc;
-GLuint lightColorLoc;
-
-GLuint pLightPosLoc;
-
-//shadow mapping - directional light
+//shadow mapping - directional light, one layer of the depth array per cascade
 GLuint shadowMapFBO;
 GLuint depthMapTexture;
-
-//shadow mapping - point light
+gps::ShadowCascades shadowCascades;
+//shadows fade out this far in front of the camera
+const float SHADOW_DISTANCE = 40.0f;
+//light view-projection of the cascade being drawn by the shadow pass
+glm::mat4 shadowPassMatrix;
+
+//how the colour pass filters the cascades, each filter is its own build of the scene programs
+enum ShadowFilter {
+	SHADOW_FILTER_NEAREST,
+	SHADOW_FILTER_HARDWARE,
+	SHADOW_FILTER_POISSON,
+	SHADOW_FILTER_PCSS,
+	SHADOW_FILTER_COUNT
+};
+const char* const shadowFilterNames[SHADOW_FILTER_COUNT] = { "nearest", "hardware", "poisson", "pcss" };
+ShadowFilter shadowFilter = SHADOW_FILTER_HARDWARE;
+//samples of the Poisson and PCSS filters, at most 16
+int shadowFilterTaps = 16;
+
+//static casters are drawn once into their own depth array, each frame copies it and adds what moves
+bool shadowCache = true;
+GLuint staticShadowFBO;
+GLuint staticDepthMapTexture;
+bool staticShadowDirty = true;
+//what each static layer was drawn with, a change redraws that layer
+glm::mat4 staticShadowLightMatrix[gps::ShadowCascades::MAX_CASCADES];
+glm::mat4 staticShadowModel;
+//cascade matrices of the last frame, a layer is only cached once its matrix holds for a frame
+glm::mat4 previousShadowLightMatrix[gps::ShadowCascades::MAX_CASCADES];
+//how each layer started its frame: copied from the cache, cache refilled then copied, or drawn directly while moving
+struct ShadowCacheCounts {
+	GLuint hits;
+	GLuint refills;
+	GLuint direct;
+};
+ShadowCacheCounts shadowCacheCounts[gps::ShadowCascades::MAX_CASCADES];
+
+//shadow mapping - point light, distance to the lamp in the six faces of a depth cubemap
 unsigned int depthCubemap;
 GLuint depthMapFBO;
+int pointShadowResolution = 1024;
+const float POINT_SHADOW_NEAR = 0.05f;
+//casters further than this from the lamp are not drawn into the cubemap
+const float POINT_SHADOW_FAR = 25.0f;
+//cube faces the casters were drawn into this frame
+GLuint pointShadowFaces = 0;
 
-const unsigned int SHADOW_WIDTH = 2048;
-const unsigned int SHADOW_HEIGHT = 2048;
+const float CAMERA_FOV = glm::radians(45.0f);
+const float CAMERA_NEAR = 0.1f;
+const float CAMERA_FAR = 500.0f;
 
 // camera
 gps::Camera myCamera(
@@ -63,6 +116,8 @@ GLfloat cameraSpeed = 0.1f;
 GLboolean pressedKeys[1024];
 
 // models
+//one vertex and index buffer pair for the geometry of every model
+gps::GeometryArena geometryArena;
 gps::Model3D sky;
 gps::Model3D ground;
 gps::Model3D bench;
@@ -86,10 +141,35 @@ float wingRZ = 0.645177f;
 bool wingUp;
 float wingAngle = 0;
 
+//the simulation advances in fixed steps, frames are drawn between the last two steps
+const double SIMULATION_STEP = 1.0 / 60.0;
+//a longer frame (window drag, breakpoint) is not caught up all at once
+const double MAX_FRAME_TIME = 0.25;
+
+//animated values a frame is drawn with
+struct AnimationState {
+	glm::vec3 cameraPosition;
+	float bodyCrowY, bodyCrowZ;
+	float wingLY, wingLZ;
+	float wingRY, wingRZ;
+	float wingAngle;
+};
+
+//state before the latest step, and how far the frame is between it and the current state
+AnimationState previousAnimation;
+float animationAlpha = 1.0f;
+AnimationState drawnAnimation;
+//steps taken since the last frame, the rain jobs replay them
+int simulationSteps = 1;
+
 
 // shaders
 gps::Shader myBasicShader;
 gps::Shader depthMapShader;
+gps::Shader rainShader;
+gps::Shader rainDepthShader;
+gps::Shader pointDepthShader;
+gps::Shader depthIndirectShader;
 
 int changeLight = 0; //true - directional; false - point
 int fog = 0;
@@ -105,9 +185,95 @@ bool wind = false;
 
 //rain effect
 bool rain = false;
-std::vector<glm::vec3> raindropsInitialPos;
-std::vector<glm::vec3> raindropsPos;
-float raindropZ;
+int raindropCount = 3000;
+gps::RainSystem rainSystem;
+
+//instanced rain - all drops in one draw call per pass
+bool instancedRain = true;
+//matrices of the frame being drawn and of the frame being simulated
+std::vector<glm::mat4> raindropsModel;
+std::vector<glm::mat4> raindropsNextModel;
+//raindropsNextModel holds a newer state, and the instance buffer an older one
+bool rainNextReady = false;
+//false while the instance buffer holds the full, current set of drops
+bool rainInstancesStale = false;
+GLuint rainInstanceVBO;
+//drops inside the frustum of the pass being drawn
+std::vector<glm::mat4> rainVisibleModels;
+
+//frustum culling, the counts are per frame
+bool frustumCulling = true;
+struct PassCulling {
+	gps::CullStats meshes;
+	gps::CullStats raindrops;
+};
+PassCulling colorCulling;
+PassCulling shadowCulling;
+//frustum and counters of the pass being drawn, NULL draws everything
+const gps::Frustum* passFrustum = NULL;
+PassCulling* passCulling = NULL;
+
+//objects placed in the scene, each one is an item of the scene tree
+enum SceneObject {
+	SCENE_GROUND,
+	SCENE_SKY,
+	SCENE_LAMP,
+	SCENE_BENCH,
+	SCENE_BODY_CROW,
+	SCENE_WING_L,
+	SCENE_WING_R,
+	SCENE_OBJECT_COUNT
+};
+//world boxes of the objects, refitted every frame for the crow
+gps::BVH sceneTree;
+std::vector<gps::BVHBox> sceneBoxes(SCENE_OBJECT_COUNT);
+//objects the scene tree found inside the frustum of the pass being drawn
+bool passVisible[SCENE_OBJECT_COUNT];
+
+//draws of the colour pass, sorted so opaque meshes go front to back and the sky last
+gps::RenderQueue colorQueue;
+
+//shadow casters drawn from the geometry arena with one multi draw per index type (--no-indirect draws them one by one)
+bool indirectShadows = true;
+gps::IndirectBatch shadowBatch;
+//texture unit of the per-draw transforms, above the shadow array (3) and cubemap (4)
+const GLuint DRAW_TRANSFORM_UNIT = 5;
+
+//diffuse and specular textures copied into texture arrays once streaming is done, so a mesh only changes an index (--no-atlas keeps the per-mesh binds)
+bool useMaterialAtlas = true;
+gps::MaterialAtlas materialAtlas;
+//first texture unit of the material arrays, above the draw transforms (5)
+const GLuint MATERIAL_ARRAY_UNIT = 6;
+
+//the next rain frame is simulated on the job system while the current one is drawn
+gps::JobSystem jobSystem;
+
+// textures stream in over the first frames, --sync-textures decodes them all while loading instead
+gps::TextureStreamer textureStreamer(jobSystem);
+
+// the color pass renders here, 0 is the window; the benchmark uses an offscreen target
+GLuint sceneFramebuffer = 0;
+GLuint sceneColorBuffer = 0;
+GLuint sceneDepthBuffer = 0;
+
+// CPU and GPU time per pass and per render call, --profile enables it and writes profile.csv / profile.json on exit
+gps::Profiler profiler;
+bool streamTextures = true;
+const size_t TEXTURE_STREAM_BUDGET = 4 * 1024 * 1024;
+gps::JobCounter rainCounter;
+const int RAIN_CHUNK_SIZE = 16384;
+
+//draw call and uniform lookup statistics
+double statsStartTime;
+int statsFrames = 0;
+GLuint statsDrawCalls = 0;
+GLuint statsPointShadowFaces = 0;
+PassCulling statsColorCulling;
+PassCulling statsShadowCulling;
+gps::RenderQueueStats statsColorQueue;
+GLuint statsUniformLookups = 0;
+GLuint statsStateCallsIssued = 0;
+GLuint statsStateCallsSkipped = 0;
 
 GLenum glCheckError_(const char* file, int line)
 {
@@ -182,7 +348,7 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
 		//update view matrix
 		view = myCamera.getViewMatrix();
 		myBasicShader.useShaderProgram();
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+		myBasicShader.setMat4("view", view);
 		// compute normal matrix for teapot
 		normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
 
@@ -192,108 +358,179 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
 }
 
 void renderScene();
+void setShadowUniforms(gps::Shader& shader);
+void setShadowFilter(ShadowFilter filter);
+
+// point the tour camera looks at
+const glm::vec3 tourTarget = glm::vec3(8.6625f, 1.81263f, 2.37074f);
+// units per second, the old tour moved 0.1 per frame at 60 fps
+const float TOUR_SPEED = 6.0f;
+
+// corners of the tour around the graveyard, in the order they are visited
+std::vector<glm::vec3> tourCorners() {
+	std::vector<glm::vec3> corners;
+	corners.push_back(glm::vec3(0.85717f, 4.0657f, -3.59243f));
+	corners.push_back(glm::vec3(15.7986f, 4.0657f, -3.59243f));
+	corners.push_back(glm::vec3(15.7986f, 4.0657f, 9.81967f));
+	corners.push_back(glm::vec3(0.85717f, 4.0657f, 9.81967f));
+	corners.push_back(glm::vec3(0.85717f, 4.0657f, -5.00509f));
+	return corners;
+}
 
-void sceneAnimation() {
-
-	std::vector<glm::vec3> path;
-	glm::vec3 targetPos = glm::vec3(8.6625f, 1.81263f, 2.37074f);
-
-	path.push_back(glm::vec3(0.85717f, 4.0657f, -5.00509f));
-	float z = -5.00509f;
-	while (z < 9.81967f) {
-		z += 0.1f;
-		path.push_back(glm::vec3(0.85717f, 4.0657f, z));
-	}
-
-	path.push_back(glm::vec3(0.85717f, 4.0657f, 9.81967f));
-	float x = 0.85717f;
-	while (x < 15.7986f) {
-		x += 0.1f;
-		path.push_back(glm::vec3(x, 4.0657f, 9.81967f));
+// how far from each corner the track starts to turn
+const float TOUR_CORNER_RADIUS = 1.0f;
+
+// spline control points that keep the legs between the corners straight: a Catmull-Rom segment
+// is straight when its four points are in line, so each leg gets points at one and two radii
+// from its ends and only the corners themselves are rounded off
+std::vector<glm::vec3> tourControlPoints() {
+	std::vector<glm::vec3> corners = tourCorners();
+	std::vector<glm::vec3> points;
+	points.push_back(corners.front());
+	for (size_t i = 0; i + 1 < corners.size(); i++) {
+		glm::vec3 direction = glm::normalize(corners[i + 1] - corners[i]);
+		if (i > 0) {
+			points.push_back(corners[i] + direction * TOUR_CORNER_RADIUS);
+		}
+		points.push_back(corners[i] + direction * (2.0f * TOUR_CORNER_RADIUS));
+		points.push_back(corners[i + 1] - direction * (2.0f * TOUR_CORNER_RADIUS));
+		if (i + 2 < corners.size()) {
+			points.push_back(corners[i + 1] - direction * TOUR_CORNER_RADIUS);
+		}
 	}
+	points.push_back(corners.back());
+	return points;
+}
 
-	path.push_back(glm::vec3(15.7986f, 4.0657f, 9.81967f));
-	z = 9.81967f;
-	while (z > -3.59243f) {
-		z -= 0.1f;
-		path.push_back(glm::vec3(15.7986f, 4.0657f, z));
-	}
+gps::CameraTrack tourTrack(tourControlPoints(), false);
+bool tourPlaying = false;
+float tourDistance = 0.0f;
 
-	path.push_back(glm::vec3(15.7986f, 4.0657f, -3.59243f));
-	x = 15.7986f;
-	while (x > 0.85717f) {
-		x -= 0.1f;
-		path.push_back(glm::vec3(x, 4.0657f, -3.59243f));
-	}
+void placeTourCamera(float distance) {
+	myCamera = gps::Camera(tourTrack.positionAt(distance),
+		tourTarget,
+		glm::vec3(0.0f, 1.0f, 0.0f));
+}
 
+//the tour is advanced by simulationStep, the rest of the scene keeps running meanwhile
+void startTour() {
+	tourPlaying = true;
+	tourDistance = 0.0f;
+	placeTourCamera(tourDistance);
+	//no interpolation from wherever the camera was before
+	previousAnimation.cameraPosition = myCamera.getPosition();
+}
 
-	while (path.size())	{
-		myCamera = gps::Camera(path.back(),
-			targetPos,
-			glm::vec3(0.0f, 1.0f, 0.0f));
+void advanceTour() {
+	tourDistance += TOUR_SPEED * (float)SIMULATION_STEP;
+	placeTourCamera(tourDistance);
 
-		path.pop_back();
+	if (tourDistance >= tourTrack.getLength()) {
+		tourPlaying = false;
+	}
+}
 
-		renderScene();
-		glfwPollEvents();
-		glfwSwapBuffers(myWindow.getWindow());
+void writeRainMatrices(std::vector<glm::mat4>& matrices, int begin, int end, bool windOn) {
+	//the wind tilts every drop by the same angle
+	glm::mat4 tilt = glm::mat4(1.0f);
+	if (windOn) {
+		tilt = glm::rotate(tilt, 0.1f, glm::vec3(1.0f, 0.0f, 0.0f));
+	}
 
+	for (int i = begin; i < end; i++) {
+		glm::mat4 modelRaindrop = tilt;
+		modelRaindrop[3] = glm::vec4(rainSystem.x[i], rainSystem.y[i], rainSystem.z[i], 1.0f);
+		matrices[i] = modelRaindrop;
 	}
 }
 
 void initRain() {
-	for (int i = 0; i < 3000; i++) {
-		float initialX = (rand() % 14476 + 1874) / 1000.0f;
-		float initialY = ((rand() % 18304) - 11712) / 1000.0f;
-		float initialZ = (rand() % 8081) / 1000.0f;
-		raindropsInitialPos.push_back(glm::vec3(initialX, initialZ, -initialY));
-		raindropsPos.push_back(glm::vec3(initialX, initialZ, -initialY));
-	}
+	rainSystem.init(raindropCount);
+	raindropsModel.resize(raindropCount);
+	raindropsNextModel.resize(raindropCount);
+	writeRainMatrices(raindropsNextModel, 0, raindropCount, wind);
+	rainNextReady = true;
 }
 
-void processMovement() {
-	if (pressedKeys[GLFW_KEY_W]) {
-		myCamera.move(gps::MOVE_FORWARD, cameraSpeed);
-		//update view matrix
-		view = myCamera.getViewMatrix();
-		myBasicShader.useShaderProgram();
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-		// compute normal matrix 
-		normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-	}
+AnimationState captureAnimation() {
+	AnimationState state;
+	state.cameraPosition = myCamera.getPosition();
+	state.bodyCrowY = bodyCrowY;
+	state.bodyCrowZ = bodyCrowZ;
+	state.wingLY = wingLY;
+	state.wingLZ = wingLZ;
+	state.wingRY = wingRY;
+	state.wingRZ = wingRZ;
+	state.wingAngle = wingAngle;
+	return state;
+}
 
-	if (pressedKeys[GLFW_KEY_S]) {
-		myCamera.move(gps::MOVE_BACKWARD, cameraSpeed);
-		//update view matrix
-		view = myCamera.getViewMatrix();
-		myBasicShader.useShaderProgram();
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-		// compute normal matrix 
-		normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
+AnimationState interpolateAnimation(const AnimationState& from, const AnimationState& to, float alpha) {
+	AnimationState state;
+	state.cameraPosition = glm::mix(from.cameraPosition, to.cameraPosition, alpha);
+	state.bodyCrowY = glm::mix(from.bodyCrowY, to.bodyCrowY, alpha);
+	state.bodyCrowZ = glm::mix(from.bodyCrowZ, to.bodyCrowZ, alpha);
+	state.wingLY = glm::mix(from.wingLY, to.wingLY, alpha);
+	state.wingLZ = glm::mix(from.wingLZ, to.wingLZ, alpha);
+	state.wingRY = glm::mix(from.wingRY, to.wingRY, alpha);
+	state.wingRZ = glm::mix(from.wingRZ, to.wingRZ, alpha);
+	state.wingAngle = glm::mix(from.wingAngle, to.wingAngle, alpha);
+	return state;
+}
+
+//advances the camera and the crow by one SIMULATION_STEP while their keys are held
+void simulationStep() {
+	//the tour owns the camera while it plays
+	if (tourPlaying) {
+		advanceTour();
 	}
+	else {
+		if (pressedKeys[GLFW_KEY_W]) {
+			myCamera.move(gps::MOVE_FORWARD, cameraSpeed);
+		}
 
-	if (pressedKeys[GLFW_KEY_A]) {
-		myCamera.move(gps::MOVE_LEFT, cameraSpeed);
-		//update view matrix
-		view = myCamera.getViewMatrix();
-		myBasicShader.useShaderProgram();
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-		// compute normal matrix 
-		normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
+		if (pressedKeys[GLFW_KEY_S]) {
+			myCamera.move(gps::MOVE_BACKWARD, cameraSpeed);
+		}
+
+		if (pressedKeys[GLFW_KEY_A]) {
+			myCamera.move(gps::MOVE_LEFT, cameraSpeed);
+		}
+
+		if (pressedKeys[GLFW_KEY_D]) {
+			myCamera.move(gps::MOVE_RIGHT, cameraSpeed);
+		}
 	}
 
-	if (pressedKeys[GLFW_KEY_D]) {
-		myCamera.move(gps::MOVE_RIGHT, cameraSpeed);
-		//update view matrix
-		view = myCamera.getViewMatrix();
-		myBasicShader.useShaderProgram();
-		glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-		// compute normal matrix 
-		normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
+	if (pressedKeys[GLFW_KEY_C]) {
+		bodyCrowY += 0.01f;
+		bodyCrowZ += 0.01f;
+		wingLY += 0.01f;
+		wingLZ += 0.01f;
+		wingRY += 0.01f;
+		wingRZ += 0.01f;
+
+		if (wingUp) {
+			wingAngle += 0.1f;
+		}
+		else {
+			wingAngle -= 0.1f;
+		}
+
+		if (wingAngle >= 0.8) {
+			wingUp = !wingUp;
+		}
+		
+		if (wingAngle <= -0.8) {
+			wingUp = !wingUp;
+		}
 	}
+}
 
-	if (pressedKeys[GLFW_KEY_T]) {
-		sceneAnimation();
+//per-frame toggles, held movement keys are handled by simulationStep
+void processMovement() {
+	if (pressedKeys[GLFW_KEY_T] && !tourPlaying) {
+		startTour();
 	}
 
 	if (pressedKeys[GLFW_KEY_M]) {
@@ -325,7 +562,7 @@ void processMovement() {
 			changeLight = 1;
 		}
 		myBasicShader.useShaderProgram();
-		glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "changeLight"), changeLight);
+		myBasicShader.setInt("changeLight", changeLight);
 	}
 
 	if (pressedKeys[GLFW_KEY_F]) {
@@ -336,31 +573,7 @@ void processMovement() {
 			fog = 1;
 		}
 		myBasicShader.useShaderProgram();
-		glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "fog"), fog);
-	}
-
-	if (pressedKeys[GLFW_KEY_C]) {
-		bodyCrowY += 0.01f;
-		bodyCrowZ += 0.01f;
-		wingLY += 0.01f;
-		wingLZ += 0.01f;
-		wingRY += 0.01f;
-		wingRZ += 0.01f;
-
-		if (wingUp) {
-			wingAngle += 0.1f;
-		}
-		else {
-			wingAngle -= 0.1f;
-		}
-
-		if (wingAngle >= 0.8) {
-			wingUp = !wingUp;
-		}
-		
-		if (wingAngle <= -0.8) {
-			wingUp = !wingUp;
-		}
+		myBasicShader.setInt("fog", fog);
 	}
 
 	if (pressedKeys[GLFW_KEY_Z]) {
@@ -374,11 +587,22 @@ void processMovement() {
 	if (pressedKeys[GLFW_KEY_X]) {
 		wind = !wind;
 	}
+
+	if (pressedKeys[GLFW_KEY_V]) {
+		//rebuilding the programs is too slow to repeat while the key is held
+		pressedKeys[GLFW_KEY_V] = false;
+		setShadowFilter((ShadowFilter)((shadowFilter + 1) % SHADOW_FILTER_COUNT));
+		std::cout << "Shadow filter: " << shadowFilterNames[shadowFilter] << std::endl;
+	}
+
+	if (pressedKeys[GLFW_KEY_I]) {
+		instancedRain = !instancedRain;
+	}
 }
 
 
-void initOpenGLWindow() {
-	myWindow.Create(1024, 768, "OpenGL Project Core");
+void initOpenGLWindow(gps::WindowOptions options) {
+	myWindow.Create(1024, 768, "OpenGL Project Core", options);
 }
 
 void setWindowCallbacks() {
@@ -399,23 +623,70 @@ void initOpenGLState() {
 }
 
 void initModels() {
-	sky.LoadModel("models/sky/sky.obj");
-	ground.LoadModel("models/gate+ground/ground.obj");
-	lamps.LoadModel("models/street-lamp/lamp.obj");
-	bench.LoadModel("models/bench/bench.obj");
-	bodyCrow.LoadModel("models/bodyCrow/body.obj");
-	wingL.LoadModel("models/wingL/wingL.obj");
-	wingR.LoadModel("models/wingR/wingR.obj");
-	raindrop.LoadModel("models/raindrop/raindrop.obj");
+	//parsing and image decoding run on the job system, the uploads on this thread
+	gps::ModelLoader loader(jobSystem);
+	loader.add(sky, "models/sky/sky.obj");
+	loader.add(ground, "models/gate+ground/ground.obj");
+	loader.add(lamps, "models/street-lamp/lamp.obj");
+	loader.add(bench, "models/bench/bench.obj");
+	loader.add(bodyCrow, "models/bodyCrow/body.obj");
+	loader.add(wingL, "models/wingL/wingL.obj");
+	loader.add(wingR, "models/wingR/wingR.obj");
+	loader.add(raindrop, "models/raindrop/raindrop.obj");
+	loader.loadAll();
 }
 
-void initShaders() {
+void initRainInstances() {
+	glGenBuffers(1, &rainInstanceVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, rainInstanceVBO);
+	glBufferData(GL_ARRAY_BUFFER, raindropCount * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	raindrop.setInstanceBuffer(rainInstanceVBO);
+}
+
+//the programs that sample the shadow maps, built for the current shadow filter
+void initSceneShaders() {
+	std::vector<std::string> defines;
+	if (shadowFilter == SHADOW_FILTER_HARDWARE) {
+		defines.push_back("SHADOW_FILTER_HARDWARE");
+	}
+	else if (shadowFilter == SHADOW_FILTER_POISSON) {
+		defines.push_back("SHADOW_FILTER_POISSON");
+	}
+	else if (shadowFilter == SHADOW_FILTER_PCSS) {
+		defines.push_back("SHADOW_FILTER_PCSS");
+	}
+	defines.push_back("POISSON_TAPS " + std::to_string(shadowFilterTaps));
+	if (materialAtlas.isBuilt()) {
+		defines.push_back("MATERIAL_ARRAYS");
+	}
+
 	myBasicShader.loadShader(
 		"shaders/basic.vert",
-		"shaders/basic.frag");
+		"shaders/basic.frag",
+		defines);
+	rainShader.loadShader(
+		"shaders/basicInstanced.vert",
+		"shaders/basic.frag",
+		defines);
+}
+
+void initShaders() {
+	initSceneShaders();
 	depthMapShader.loadShader(
 		"shaders/shadow.vert",
 		"shaders/shadow.frag");
+	rainDepthShader.loadShader(
+		"shaders/shadowInstanced.vert",
+		"shaders/shadow.frag");
+	pointDepthShader.loadShader(
+		"shaders/pointShadow.vert",
+		"shaders/pointShadow.geom",
+		"shaders/pointShadow.frag");
+	depthIndirectShader.loadShader(
+		"shaders/shadowIndirect.vert",
+		"shaders/shadow.frag");
 
 }
 
@@ -424,67 +695,72 @@ void initUniforms() {
 
 	// create model matrix 
 	model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-	modelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
 
 	// get view matrix for current camera
 	view = myCamera.getViewMatrix();
-	viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
 	// send view matrix to shader
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+	myBasicShader.setMat4("view", view);
 
 	// compute normal matrix 
 	normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-	normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
 
 	// create projection matrix
-	projection = glm::perspective(glm::radians(45.0f),
+	projection = glm::perspective(CAMERA_FOV,
 		(float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
-		0.1f, 500.0f);
-	projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
+		CAMERA_NEAR, CAMERA_FAR);
 	// send projection matrix to shader
-	glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+	myBasicShader.setMat4("projection", projection);
 
 	//set the light direction (direction towards the light)
 	lightDir = glm::vec3(0.0f, 7.0f, 1.0f);
-	lightDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDir");
 	// send light dir to shader
-	glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDir));
+	myBasicShader.setVec3("lightDir", lightDir);
+
+	//the lamp's bulb
+	pLightPos = glm::vec3(3.77206f, 0.789307f, 2.86863f);
 
 	//set light color
 	lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
-	lightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightColor");
 	// send light color to shader
-	glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
+	myBasicShader.setVec3("lightColor", lightColor);
 }
 
-void initFBO() {
-	glGenFramebuffers(1, &shadowMapFBO);
-
-	glGenTextures(1, &depthMapTexture);
-	glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-		SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+//depth-only framebuffer with a depth array of one resolution x resolution layer per cascade
+void initShadowTarget(GLuint& framebuffer, GLuint& texture) {
+	glGenFramebuffers(1, &framebuffer);
+
+	//sized format, the static and the per-frame array must match for glBlitFramebuffer
+	int resolution = shadowCascades.getResolution();
+	glGenTextures(1, &texture);
+	//array textures are not tracked by the state cache, only the unit is
+	gps::GLStateCache::activeTexture(0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24,
+		resolution, resolution, shadowCascades.getCascadeCount(), 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-	glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMapTexture,
-		0);
+	glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, 0);
 
 	glDrawBuffer(GL_NONE);
 	glReadBuffer(GL_NONE);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+//depth cubemap around the lamp, all six faces are drawn in one layered pass
 void initCubeMap() {
+	glGenFramebuffers(1, &depthMapFBO);
 	glGenTextures(1, &depthCubemap);
+	//cubemaps are not tracked by the state cache, only the unit is
+	gps::GLStateCache::activeTexture(0);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap);
 	for (unsigned int i = 0; i < 6; ++i)
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT,
-			SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT24,
+			pointShadowResolution, pointShadowResolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -495,257 +771,486 @@ void initCubeMap() {
 	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthCubemap, 0);
 	glDrawBuffer(GL_NONE);
 	glReadBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "Point light shadow framebuffer is incomplete" << std::endl;
+	}
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void renderGround(gps::Shader shader, bool depthPass) {
-	// select active shader program
-	shader.useShaderProgram();
+//hardware comparison for the filters that take compare samples, raw depth for the others
+void initShadowSampling() {
+	bool compare = shadowFilter == SHADOW_FILTER_HARDWARE || shadowFilter == SHADOW_FILTER_POISSON;
+	GLint filter = compare ? GL_LINEAR : GL_NEAREST;
+
+	gps::GLStateCache::activeTexture(0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, depthMapTexture);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, compare ? GL_COMPARE_REF_TO_TEXTURE : GL_NONE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, filter);
+}
 
-	//send teapot model matrix data to shader
-	glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+//rebuilds the scene programs for the current filter and material atlas and restores their uniforms
+void rebuildSceneShaders() {
+	gps::GLStateCache::forgetProgram(myBasicShader.shaderProgram);
+	gps::GLStateCache::forgetProgram(rainShader.shaderProgram);
+	glDeleteProgram(myBasicShader.shaderProgram);
+	glDeleteProgram(rainShader.shaderProgram);
+	initSceneShaders();
+	initUniforms();
+	myBasicShader.setInt("changeLight", changeLight);
+	myBasicShader.setInt("fog", fog);
+	if (materialAtlas.isBuilt()) {
+		myBasicShader.useShaderProgram();
+		materialAtlas.setUniforms(myBasicShader, MATERIAL_ARRAY_UNIT);
+		rainShader.useShaderProgram();
+		materialAtlas.setUniforms(rainShader, MATERIAL_ARRAY_UNIT);
+	}
 
-	if (depthPass == false) {
-		//send teapot normal matrix data to shader
-		glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+	initShadowSampling();
+}
+
+void setShadowFilter(ShadowFilter filter) {
+	shadowFilter = filter;
+	rebuildSceneShaders();
+}
+
+//moves every mesh onto the material arrays once the streamed textures hold their images
+void updateMaterialAtlas() {
+	if (!useMaterialAtlas || materialAtlas.isBuilt() || textureStreamer.getPendingCount() > 0) {
+		return;
+	}
+
+	std::vector<gps::Model3D*> models = { &sky, &ground, &lamps, &bench, &bodyCrow, &wingL, &wingR, &raindrop };
+	if (!materialAtlas.build(models)) {
+		//too many materials, stay on the per-mesh textures
+		useMaterialAtlas = false;
+		return;
+	}
+	rebuildSceneShaders();
+}
+
+void initFBO() {
+	initShadowTarget(shadowMapFBO, depthMapTexture);
+	initShadowTarget(staticShadowFBO, staticDepthMapTexture);
+	initShadowSampling();
+	initCubeMap();
+}
+
+//draws the meshes of object inside the current pass frustum, or all of them outside a culled pass
+void drawModel(SceneObject id, gps::Model3D& object, gps::Shader& shader, const glm::mat4& modelMatrix) {
+	if (frustumCulling && passFrustum) {
+		//the scene tree already rejected it, only its meshes are left to count
+		if (!passVisible[id]) {
+			passCulling->meshes.culled += (GLuint)object.meshes.size();
+			return;
+		}
+		object.Draw(shader, *passFrustum, modelMatrix, passCulling->meshes);
+	}
+	else {
+		object.Draw(shader);
+	}
+}
+
+//model matrices of the objects placed in the scene, shared by the colour and the shadow passes
+glm::mat4 computeBenchModel() {
+	return glm::translate(glm::mat4(1.0f), glm::vec3(4.31311f, -0.000201f, 1.25905f));
+}
+
+glm::mat4 computeLampModel() {
+	return glm::translate(glm::mat4(1.0f), glm::vec3(3.7833f, -0.019674f, 3.02676f));
+}
+
+glm::mat4 computeBodyCrowModel() {
+	return glm::translate(glm::mat4(1.0f), glm::vec3(5.9248f, drawnAnimation.bodyCrowY, drawnAnimation.bodyCrowZ));
+}
+
+glm::mat4 computeWingLModel() {
+	glm::mat4 modelWingL = glm::translate(glm::mat4(1.0f), glm::vec3(5.94813f, drawnAnimation.wingLY, drawnAnimation.wingLZ));
+	return glm::rotate(modelWingL, drawnAnimation.wingAngle, glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+glm::mat4 computeWingRModel() {
+	glm::mat4 modelWingR = glm::translate(glm::mat4(1.0f), glm::vec3(5.89672f, drawnAnimation.wingRY, drawnAnimation.wingRZ));
+	return glm::rotate(modelWingR, -drawnAnimation.wingAngle, glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+gps::Model3D& sceneObjectModel(SceneObject object) {
+	switch (object) {
+	case SCENE_GROUND: return ground;
+	case SCENE_SKY: return sky;
+	case SCENE_LAMP: return lamps;
+	case SCENE_BENCH: return bench;
+	case SCENE_BODY_CROW: return bodyCrow;
+	case SCENE_WING_L: return wingL;
+	default: return wingR;
+	}
+}
+
+glm::mat4 sceneObjectMatrix(SceneObject object) {
+	switch (object) {
+	case SCENE_LAMP: return computeLampModel();
+	case SCENE_BENCH: return computeBenchModel();
+	case SCENE_BODY_CROW: return computeBodyCrowModel();
+	case SCENE_WING_L: return computeWingLModel();
+	case SCENE_WING_R: return computeWingRModel();
+	default: return model;
+	}
+}
+
+//moves the scene tree to this frame's object positions, the first call builds it
+void updateSceneTree() {
+	for (int object = 0; object < SCENE_OBJECT_COUNT; object++) {
+		SceneObject id = (SceneObject)object;
+		sceneObjectModel(id).getBounds().worldBox(sceneObjectMatrix(id), sceneBoxes[object].min, sceneBoxes[object].max);
+	}
+	//most objects only sway around their places, but the crow flies off while C is held;
+	//once its path has stretched the nodes above it the tree is rebuilt around the new positions
+	sceneTree.update(sceneBoxes);
+}
+
+//marks the objects touching the frustum, drawModel skips the rest
+void cullSceneObjects(const gps::Frustum& frustum) {
+	std::fill(passVisible, passVisible + SCENE_OBJECT_COUNT, false);
+	sceneTree.queryFrustum(frustum, [](uint32_t object) {
+		passVisible[object] = true;
+	});
+}
+
+//calls draw(mesh) for each mesh of object that survives the current pass's culling, and counts them
+template <class MeshVisitor>
+void forVisibleMeshes(SceneObject id, const glm::mat4& modelMatrix, MeshVisitor draw) {
+	gps::Model3D& object = sceneObjectModel(id);
+	bool culling = frustumCulling && passFrustum;
+	if (culling && !passVisible[id]) {
+		passCulling->meshes.culled += (GLuint)object.meshes.size();
+		return;
+	}
+
+	for (size_t i = 0; i < object.meshes.size(); i++) {
+		if (culling) {
+			if (object.meshes.size() > 1 && !passFrustum->intersects(object.meshes[i].getBounds(), modelMatrix)) {
+				passCulling->meshes.culled++;
+				continue;
+			}
+			passCulling->meshes.visible++;
+		}
+		draw(object.meshes[i]);
 	}
+}
+
+//queues the meshes of object that survive culling, keyed by their distance in front of the camera
+void queueModel(gps::RenderQueue& queue, gps::RenderLayer layer, SceneObject id, gps::Shader& shader) {
+	glm::mat4 modelMatrix = sceneObjectMatrix(id);
+	glm::mat4 modelView = view * modelMatrix;
+	uint32_t transform = queue.addTransform(modelMatrix);
+	forVisibleMeshes(id, modelMatrix, [&](gps::Mesh& mesh) {
+		float depth = -(modelView * glm::vec4(mesh.getBounds().center, 1.0f)).z;
+		queue.push(layer, shader, mesh, transform, depth);
+	});
+}
 
-	ground.Draw(shader);
+//adds the meshes of object that survive culling to an indirect batch
+void batchModel(gps::IndirectBatch& batch, SceneObject id) {
+	glm::mat4 modelMatrix = sceneObjectMatrix(id);
+	uint32_t transform = batch.addTransform(modelMatrix);
+	forVisibleMeshes(id, modelMatrix, [&](gps::Mesh& mesh) {
+		batch.add(mesh, transform);
+	});
 }
 
-void renderSky(gps::Shader shader) {
+//draws the scene objects into the bound depth target with one multi draw per index type
+void renderShadowCastersIndirect(const SceneObject* objects, int count) {
+	shadowBatch.clear();
+	for (int i = 0; i < count; i++) {
+		batchModel(shadowBatch, objects[i]);
+	}
+	depthIndirectShader.useShaderProgram();
+	shadowBatch.submit(depthIndirectShader, DRAW_TRANSFORM_UNIT);
+}
+
+void renderGround(gps::Shader& shader, bool depthPass) {
+	gps::ProfileScope scope(profiler, "renderGround");
 	// select active shader program
 	shader.useShaderProgram();
 
 	//send teapot model matrix data to shader
-	glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+	shader.setMat4("model", model);
 
-	//send teapot normal matrix data to shader
-	glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+	if (depthPass == false) {
+		//send teapot normal matrix data to shader
+		shader.setMat3("normalMatrix", normalMatrix);
+	}
 
-	sky.Draw(shader);
+	drawModel(SCENE_GROUND, ground, shader, model);
 }
 
-void renderBench(gps::Shader shader, bool depthPass) {
+void renderBench(gps::Shader& shader, bool depthPass) {
+	gps::ProfileScope scope(profiler, "renderBench");
 	// select active shader program
 	shader.useShaderProgram();
 
 	//position
-	glm::mat4 modelBench = glm::mat4(1.0f);
-	modelBench = glm::translate(modelBench, glm::vec3(4.31311f, -0.000201f, 1.25905f));
+	glm::mat4 modelBench = computeBenchModel();
 
 	//send teapot model matrix data to shader
-	glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(modelBench));
+	shader.setMat4("model", modelBench);
 
 	if (!depthPass) {
 		//send teapot normal matrix data to shader
-		glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+		shader.setMat3("normalMatrix", normalMatrix);
 	}
 
-	bench.Draw(shader);
+	drawModel(SCENE_BENCH, bench, shader, modelBench);
 }
 
-void renderLamp(gps::Shader shader, bool depthPass) {
+void renderLamp(gps::Shader& shader, bool depthPass) {
+	gps::ProfileScope scope(profiler, "renderLamp");
 	// select active shader program
 	shader.useShaderProgram();
 
 	//position
-	glm::mat4 modelLamp = glm::mat4(1.0f);
-	modelLamp = glm::translate(modelLamp, glm::vec3(3.7833f, -0.019674f, 3.02676f));
+	glm::mat4 modelLamp = computeLampModel();
 
 	//send teapot model matrix data to shader
-	glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(modelLamp));
+	shader.setMat4("model", modelLamp);
 
 	if (!depthPass) {
 		//send teapot normal matrix data to shader
-		glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+		shader.setMat3("normalMatrix", normalMatrix);
 	}
 
-	lamps.Draw(shader);
+	drawModel(SCENE_LAMP, lamps, shader, modelLamp);
 }
 
-void renderBodyCrow(gps::Shader shader, bool depthPass) {
+void renderBodyCrow(gps::Shader& shader, bool depthPass) {
+	gps::ProfileScope scope(profiler, "renderBodyCrow");
 	// select active shader program
 	shader.useShaderProgram();
 
 	//position
-	glm::mat4 modelBodyCrow = glm::mat4(1.0f);
-	modelBodyCrow = glm::translate(modelBodyCrow, glm::vec3(5.9248f, bodyCrowY, bodyCrowZ));
-
-
+	glm::mat4 modelBodyCrow = computeBodyCrowModel();
 
 	//send teapot model matrix data to shader
-	glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(modelBodyCrow));
+	shader.setMat4("model", modelBodyCrow);
 
 	if (!depthPass) {
 		//send teapot normal matrix data to shader
-		glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+		shader.setMat3("normalMatrix", normalMatrix);
 	}
 
-	bodyCrow.Draw(shader);
+	drawModel(SCENE_BODY_CROW, bodyCrow, shader, modelBodyCrow);
 }
 
-void renderWingL(gps::Shader shader, bool depthPass) {
+void renderWingL(gps::Shader& shader, bool depthPass) {
+	gps::ProfileScope scope(profiler, "renderWingL");
 	// select active shader program
 	shader.useShaderProgram();
 
 	//position
-	glm::mat4 modelWingL = glm::mat4(1.0f);
-
-	modelWingL = glm::translate(modelWingL, glm::vec3(5.94813f, wingLY, wingLZ));
-	modelWingL = glm::rotate(modelWingL, wingAngle, glm::vec3(0.0f, 0.0f, 1.0f));
-
-	//modelWingL = glm::translate(modelWingL, glm::vec3(-5.94813f, -wingLY, -wingLZ));
-	//modelWingL = glm::translate(modelWingL, glm::vec3(5.94813f, wingLY, wingLZ));
+	glm::mat4 modelWingL = computeWingLModel();
 
 	//send teapot model matrix data to shader
-	glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(modelWingL));
+	shader.setMat4("model", modelWingL);
 
 	if (!depthPass) {
 		//send teapot normal matrix data to shader
-		glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+		shader.setMat3("normalMatrix", normalMatrix);
 	}
 
-	wingL.Draw(shader);
+	drawModel(SCENE_WING_L, wingL, shader, modelWingL);
 }
 
-void renderWingR(gps::Shader shader, bool depthPass) {
+void renderWingR(gps::Shader& shader, bool depthPass) {
+	gps::ProfileScope scope(profiler, "renderWingR");
 	// select active shader program
 	shader.useShaderProgram();
 
 	//position
-	glm::mat4 modelWingR = glm::mat4(1.0f);
-
-	modelWingR = glm::translate(modelWingR, glm::vec3(5.89672f, wingRY, wingRZ));
-	modelWingR = glm::rotate(modelWingR, -wingAngle, glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::mat4 modelWingR = computeWingRModel();
 
 	//send teapot model matrix data to shader
-	glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(modelWingR));
+	shader.setMat4("model", modelWingR);
 
 	if (!depthPass) {
 		//send teapot normal matrix data to shader
-		glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+		shader.setMat3("normalMatrix", normalMatrix);
 	}
 
-	wingR.Draw(shader);
+	drawModel(SCENE_WING_R, wingR, shader, modelWingR);
 }
 
-bool checkCollision(glm::vec3 raindropPos) {
-	bool collisionRoofR = false;
-	bool collisionRoofL = false;
-	bool collisionWallR = false;
-	bool collisionWallL = false;
-
-	glm::vec3 A = glm::vec3(8.45154f, 3.58871f, 2.47549f);  //top-front vertex of roof
-	glm::vec3 B = glm::vec3(12.8966f, 3.62955f, 2.55956f);  //top-back vertex of roof
-	glm::vec3 C = glm::vec3(8.40777f, 1.63252f, 3.92667f);  //top-front vertex of right wall
-	glm::vec3 D = glm::vec3(12.8452f, 1.63252f, 4.00412f);  //top-back vertex of right wall
-	glm::vec3 E = glm::vec3(8.47413f, 1.63252f, 1.04179f);  //top-front vertex of left wall
-	glm::vec3 F = glm::vec3(12.9299f, 1.59839f, 1.10053f);  //top-back vertex of left wall
-	glm::vec3 G = glm::vec3(8.45149f, 0.007231f, 3.904f);   //bottom-front vertex of right wall
-	glm::vec3 H = glm::vec3(12.8534f, 0.007231f, 3.99226f); //bottom-back vertex of right wall
-	glm::vec3 I = glm::vec3(8.46879f, 0.007231f, 1.07433f); //bottom-front vertex of left-wall
-	glm::vec3 J = glm::vec3(12.9299f, 0.007231f, 1.11824f); //bottom-back vertex of left-wall
+void uploadRainInstances(const glm::mat4* matrices, int count) {
+	//orphan the old storage so the driver does not wait for the previous frame
+	glBindBuffer(GL_ARRAY_BUFFER, rainInstanceVBO);
+	glBufferData(GL_ARRAY_BUFFER, raindropCount * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(glm::mat4), matrices);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-	
-	glm::vec3 normalRoofR = glm::cross(A - C, D - C);
+bool isRaindropVisible(const glm::mat4& modelRaindrop) {
+	//drops are only moved and tilted, the sphere keeps its radius
+	const gps::Bounds& bounds = raindrop.getBounds();
+	glm::vec3 center = glm::vec3(modelRaindrop * glm::vec4(bounds.center, 1.0f));
+	return passFrustum->intersectsSphere(center, bounds.radius);
+}
 
-	if (raindropPos.x > 8.40777f and raindropPos.x < 12.8966f and
-		raindropPos.y > 1.63252f and raindropPos.y < 3.62955f and
-		raindropPos.z > 2.47549f and raindropPos.z < 4.00412f and
-		glm::dot(normalRoofR, (raindropPos - A)) < 0) {
-		collisionRoofR = true;
+//compacts the drops inside the pass frustum into the instance buffer, returns how many there are
+GLsizei uploadVisibleRain() {
+	rainVisibleModels.clear();
+	for (int i = 0; i < raindropCount; i++) {
+		if (isRaindropVisible(raindropsModel[i])) {
+			rainVisibleModels.push_back(raindropsModel[i]);
+		}
 	}
 
-	glm::vec3 normalRoofL = glm::cross(A - E, F - E);
+	GLsizei visibleCount = (GLsizei)rainVisibleModels.size();
+	passCulling->raindrops.visible += visibleCount;
+	passCulling->raindrops.culled += raindropCount - visibleCount;
 
-	if (raindropPos.x > 8.45154f and raindropPos.x < 12.9299f and
-		raindropPos.y > 1.59839f and raindropPos.y < 3.62955f and
-		raindropPos.z > 1.04179f and raindropPos.z < 2.55956f and
-		glm::dot(normalRoofL, (raindropPos - A)) < 0) {
-		collisionRoofL = true;
-	}
-
-	glm::vec3 normalWallR = glm::cross(C - G, H - G);
+	uploadRainInstances(rainVisibleModels.data(), visibleCount);
+	rainInstancesStale = true;
+	return visibleCount;
+}
 
-	if (raindropPos.x > 8.40777f and raindropPos.x < 12.8534f and
-		raindropPos.y > 0.007231f and raindropPos.y < 1.63252f and
-		raindropPos.z > 3.904f and raindropPos.z < 4.00412f and
-		glm::dot(normalWallR, (raindropPos - C)) < 0) {
-		collisionWallR = true;
+void updateRain() {
+	gps::ProfileScope scope(profiler, "updateRain");
+	//the matrices simulated during the previous frame become the ones drawn now
+	if (rainNextReady) {
+		raindropsModel.swap(raindropsNextModel);
+		rainNextReady = false;
+		rainInstancesStale = true;
 	}
 
-	glm::vec3 normalWallL = glm::cross(E - I, J - I);
+	//with culling every pass uploads its own visible drops instead
+	if (instancedRain && rainInstancesStale && !frustumCulling) {
+		rainInstancesStale = false;
+		uploadRainInstances(raindropsModel.data(), raindropCount);
+	}
+}
 
-	if (raindropPos.x > 8.46879f and raindropPos.x < 12.9299f and
-		raindropPos.y > 0.007231f and raindropPos.y < 1.63252f and
-		raindropPos.z > 1.04179f and raindropPos.z < 1.11824f and
-		glm::dot(normalWallL, (raindropPos - E)) < 0) {
-		collisionWallL = true;
+//simulates the steps taken this frame, with none the drawn drops stay where they are
+void kickRainUpdate(int steps) {
+	if (steps <= 0) {
+		return;
 	}
 
-	return (collisionRoofR or collisionRoofL or collisionWallR or collisionRoofL);
+	bool windOn = wind;
+	jobSystem.parallelFor(raindropCount, RAIN_CHUNK_SIZE, [windOn, steps](int begin, int end) {
+		for (int step = 0; step < steps; step++) {
+			rainSystem.update(begin, end, windOn);
+		}
+		writeRainMatrices(raindropsNextModel, begin, end, windOn);
+	}, &rainCounter);
+	rainNextReady = true;
+}
+
+void joinRainUpdate() {
+	//time spent waiting for the simulation jobs, zero when they finish behind the passes
+	gps::ProfileScope scope(profiler, "joinRainUpdate");
+	jobSystem.wait(&rainCounter);
 }
 
-void renderRain(gps::Shader shader, bool depthPass) {
-	for (int i = 0; i < 3000; i++) {
-		// select active shader program
-		shader.useShaderProgram();
+void renderRainInstanced(bool depthPass) {
+	GLsizei instanceCount = raindropCount;
+	if (frustumCulling && passFrustum) {
+		instanceCount = uploadVisibleRain();
+	}
 
-		//position
-		glm::mat4 modelRaindrop = glm::mat4(1.0f);
-		glm::vec3 raindropPos = raindropsPos.at(i);
+	if (depthPass) {
+		rainDepthShader.useShaderProgram();
+		rainDepthShader.setMat4("lightSpaceTrMatrix", shadowPassMatrix);
 
-		modelRaindrop = glm::translate(modelRaindrop, raindropPos);
+		raindrop.DrawInstanced(rainDepthShader, instanceCount);
+	}
+	else {
+		//the instanced program has its own copy of the scene uniforms
+		rainShader.useShaderProgram();
+		rainShader.setMat4("model", glm::mat4(1.0f));
+		rainShader.setMat4("view", view);
+		rainShader.setMat4("projection", projection);
+		rainShader.setMat3("normalMatrix", normalMatrix);
+		setShadowUniforms(rainShader);
+		rainShader.setVec3("lightDir", lightDir);
+		rainShader.setVec3("lightColor", lightColor);
+		rainShader.setVec3("pLightPosition", pLightPos);
+		rainShader.setInt("changeLight", changeLight);
+		rainShader.setInt("fog", fog);
+
+		raindrop.DrawInstanced(rainShader, instanceCount);
+	}
+}
 
-		raindropsPos.at(i).y -= 0.05;
+void renderRain(gps::Shader& shader, bool depthPass) {
+	gps::ProfileScope scope(profiler, "renderRain");
+	if (instancedRain) {
+		renderRainInstanced(depthPass);
+		return;
+	}
 
-		if (wind) {
-			modelRaindrop = glm::rotate(modelRaindrop, 0.1f, glm::vec3(1.0f, 0.0f, 0.0f));
-			raindropsPos.at(i).z -= 0.02;
+	bool culling = frustumCulling && passFrustum;
+	for (int i = 0; i < raindropCount; i++) {
+		if (culling) {
+			if (!isRaindropVisible(raindropsModel[i])) {
+				passCulling->raindrops.culled++;
+				continue;
+			}
+			passCulling->raindrops.visible++;
 		}
 
-		if (raindropsPos.at(i).y < 0.0f or checkCollision(raindropsPos.at(i)) == true) {
-			raindropsPos.at(i) = raindropsInitialPos.at(i);
-			raindropsPos.at(i).y = 8.081f;
-		}
+		// select active shader program
+		shader.useShaderProgram();
 
 		//send teapot model matrix data to shader
-		glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(modelRaindrop));
+		shader.setMat4("model", raindropsModel.at(i));
 
 		if (!depthPass) {
 			//send teapot normal matrix data to shader
-			glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+			shader.setMat3("normalMatrix", normalMatrix);
 		}
 
 		raindrop.Draw(shader);
 	}
-
-	
 }
 
 
-glm::mat4 computeLightSpaceTrMatrix() {
-	glm::mat4 lightView = glm::lookAt(lightDir, glm::vec3(12.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-	const GLfloat near_plane = 5.0f, far_plane = 20.0f;
-	glm::mat4 lightProjection = glm::ortho(-7.0f, 7.0f, -7.0f, 7.0f, near_plane, far_plane);
-	glm::mat4 lightSpaceTrMatrix = lightProjection * lightView;
-	
-	return lightSpaceTrMatrix;
+//refits the cascades around the camera the frame is drawn from
+void updateShadowCascades(const glm::mat4& cameraView) {
+	//the light shines from lightDir towards the middle of the scene
+	glm::vec3 shadowDirection = glm::vec3(12.0f, 0.0f, 0.0f) - lightDir;
+	float aspect = (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height;
+	shadowCascades.update(cameraView, CAMERA_FOV, aspect, CAMERA_NEAR, SHADOW_DISTANCE, shadowDirection);
 }
 
-void renderScene() {
-
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+//shadow maps of both lights, bound to units 3 and 4 by the colour pass
+void setShadowUniforms(gps::Shader& shader) {
+	shader.setInt("shadowMap", 3);
+	shader.setInt("pointShadowMap", 4);
+	shader.setFloat("pointShadowFar", POINT_SHADOW_FAR);
+
+	int cascadeCount = shadowCascades.getCascadeCount();
+	shader.setMat4Array("cascadeMatrices", shadowCascades.getMatrices(), cascadeCount);
+	shader.setFloatArray("cascadeSplits", shadowCascades.getSplitDepths(), cascadeCount);
+	shader.setFloatArray("cascadeBias", shadowCascades.getDepthBiases(), cascadeCount);
+	shader.setFloatArray("cascadeDepthToUV", shadowCascades.getDepthToUVScales(), cascadeCount);
+	shader.setInt("cascadeCount", cascadeCount);
+}
 
-	depthMapShader.useShaderProgram();
-	glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix"),
-		1,
-		GL_FALSE,
-		glm::value_ptr(computeLightSpaceTrMatrix()));
-	glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+//points both shadow framebuffers at one layer of their depth arrays
+void attachShadowLayer(int cascade) {
+	glBindFramebuffer(GL_FRAMEBUFFER, staticShadowFBO);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticDepthMapTexture, 0, cascade);
 	glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-	glClear(GL_DEPTH_BUFFER_BIT);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthMapTexture, 0, cascade);
+}
+
+//casters that never move, with the shadow cache they are drawn only when the light changes
+void renderStaticShadowCasters() {
+	if (indirectShadows) {
+		static const SceneObject staticCasters[] = { SCENE_GROUND, SCENE_LAMP, SCENE_BENCH };
+		renderShadowCastersIndirect(staticCasters, 3);
+		return;
+	}
 
 	//render the ground
 	renderGround(depthMapShader, true);
@@ -753,77 +1258,882 @@ void renderScene() {
 	renderLamp(depthMapShader, true);
 	//render the bench
 	renderBench(depthMapShader, true);
-	//render the body of the crow
-	renderBodyCrow(depthMapShader, true);
-	//render the wings
-	renderWingL(depthMapShader, true);
-	renderWingR(depthMapShader, true);
+}
+
+void renderDynamicShadowCasters() {
+	if (indirectShadows) {
+		static const SceneObject dynamicCasters[] = { SCENE_BODY_CROW, SCENE_WING_L, SCENE_WING_R };
+		renderShadowCastersIndirect(dynamicCasters, 3);
+	}
+	else {
+		//render the body of the crow
+		renderBodyCrow(depthMapShader, true);
+		//render the wings
+		renderWingL(depthMapShader, true);
+		renderWingR(depthMapShader, true);
+	}
 	//render rain
 	if (rain) {
 		renderRain(depthMapShader, true);
 	}
+}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	
+//bit per cube face whose frustum the sphere reaches, 0 when it is out of the lamp's range
+unsigned int pointShadowFaceMask(const glm::vec3& center, float radius) {
+	glm::vec3 toCaster = center - pLightPos;
+	if (glm::length(toCaster) - radius > POINT_SHADOW_FAR) {
+		return 0;
+	}
+
+	const float halfSqrt2 = 0.70710678f;
+	unsigned int mask = 0;
+	for (int face = 0; face < 6; face++) {
+		int axis = face / 2;
+		float along = face % 2 == 0 ? toCaster[axis] : -toCaster[axis];
+
+		//the four side planes of the 90 degree face frustum
+		bool inside = true;
+		for (int other = 0; other < 3 && inside; other++) {
+			if (other != axis) {
+				inside = (along - toCaster[other]) * halfSqrt2 >= -radius && (along + toCaster[other]) * halfSqrt2 >= -radius;
+			}
+		}
+		if (inside) {
+			mask |= 1u << face;
+		}
+	}
+	return mask;
+}
+
+void renderPointShadowCaster(gps::Model3D& object, const glm::mat4& modelMatrix) {
+	//world bounding sphere, the scene's model matrices do not scale
+	const gps::Bounds& bounds = object.getBounds();
+	glm::vec3 center = glm::vec3(modelMatrix * glm::vec4(bounds.center, 1.0f));
+
+	unsigned int faceMask = pointShadowFaceMask(center, bounds.radius);
+	if (faceMask == 0) {
+		return;
+	}
+	for (int face = 0; face < 6; face++) {
+		if (faceMask & (1u << face)) {
+			pointShadowFaces++;
+		}
+	}
+
+	pointDepthShader.setInt("faceMask", (GLint)faceMask);
+	pointDepthShader.setMat4("model", modelMatrix);
+	object.Draw(pointDepthShader);
+}
+
+//draws the casters around the lamp into all faces of the cubemap at once
+void renderPointShadowPass() {
+	gps::ProfileScope scope(profiler, "pointShadowPass");
+
+	//face order and up vectors of GL_TEXTURE_CUBE_MAP_POSITIVE_X onwards
+	static const glm::vec3 faceDirections[6] = {
+		glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+		glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+		glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f) };
+	static const glm::vec3 faceUps[6] = {
+		glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+		glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+		glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) };
+
+	glm::mat4 faceProjection = glm::perspective(glm::radians(90.0f), 1.0f, POINT_SHADOW_NEAR, POINT_SHADOW_FAR);
+	glm::mat4 faceMatrices[6];
+	for (int face = 0; face < 6; face++) {
+		faceMatrices[face] = faceProjection * glm::lookAt(pLightPos, pLightPos + faceDirections[face], faceUps[face]);
+	}
+
+	pointDepthShader.useShaderProgram();
+	pointDepthShader.setMat4Array("faceMatrices", faceMatrices, 6);
+	pointDepthShader.setVec3("lightPosition", pLightPos);
+	pointDepthShader.setFloat("farPlane", POINT_SHADOW_FAR);
+
+	glViewport(0, 0, pointShadowResolution, pointShadowResolution);
+	glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	//only objects within the lamp's range can cast into the cubemap
+	glm::vec3 range(POINT_SHADOW_FAR);
+	sceneTree.queryBox(pLightPos - range, pLightPos + range, [](uint32_t object) {
+		//the lamp is left out, it encloses the bulb and would shadow the whole scene
+		if (object != SCENE_LAMP && object != SCENE_SKY) {
+			SceneObject id = (SceneObject)object;
+			renderPointShadowCaster(sceneObjectModel(id), sceneObjectMatrix(id));
+		}
+	});
+
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+}
+
+void renderScene() {
+
+	drawnAnimation = interpolateAnimation(previousAnimation, captureAnimation(), animationAlpha);
+	colorCulling = PassCulling();
+	shadowCulling = PassCulling();
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	//upload this frame's drops and start simulating the next frame while the passes are submitted
+	if (rain) {
+		updateRain();
+		kickRainUpdate(simulationSteps);
+	}
+
+	//the camera is drawn between its last two simulated positions
+	gps::Camera drawnCamera = myCamera;
+	drawnCamera.setPosition(drawnAnimation.cameraPosition);
+	view = drawnCamera.getViewMatrix();
+	updateSceneTree();
+	updateMaterialAtlas();
+
+	profiler.beginScope("shadowPass");
+	//only the active light casts shadows
+	if (changeLight == 1) {
+		updateShadowCascades(view);
+		int shadowResolution = shadowCascades.getResolution();
+		glViewport(0, 0, shadowResolution, shadowResolution);
+
+		if (staticShadowDirty || model != staticShadowModel) {
+			staticShadowDirty = false;
+			staticShadowModel = model;
+			//an identity light matrix never matches a fitted cascade, so every layer is redrawn
+			for (int cascade = 0; cascade < gps::ShadowCascades::MAX_CASCADES; cascade++) {
+				staticShadowLightMatrix[cascade] = glm::mat4(1.0f);
+			}
+		}
+
+		static const char* const cascadeScopes[gps::ShadowCascades::MAX_CASCADES] = { "cascade0", "cascade1", "cascade2", "cascade3" };
+		for (int cascade = 0; cascade < shadowCascades.getCascadeCount(); cascade++) {
+			gps::ProfileScope cascadeScope(profiler, cascadeScopes[cascade]);
+			shadowPassMatrix = shadowCascades.getMatrix(cascade);
+			depthMapShader.useShaderProgram();
+			depthMapShader.setMat4("lightSpaceTrMatrix", shadowPassMatrix);
+			depthIndirectShader.useShaderProgram();
+			depthIndirectShader.setMat4("lightSpaceTrMatrix", shadowPassMatrix);
+			attachShadowLayer(cascade);
+			gps::Frustum cascadeFrustum(shadowPassMatrix);
+			passFrustum = &cascadeFrustum;
+			passCulling = &shadowCulling;
+			cullSceneObjects(cascadeFrustum);
+
+			//cascades follow the camera, a layer that moved this frame is drawn without the cache
+			bool cached = shadowCache && shadowPassMatrix == staticShadowLightMatrix[cascade];
+			bool stable = shadowPassMatrix == previousShadowLightMatrix[cascade];
+			previousShadowLightMatrix[cascade] = shadowPassMatrix;
+
+			if (cached || (shadowCache && stable)) {
+				if (cached) {
+					shadowCacheCounts[cascade].hits++;
+				}
+				else {
+					gps::ProfileScope scope(profiler, "staticCasters");
+					glBindFramebuffer(GL_FRAMEBUFFER, staticShadowFBO);
+					glClear(GL_DEPTH_BUFFER_BIT);
+					renderStaticShadowCasters();
+					staticShadowLightMatrix[cascade] = shadowPassMatrix;
+					shadowCacheCounts[cascade].refills++;
+				}
+
+				//start from the static depth instead of clearing
+				gps::ProfileScope scope(profiler, "shadowCopy");
+				glBindFramebuffer(GL_READ_FRAMEBUFFER, staticShadowFBO);
+				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowMapFBO);
+				glBlitFramebuffer(0, 0, shadowResolution, shadowResolution, 0, 0, shadowResolution, shadowResolution,
+					GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+				glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+			}
+			else {
+				glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+				glClear(GL_DEPTH_BUFFER_BIT);
+				renderStaticShadowCasters();
+				shadowCacheCounts[cascade].direct++;
+			}
+
+			renderDynamicShadowCasters();
+		}
+		passFrustum = NULL;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+	profiler.endScope();
+
+	if (changeLight == 0) {
+		renderPointShadowPass();
+	}
 
 	//render with shadow mapping
+	profiler.beginScope("colorPass");
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	myBasicShader.useShaderProgram();
 
-	glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceTrMatrix"),
-		1,
-		GL_FALSE,
-		glm::value_ptr(computeLightSpaceTrMatrix()));
+	setShadowUniforms(myBasicShader);
 
-	view = myCamera.getViewMatrix();
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+	myBasicShader.setMat4("view", view);
+	normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
 
-	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-	glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "shadowMap"), 3);
+	gps::GLStateCache::activeTexture(3);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, depthMapTexture);
+	gps::GLStateCache::activeTexture(4);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap);
+	materialAtlas.bind(MATERIAL_ARRAY_UNIT);
 
 	glViewport(0, 0, (float)myWindow.getWindowDimensions().width, (float)myWindow.getWindowDimensions().height);
 	myBasicShader.useShaderProgram();
 
-	//render the scene
-	//render the ground
-	renderGround(myBasicShader, false);
-	//render the sky
-	renderSky(myBasicShader);
-	//render the lamp
-	renderLamp(myBasicShader, false);
-	//render the bench
-	renderBench(myBasicShader, false);
-	//render the body of the crow
-	renderBodyCrow(myBasicShader, false);
-	//render the wings
-	renderWingL(myBasicShader, false);
-	renderWingR(myBasicShader, false);
-	//render rain
+	gps::Frustum cameraFrustum(projection * view);
+	passFrustum = &cameraFrustum;
+	passCulling = &colorCulling;
+	cullSceneObjects(cameraFrustum);
+
+	//every object shares the normal matrix, only "model" changes between draws
+	myBasicShader.setMat3("normalMatrix", normalMatrix);
+
+	//collect the visible meshes, then draw them in key order
+	profiler.beginScope("buildQueue");
+	colorQueue.clear();
+	queueModel(colorQueue, gps::RENDER_LAYER_OPAQUE, SCENE_GROUND, myBasicShader);
+	queueModel(colorQueue, gps::RENDER_LAYER_OPAQUE, SCENE_LAMP, myBasicShader);
+	queueModel(colorQueue, gps::RENDER_LAYER_OPAQUE, SCENE_BENCH, myBasicShader);
+	queueModel(colorQueue, gps::RENDER_LAYER_OPAQUE, SCENE_BODY_CROW, myBasicShader);
+	queueModel(colorQueue, gps::RENDER_LAYER_OPAQUE, SCENE_WING_L, myBasicShader);
+	queueModel(colorQueue, gps::RENDER_LAYER_OPAQUE, SCENE_WING_R, myBasicShader);
+	queueModel(colorQueue, gps::RENDER_LAYER_SKY, SCENE_SKY, myBasicShader);
+	colorQueue.sort();
+	profiler.endScope();
+
+	profiler.beginScope("submitQueue");
+	colorQueue.submit();
+	profiler.endScope();
+
+	//render rain, the sky left its depth alone so drops in front of it still pass the test
 	if (rain) {
 		renderRain(myBasicShader, false);
 	}
 
-	pLightPos = glm::vec3(3.77206f, 0.789307f, 2.86863f);
-	pLightPosLoc = glGetUniformLocation(myBasicShader.shaderProgram, "pLightPosition");
-	glUniform3fv(pLightPosLoc, 1, glm::value_ptr(pLightPos));
+	passFrustum = NULL;
+	myBasicShader.setVec3("pLightPosition", pLightPos);
+	profiler.endScope();
 
+	if (rain) {
+		joinRainUpdate();
+	}
+}
+
+void addCulling(PassCulling& total, const PassCulling& frame) {
+	total.meshes.visible += frame.meshes.visible;
+	total.meshes.culled += frame.meshes.culled;
+	total.raindrops.visible += frame.raindrops.visible;
+	total.raindrops.culled += frame.raindrops.culled;
+}
+
+void printFrameStats() {
+	statsDrawCalls += gps::Mesh::drawCalls;
+	gps::Mesh::drawCalls = 0;
+	statsPointShadowFaces += pointShadowFaces;
+	pointShadowFaces = 0;
+	addCulling(statsColorCulling, colorCulling);
+	addCulling(statsShadowCulling, shadowCulling);
+	statsColorQueue.draws += colorQueue.getStats().draws;
+	statsColorQueue.shaderChanges += colorQueue.getStats().shaderChanges;
+	statsColorQueue.textureChanges += colorQueue.getStats().textureChanges;
+	statsColorQueue.transformChanges += colorQueue.getStats().transformChanges;
+	statsUniformLookups += gps::Shader::driverLookups;
+	gps::Shader::driverLookups = 0;
+	statsStateCallsIssued += gps::GLStateCache::issuedCalls;
+	gps::GLStateCache::issuedCalls = 0;
+	statsStateCallsSkipped += gps::GLStateCache::skippedCalls;
+	gps::GLStateCache::skippedCalls = 0;
+	statsFrames++;
+
+	double currentTime = glfwGetTime();
+	if (currentTime - statsStartTime >= 1.0) {
+		std::cout << "Draw calls per frame: " << statsDrawCalls / statsFrames;
+		if (rain) {
+			std::cout << " (" << raindropCount << " raindrops, " << (instancedRain ? "instanced" : "per-drop") << ")";
+		}
+		std::cout << ", uniform location lookups per frame: " << statsUniformLookups / statsFrames;
+		std::cout << ", state binds issued/skipped per frame: " << statsStateCallsIssued / statsFrames
+			<< "/" << statsStateCallsSkipped / statsFrames;
+		std::cout << ", colour queue draws/program/texture/transform changes per frame: " << statsColorQueue.draws / statsFrames
+			<< "/" << statsColorQueue.shaderChanges / statsFrames << "/" << statsColorQueue.textureChanges / statsFrames
+			<< "/" << statsColorQueue.transformChanges / statsFrames;
+		if (changeLight == 0) {
+			std::cout << ", point shadow caster faces per frame: " << statsPointShadowFaces / statsFrames;
+		}
+		if (frustumCulling) {
+			std::cout << ", visible/culled meshes per frame: colour " << statsColorCulling.meshes.visible / statsFrames
+				<< "/" << statsColorCulling.meshes.culled / statsFrames
+				<< ", shadow " << statsShadowCulling.meshes.visible / statsFrames
+				<< "/" << statsShadowCulling.meshes.culled / statsFrames;
+			if (rain) {
+				std::cout << ", visible/culled raindrops per frame: colour " << statsColorCulling.raindrops.visible / statsFrames
+					<< "/" << statsColorCulling.raindrops.culled / statsFrames
+					<< ", shadow " << statsShadowCulling.raindrops.visible / statsFrames
+					<< "/" << statsShadowCulling.raindrops.culled / statsFrames;
+			}
+		}
+		if (textureStreamer.getPendingCount() > 0 || textureStreamer.getMaxUpdateMs() > 0.0) {
+			std::cout << ", textures streaming: " << textureStreamer.getPendingCount()
+				<< " (max " << textureStreamer.getMaxUpdateMs() << " ms/frame)";
+			textureStreamer.resetStats();
+		}
+		std::cout << std::endl;
+		statsStartTime = currentTime;
+		statsFrames = 0;
+		statsDrawCalls = 0;
+		statsPointShadowFaces = 0;
+		statsColorCulling = PassCulling();
+		statsShadowCulling = PassCulling();
+		statsColorQueue = gps::RenderQueueStats();
+		statsUniformLookups = 0;
+		statsStateCallsIssued = 0;
+		statsStateCallsSkipped = 0;
+	}
 }
 
 void cleanup() {
+	if (profiler.isEnabled()) {
+		profiler.printSummary();
+		if (!profiler.writeCSV("profile.csv") || !profiler.writeChromeTrace("profile.json")) {
+			std::cerr << "WARNING: could not write profile.csv / profile.json" << std::endl;
+		}
+	}
+	profiler.release();
+	textureStreamer.release();
+	if (sceneFramebuffer) {
+		glDeleteFramebuffers(1, &sceneFramebuffer);
+	}
+	glDeleteRenderbuffers(1, &sceneColorBuffer);
+	glDeleteRenderbuffers(1, &sceneDepthBuffer);
+	glDeleteBuffers(1, &rainInstanceVBO);
 	glDeleteTextures(1, &depthMapTexture);
+	glDeleteTextures(1, &staticDepthMapTexture);
+	glDeleteFramebuffers(1, &staticShadowFBO);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	glDeleteFramebuffers(1, &shadowMapFBO);
+	glDeleteTextures(1, &depthCubemap);
+	glDeleteFramebuffers(1, &depthMapFBO);
 	myWindow.Delete();
 	//cleanup code for your own data
 }
 
+//headless benchmark of the rain simulation, compares the SIMD kernel against the scalar reference
+void benchmarkRain(int count) {
+	const int frames = 100;
+	gps::RainSystem simd;
+	gps::RainSystem scalar;
+
+	srand(1);
+	simd.init(count);
+	srand(1);
+	scalar.init(count);
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (int f = 0; f < frames; f++) {
+		simd.update(f % 2 == 0);
+	}
+	std::chrono::high_resolution_clock::time_point middle = std::chrono::high_resolution_clock::now();
+	for (int f = 0; f < frames; f++) {
+		scalar.updateScalar(0, scalar.size(), f % 2 == 0);
+	}
+	std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+	int mismatches = 0;
+	for (int i = 0; i < count; i++) {
+		if (simd.x[i] != scalar.x[i] || simd.y[i] != scalar.y[i] || simd.z[i] != scalar.z[i]) {
+			mismatches++;
+		}
+	}
+
+	double simdMs = std::chrono::duration<double, std::milli>(middle - start).count() / frames;
+	double scalarMs = std::chrono::duration<double, std::milli>(end - middle).count() / frames;
+	std::cout << "Rain benchmark: " << count << " drops, " << frames << " frames" << std::endl;
+	std::cout << "  " << gps::RainSystem::kernelName() << ": " << simdMs << " ms/frame" << std::endl;
+	std::cout << "  scalar: " << scalarMs << " ms/frame" << std::endl;
+	std::cout << "  mismatching drops: " << mismatches << std::endl;
+
+	//thread scaling on the job system, the calling thread counts as one of the threads
+	double singleThreadMs = 0.0;
+	for (int threads = 1; threads <= 16; threads *= 2) {
+		gps::JobSystem jobs(threads - 1);
+		gps::JobCounter counter;
+
+		start = std::chrono::high_resolution_clock::now();
+		for (int f = 0; f < frames; f++) {
+			jobs.parallelFor(count, RAIN_CHUNK_SIZE, [&simd](int begin, int end) {
+				simd.update(begin, end, false);
+			}, &counter);
+			jobs.wait(&counter);
+		}
+		end = std::chrono::high_resolution_clock::now();
+
+		double threadedMs = std::chrono::duration<double, std::milli>(end - start).count() / frames;
+		if (threads == 1) {
+			singleThreadMs = threadedMs;
+		}
+		std::cout << "  " << threads << " threads: " << threadedMs << " ms/frame, speedup "
+			<< singleThreadMs / threadedMs << "x" << std::endl;
+	}
+}
+
+//times the texture import loops against their scalar versions on a size x size RGBA image
+void benchmarkImageOps(int size) {
+	const int runs = 5;
+	size_t texels = (size_t)size * size;
+	std::vector<unsigned char> image(texels * 4);
+	srand(1);
+	for (size_t i = 0; i < image.size(); i++) {
+		image[i] = (unsigned char)(rand() & 0xFF);
+	}
+	std::vector<unsigned char> simd = image;
+	std::vector<unsigned char> scalar = image;
+	//builds the conversion tables outside the timed loops
+	std::vector<unsigned char> warmUp(4 * 4);
+	gps::ImageOps::downsample(image.data(), 2, 2, warmUp.data(), gps::MIP_FILTER_BOX);
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < runs; r++) {
+		gps::ImageOps::flipRows(simd.data(), size, size, 4);
+	}
+	std::chrono::high_resolution_clock::time_point middle = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < runs; r++) {
+		gps::ImageOps::flipRowsScalar(scalar.data(), size, size, 4);
+	}
+	std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+	double flipMs = std::chrono::duration<double, std::milli>(middle - start).count() / runs;
+	double flipScalarMs = std::chrono::duration<double, std::milli>(end - middle).count() / runs;
+	bool flipMatches = simd == scalar;
+
+	//RGB to RGBA against the per texel loop
+	std::vector<unsigned char> rgb(texels * 3);
+	for (size_t i = 0; i < rgb.size(); i++) {
+		rgb[i] = image[i];
+	}
+	start = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < runs; r++) {
+		gps::ImageOps::expandToRGBA(rgb.data(), 3, simd.data(), texels);
+	}
+	middle = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < runs; r++) {
+		for (size_t i = 0; i < texels; i++) {
+			scalar[i * 4 + 0] = rgb[i * 3 + 0];
+			scalar[i * 4 + 1] = rgb[i * 3 + 1];
+			scalar[i * 4 + 2] = rgb[i * 3 + 2];
+			scalar[i * 4 + 3] = 255;
+		}
+	}
+	end = std::chrono::high_resolution_clock::now();
+	double expandMs = std::chrono::duration<double, std::milli>(middle - start).count() / runs;
+	double expandScalarMs = std::chrono::duration<double, std::milli>(end - middle).count() / runs;
+	bool expandMatches = simd == scalar;
+
+	//one mip level, box and Kaiser against the scalar box
+	int mipSize = std::max(1, size / 2);
+	std::vector<unsigned char> mipSimd((size_t)mipSize * mipSize * 4);
+	std::vector<unsigned char> mipScalar(mipSimd.size());
+	start = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < runs; r++) {
+		gps::ImageOps::downsample(image.data(), size, size, mipSimd.data(), gps::MIP_FILTER_BOX);
+	}
+	middle = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < runs; r++) {
+		gps::ImageOps::downsampleScalar(image.data(), size, size, mipScalar.data());
+	}
+	end = std::chrono::high_resolution_clock::now();
+	double boxMs = std::chrono::duration<double, std::milli>(middle - start).count() / runs;
+	double boxScalarMs = std::chrono::duration<double, std::milli>(end - middle).count() / runs;
+	int boxDifference = 0;
+	for (size_t i = 0; i < mipSimd.size(); i++) {
+		boxDifference = std::max(boxDifference, std::abs(mipSimd[i] - mipScalar[i]));
+	}
+
+	start = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < runs; r++) {
+		gps::ImageOps::downsample(image.data(), size, size, mipSimd.data(), gps::MIP_FILTER_KAISER);
+	}
+	end = std::chrono::high_resolution_clock::now();
+	double kaiserMs = std::chrono::duration<double, std::milli>(end - start).count() / runs;
+
+	//every sRGB byte must come back unchanged
+	unsigned char bytes[256 * 4];
+	float linear[256 * 4];
+	for (int i = 0; i < 256 * 4; i++) {
+		bytes[i] = (unsigned char)(i / 4);
+	}
+	gps::ImageOps::srgbToLinear(bytes, linear, 256);
+	gps::ImageOps::linearToSrgb(linear, bytes, 256);
+	int roundTripErrors = 0;
+	for (int i = 0; i < 256 * 4; i++) {
+		roundTripErrors += bytes[i] != i / 4 ? 1 : 0;
+	}
+
+	std::cout << "Image benchmark: " << size << "x" << size << " RGBA, " << gps::ImageOps::kernelName() << ", " << runs << " runs" << std::endl;
+	std::cout << "  flip rows: " << flipMs << " ms, byte loop " << flipScalarMs << " ms" << (flipMatches ? "" : " (MISMATCH)") << std::endl;
+	std::cout << "  RGB to RGBA: " << expandMs << " ms, texel loop " << expandScalarMs << " ms" << (expandMatches ? "" : " (MISMATCH)") << std::endl;
+	std::cout << "  box mip: " << boxMs << " ms, scalar " << boxScalarMs << " ms, max difference " << boxDifference << std::endl;
+	std::cout << "  Kaiser mip: " << kaiserMs << " ms" << std::endl;
+	std::cout << "  sRGB round trip errors: " << roundTripErrors << std::endl;
+}
+
+// fixed scene settings of one part of the --benchmark run
+struct BenchmarkPhase {
+	const char* name;
+	bool rain;
+	int fog;
+	int changeLight;
+};
+
+void setSceneToggles(bool rainOn, int fogOn, int lightMode) {
+	if (rainOn && !rain) {
+		initRain();
+	}
+	rain = rainOn;
+	fog = fogOn;
+	changeLight = lightMode;
+
+	myBasicShader.useShaderProgram();
+	myBasicShader.setInt("fog", fog);
+	myBasicShader.setInt("changeLight", changeLight);
+}
+
+//offscreen color pass target, the default framebuffer of a hidden window has no guaranteed pixels
+void initOffscreenTarget() {
+	WindowDimensions dimensions = myWindow.getWindowDimensions();
+
+	glGenRenderbuffers(1, &sceneColorBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, sceneColorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_SRGB8_ALPHA8, dimensions.width, dimensions.height);
+	glGenRenderbuffers(1, &sceneDepthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, sceneDepthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, dimensions.width, dimensions.height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &sceneFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, sceneColorBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, sceneDepthBuffer);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "WARNING: offscreen framebuffer is incomplete, rendering to the window" << std::endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &sceneFramebuffer);
+		sceneFramebuffer = 0;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+}
+
+//nearest-rank percentile of sorted values
+double percentile(const std::vector<double>& sorted, double fraction) {
+	if (sorted.empty()) {
+		return 0.0;
+	}
+	size_t rank = (size_t)(fraction * sorted.size() + 0.999999);
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+//draws one frame from the given step of the camera tour, returns its CPU time in ms
+double renderBenchmarkFrame(int tourFrame) {
+	//one simulation step of the tour per frame, looping over the track
+	placeTourCamera(std::fmod(tourFrame * TOUR_SPEED * (float)SIMULATION_STEP, tourTrack.getLength()));
+
+	std::chrono::high_resolution_clock::time_point frameStart = std::chrono::high_resolution_clock::now();
+
+	profiler.beginFrame();
+	profiler.beginScope("renderScene");
+	renderScene();
+	profiler.endScope();
+	profiler.beginScope("swapBuffers");
+	glfwSwapBuffers(myWindow.getWindow());
+	profiler.endScope();
+	profiler.endFrame();
+	glfwPollEvents();
+
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frameStart).count();
+}
+
+//GPU time of the colour pass with each shadow filter, under the directional light the filters apply to
+void benchmarkShadowFilters(int frames, int warmupFrames, std::ofstream& report) {
+	ShadowFilter selectedFilter = shadowFilter;
+	setSceneToggles(false, 0, 1);
+
+	report << "  \"shadow_filters\": [";
+	for (int filter = 0; filter < SHADOW_FILTER_COUNT; filter++) {
+		setShadowFilter((ShadowFilter)filter);
+
+		//every filter sees the same part of the tour
+		double frameSum = 0.0;
+		for (int frame = 0; frame < warmupFrames + frames; frame++) {
+			if (frame == warmupFrames) {
+				profiler.resetStats();
+			}
+			double frameMs = renderBenchmarkFrame(frame);
+			if (frame >= warmupFrames) {
+				frameSum += frameMs;
+			}
+		}
+		glFinish();
+
+		gps::ProfileStats colorPass = {};
+		std::vector<gps::ProfileStats> stats = profiler.getStats();
+		for (size_t i = 0; i < stats.size(); i++) {
+			if (stats[i].path == "renderScene/colorPass") {
+				colorPass = stats[i];
+			}
+		}
+
+		std::cout << "Shadow filter " << shadowFilterNames[filter] << ": colour pass GPU ms avg " << colorPass.gpuAvg
+			<< ", p99 " << colorPass.gpuP99 << ", frame ms avg " << frameSum / frames << std::endl;
+
+		report << (filter > 0 ? "," : "") << "\n    { \"filter\": \"" << shadowFilterNames[filter] << "\""
+			<< ", \"taps\": " << (filter == SHADOW_FILTER_POISSON || filter == SHADOW_FILTER_PCSS ? shadowFilterTaps : 1)
+			<< ", \"color_pass_gpu_avg_ms\": " << colorPass.gpuAvg << ", \"color_pass_gpu_p99_ms\": " << colorPass.gpuP99
+			<< ", \"frame_ms_avg\": " << frameSum / frames << " }";
+	}
+	report << "\n  ],\n";
+
+	setShadowFilter(selectedFilter);
+}
+
+//replays the camera tour with rain, fog and both light modes in fixed phases and writes a JSON report
+int runBenchmark(int framesPerPhase, const std::string& reportFile) {
+	const int warmupFrames = 30;
+	//changeLight 1 is the directional light, 0 the lamp
+	const BenchmarkPhase phases[] = {
+		{ "directional", false, 0, 1 },
+		{ "point", false, 0, 0 },
+		{ "fog", false, 1, 1 },
+		{ "rain", true, 0, 1 },
+		{ "rain+fog+point", true, 1, 0 },
+	};
+	const int phaseCount = sizeof(phases) / sizeof(phases[0]);
+
+	//same drops on every run
+	srand(1);
+
+	//every texture is resident before anything is measured
+	while (textureStreamer.getPendingCount() > 0) {
+		textureStreamer.update(TEXTURE_STREAM_BUDGET);
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	updateMaterialAtlas();
+
+	int tourFrame = 0;
+
+	profiler.setEnabled(true);
+
+	std::ofstream report(reportFile.c_str());
+	if (!report) {
+		std::cerr << "ERROR: could not write " << reportFile << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	WindowDimensions dimensions = myWindow.getWindowDimensions();
+	report << "{\n  \"renderer\": \"" << glGetString(GL_RENDERER) << "\",\n";
+	report << "  \"resolution\": [" << dimensions.width << ", " << dimensions.height << "],\n";
+	report << "  \"raindrops\": " << raindropCount << ",\n";
+	report << "  \"shadow_cascades\": " << shadowCascades.getCascadeCount() << ",\n";
+	report << "  \"shadow_resolution\": " << shadowCascades.getResolution() << ",\n";
+	report << "  \"shadow_filter\": \"" << shadowFilterNames[shadowFilter] << "\",\n";
+	report << "  \"shadow_submission\": \"" << (!indirectShadows ? "per-mesh" :
+		(gps::IndirectBatch::isMultiDrawSupported() ? "multi-draw-indirect" : "indirect-fallback")) << "\",\n";
+	report << "  \"texture_compression\": \"" << gps::TextureCompressor::getName(gps::Model3D::textureCompression) << "\",\n";
+	report << "  \"material_arrays\": " << materialAtlas.getArrayCount() << ",\n";
+	report << "  \"materials\": " << materialAtlas.getMaterialCount() << ",\n";
+	report << "  \"frames_per_phase\": " << framesPerPhase << ",\n";
+
+	benchmarkShadowFilters(framesPerPhase, warmupFrames, report);
+
+	report << "  \"phases\": [";
+
+	for (int p = 0; p < phaseCount; p++) {
+		const BenchmarkPhase& phase = phases[p];
+		setSceneToggles(phase.rain, phase.fog, phase.changeLight);
+
+		std::vector<double> frameTimes;
+		std::chrono::high_resolution_clock::time_point phaseStart;
+		PassCulling phaseColorCulling;
+		PassCulling phaseShadowCulling;
+
+		for (int frame = 0; frame < warmupFrames + framesPerPhase; frame++) {
+			if (frame == warmupFrames) {
+				profiler.resetStats();
+				std::fill(shadowCacheCounts, shadowCacheCounts + gps::ShadowCascades::MAX_CASCADES, ShadowCacheCounts());
+				phaseStart = std::chrono::high_resolution_clock::now();
+			}
+
+			double frameMs = renderBenchmarkFrame(tourFrame);
+			tourFrame++;
+
+			if (frame >= warmupFrames) {
+				frameTimes.push_back(frameMs);
+				addCulling(phaseColorCulling, colorCulling);
+				addCulling(phaseShadowCulling, shadowCulling);
+			}
+		}
+
+		//the GPU must be done for the wall clock to cover the whole phase
+		glFinish();
+		double phaseMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - phaseStart).count();
+		double fps = framesPerPhase / (phaseMs / 1000.0);
+
+		std::vector<double> sorted(frameTimes);
+		std::sort(sorted.begin(), sorted.end());
+		double sum = 0.0;
+		for (size_t i = 0; i < sorted.size(); i++) {
+			sum += sorted[i];
+		}
+		double average = sorted.empty() ? 0.0 : sum / sorted.size();
+
+		std::cout << "Benchmark phase " << phase.name << ": " << fps << " fps, frame ms avg " << average
+			<< ", p50 " << percentile(sorted, 0.5) << ", p99 " << percentile(sorted, 0.99) << std::endl;
+
+		report << (p > 0 ? "," : "") << "\n    {\n";
+		report << "      \"name\": \"" << phase.name << "\",\n";
+		report << "      \"rain\": " << (phase.rain ? "true" : "false") << ", \"fog\": " << (phase.fog ? "true" : "false")
+			<< ", \"light\": \"" << (phase.changeLight ? "directional" : "point") << "\",\n";
+		report << "      \"fps\": " << fps << ",\n";
+		report << "      \"frame_ms\": { \"min\": " << (sorted.empty() ? 0.0 : sorted.front()) << ", \"avg\": " << average
+			<< ", \"p50\": " << percentile(sorted, 0.5) << ", \"p95\": " << percentile(sorted, 0.95)
+			<< ", \"p99\": " << percentile(sorted, 0.99) << ", \"max\": " << (sorted.empty() ? 0.0 : sorted.back()) << " },\n";
+		report << "      \"culling_per_frame\": { \"color_meshes\": [" << phaseColorCulling.meshes.visible / framesPerPhase
+			<< ", " << phaseColorCulling.meshes.culled / framesPerPhase << "], \"shadow_meshes\": ["
+			<< phaseShadowCulling.meshes.visible / framesPerPhase << ", " << phaseShadowCulling.meshes.culled / framesPerPhase
+			<< "], \"color_raindrops\": [" << phaseColorCulling.raindrops.visible / framesPerPhase
+			<< ", " << phaseColorCulling.raindrops.culled / framesPerPhase << "], \"shadow_raindrops\": ["
+			<< phaseShadowCulling.raindrops.visible / framesPerPhase << ", " << phaseShadowCulling.raindrops.culled / framesPerPhase << "] },\n";
+		if (shadowCache && phase.changeLight == 1) {
+			report << "      \"shadow_cache\": [";
+			for (int cascade = 0; cascade < shadowCascades.getCascadeCount(); cascade++) {
+				const ShadowCacheCounts& counts = shadowCacheCounts[cascade];
+				report << (cascade > 0 ? ", " : "") << "{ \"hits\": " << counts.hits << ", \"refills\": " << counts.refills
+					<< ", \"direct\": " << counts.direct << " }";
+			}
+			report << "],\n";
+		}
+		report << "      \"passes\": [";
+
+		std::vector<gps::ProfileStats> stats = profiler.getStats();
+		bool first = true;
+		for (size_t i = 0; i < stats.size(); i++) {
+			if (stats[i].samples == 0) {
+				continue;
+			}
+			report << (first ? "" : ",") << "\n        { \"scope\": \"" << stats[i].path << "\""
+				<< ", \"cpu_avg_ms\": " << stats[i].cpuAvg << ", \"cpu_p99_ms\": " << stats[i].cpuP99
+				<< ", \"gpu_avg_ms\": " << stats[i].gpuAvg << ", \"gpu_p99_ms\": " << stats[i].gpuP99 << " }";
+			first = false;
+		}
+		report << "\n      ]\n    }";
+	}
+
+	report << "\n  ]\n}\n";
+	std::cout << "Benchmark report written to " << reportFile << std::endl;
+
+	return report.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int main(int argc, const char* argv[]) {
 
+	gps::WindowOptions windowOptions;
+	bool benchmark = false;
+	int benchmarkFrames = 300;
+	std::string benchmarkReport = "benchmark.json";
+
+	for (int i = 1; i < argc; i++) {
+		if (std::string(argv[i]) == "--raindrops" && i + 1 < argc) {
+			raindropCount = atoi(argv[++i]);
+		}
+		else if (std::string(argv[i]) == "--no-mesh-opt") {
+			gps::Model3D::optimizeMeshes = false;
+		}
+		else if (std::string(argv[i]) == "--sync-textures") {
+			streamTextures = false;
+		}
+		else if (std::string(argv[i]) == "--texture-compression" && i + 1 < argc) {
+			//none, bc1 (BC1/BC3) or bc7; compressed mip chains are cached next to each image
+			std::string name = argv[++i];
+			gps::Model3D::textureCompression = name == "none" ? gps::TEXTURE_COMPRESSION_NONE :
+				(name == "bc7" ? gps::TEXTURE_COMPRESSION_BC7 : gps::TEXTURE_COMPRESSION_BC1_BC3);
+		}
+		else if (std::string(argv[i]) == "--no-shadow-cache") {
+			shadowCache = false;
+		}
+		else if (std::string(argv[i]) == "--cascades" && i + 1 < argc) {
+			shadowCascades.setCascadeCount(atoi(argv[++i]));
+		}
+		else if (std::string(argv[i]) == "--shadow-size" && i + 1 < argc) {
+			//side of each cascade's depth map
+			shadowCascades.setResolution(atoi(argv[++i]));
+		}
+		else if (std::string(argv[i]) == "--point-shadow-size" && i + 1 < argc) {
+			//side of each face of the lamp's shadow cubemap
+			pointShadowResolution = std::max(16, atoi(argv[++i]));
+		}
+		else if (std::string(argv[i]) == "--shadow-filter" && i + 1 < argc) {
+			std::string name = argv[++i];
+			for (int filter = 0; filter < SHADOW_FILTER_COUNT; filter++) {
+				if (name == shadowFilterNames[filter]) {
+					shadowFilter = (ShadowFilter)filter;
+				}
+			}
+		}
+		else if (std::string(argv[i]) == "--shadow-taps" && i + 1 < argc) {
+			shadowFilterTaps = std::min(16, std::max(1, atoi(argv[++i])));
+		}
+		else if (std::string(argv[i]) == "--no-culling") {
+			frustumCulling = false;
+		}
+		else if (std::string(argv[i]) == "--no-indirect") {
+			indirectShadows = false;
+		}
+		else if (std::string(argv[i]) == "--no-atlas") {
+			useMaterialAtlas = false;
+		}
+		else if (std::string(argv[i]) == "--profile") {
+			profiler.setEnabled(true);
+		}
+		else if (std::string(argv[i]) == "--benchmark") {
+			//hidden window, no vsync, optional frame count per phase
+			benchmark = true;
+			windowOptions.visible = false;
+			windowOptions.vsync = false;
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0) {
+				benchmarkFrames = atoi(argv[++i]);
+			}
+		}
+		else if (std::string(argv[i]) == "--report" && i + 1 < argc) {
+			benchmarkReport = argv[++i];
+		}
+		else if (std::string(argv[i]) == "--egl") {
+			windowOptions.egl = true;
+		}
+		else if (std::string(argv[i]) == "--mip-filter" && i + 1 < argc) {
+			//box or kaiser, for the mip chains of compressed textures
+			gps::Model3D::textureMipFilter = std::string(argv[++i]) == "kaiser" ? gps::MIP_FILTER_KAISER : gps::MIP_FILTER_BOX;
+		}
+		else if (std::string(argv[i]) == "--bench-image") {
+			int size = 4096;
+			if (i + 1 < argc) {
+				size = std::max(1, atoi(argv[++i]));
+			}
+			benchmarkImageOps(size);
+			return EXIT_SUCCESS;
+		}
+		else if (std::string(argv[i]) == "--bench-rain") {
+			int count = 1000000;
+			if (i + 1 < argc) {
+				count = atoi(argv[++i]);
+			}
+			benchmarkRain(count);
+			return EXIT_SUCCESS;
+		}
+	}
+
 	try {
-		initOpenGLWindow();
+		initOpenGLWindow(windowOptions);
 	}
 	catch (const std::exception & e) {
 		std::cerr << e.what() << std::endl;
@@ -833,19 +2143,77 @@ int main(int argc, const char* argv[]) {
 	
 	initOpenGLState();
 	initFBO();
+	geometryArena.init();
+	gps::Mesh::geometryArena = &geometryArena;
+	shadowBatch.init();
+	if (!gps::TextureCompressor::isSupported(gps::Model3D::textureCompression)) {
+		std::cerr << "WARNING: " << gps::TextureCompressor::getName(gps::Model3D::textureCompression)
+			<< " textures are not supported, loading them uncompressed" << std::endl;
+		gps::Model3D::textureCompression = gps::TEXTURE_COMPRESSION_NONE;
+	}
+	if (streamTextures) {
+		gps::Model3D::textureStreamer = &textureStreamer;
+	}
 	initModels();
+	initRainInstances();
 	initShaders();
 	initUniforms();
+
+	if (benchmark) {
+		initOffscreenTarget();
+		int result = runBenchmark(benchmarkFrames, benchmarkReport);
+		cleanup();
+		return result;
+	}
+
 	setWindowCallbacks();
 
 	glCheckError();
+	//lookups made while linking the shaders are not part of any frame
+	gps::Shader::driverLookups = 0;
+	gps::GLStateCache::issuedCalls = 0;
+	gps::GLStateCache::skippedCalls = 0;
+	statsStartTime = glfwGetTime();
+	double previousTime = glfwGetTime();
+	double accumulator = 0.0;
+	previousAnimation = captureAnimation();
 	// application loop
 	while (!glfwWindowShouldClose(myWindow.getWindow())) {
+		profiler.beginFrame();
+
+		double currentTime = glfwGetTime();
+		accumulator += std::min(currentTime - previousTime, MAX_FRAME_TIME);
+		previousTime = currentTime;
+
+		profiler.beginScope("processMovement");
 		processMovement();
+		profiler.endScope();
+
+		profiler.beginScope("simulationStep");
+		simulationSteps = 0;
+		while (accumulator >= SIMULATION_STEP) {
+			previousAnimation = captureAnimation();
+			simulationStep();
+			accumulator -= SIMULATION_STEP;
+			simulationSteps++;
+		}
+		animationAlpha = (float)(accumulator / SIMULATION_STEP);
+		profiler.endScope();
+
+		profiler.beginScope("textureStreaming");
+		textureStreamer.update(TEXTURE_STREAM_BUDGET);
+		profiler.endScope();
+
+		profiler.beginScope("renderScene");
 		renderScene();
+		profiler.endScope();
 
 		glfwPollEvents();
+		profiler.beginScope("swapBuffers");
 		glfwSwapBuffers(myWindow.getWindow());
+		profiler.endScope();
+		profiler.endFrame();
+		printFrameStats();
 
 		glCheckError();
 	}
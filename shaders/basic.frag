@@ -14,8 +14,27 @@ uniform mat3 normalMatrix;
 uniform vec3 lightDir;
 uniform vec3 lightColor;
 // textures
+#ifdef MATERIAL_ARRAYS
+//must match MaterialAtlas::MAX_ARRAYS and MaterialAtlas::MAX_MATERIALS
+#define MAX_MATERIAL_ARRAYS 6
+#define MAX_MATERIALS 64
+uniform sampler2DArray materialArrays[MAX_MATERIAL_ARRAYS];
+//diffuse array, diffuse layer, specular array, specular layer
+uniform ivec4 materials[MAX_MATERIALS];
+uniform int materialId;
+
+//a negative array means the mesh has no texture of that kind
+vec4 sampleMaterial(int array, int layer)
+{
+	if (array < 0) {
+		return vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	}
+	return texture(materialArrays[array], vec3(fTexCoords, float(layer)));
+}
+#else
 uniform sampler2D diffuseTexture;
 uniform sampler2D specularTexture;
+#endif
 
 //components
 vec3 ambient;
@@ -24,23 +43,117 @@ vec3 diffuse;
 vec3 specular;
 float specularStrength = 0.5f;
 
-//shadows
-in vec4 fragPosLightSpace;
-uniform sampler2D shadowMap;
+//shadows - cascaded shadow map, one layer per slice of the view frustum
+//the filter is picked when the program is built: SHADOW_FILTER_HARDWARE, SHADOW_FILTER_POISSON,
+//SHADOW_FILTER_PCSS, or one nearest sample when none is defined
+#define MAX_CASCADES 4
+#if defined(SHADOW_FILTER_HARDWARE) || defined(SHADOW_FILTER_POISSON)
+//compare mode is on, each lookup returns the lit fraction of the 2x2 texels around it
+uniform sampler2DArrayShadow shadowMap;
+#else
+uniform sampler2DArray shadowMap;
+#endif
+uniform mat4 cascadeMatrices[MAX_CASCADES];
+//view-space depth where each cascade ends
+uniform float cascadeSplits[MAX_CASCADES];
+uniform float cascadeBias[MAX_CASCADES];
+uniform int cascadeCount;
+
+#if defined(SHADOW_FILTER_POISSON) || defined(SHADOW_FILTER_PCSS)
+#ifndef POISSON_TAPS
+#define POISSON_TAPS 16
+#endif
+const vec2 poissonDisk[16] = vec2[](
+	vec2(-0.94201624f, -0.39906216f), vec2(0.94558609f, -0.76890725f),
+	vec2(-0.09418410f, -0.92938870f), vec2(0.34495938f, 0.29387760f),
+	vec2(-0.91588581f, 0.45771432f), vec2(-0.81544232f, -0.87912464f),
+	vec2(-0.38277543f, 0.27676845f), vec2(0.97484398f, 0.75648379f),
+	vec2(0.44323325f, -0.97511554f), vec2(0.53742981f, -0.47373420f),
+	vec2(-0.26496911f, -0.41893023f), vec2(0.79197514f, 0.19090188f),
+	vec2(-0.24188840f, 0.99706507f), vec2(-0.81409955f, 0.91437590f),
+	vec2(0.19984126f, 0.78641367f), vec2(0.14383161f, -0.14100790f));
+//disk radius of the fixed size filter, in texels
+const float POISSON_RADIUS = 1.5f;
+#endif
+
+#ifdef SHADOW_FILTER_PCSS
+//tangent of the angle the sun covers, sets how fast penumbrae widen away from the caster
+const float LIGHT_SIZE = 0.03f;
+//blocker search and penumbra radius limits, in texels
+const float PCSS_MIN_RADIUS = 1.0f;
+const float PCSS_MAX_RADIUS = 16.0f;
+uniform float cascadeDepthToUV[MAX_CASCADES];
+#endif
+
+//1 when coords (shadow map UV and depth) is in shadow, fractions on filtered edges
+float sampleShadow(vec3 coords, int cascade, float bias)
+{
+	float receiverDepth = coords.z - bias;
+#if defined(SHADOW_FILTER_HARDWARE)
+	return 1.0f - texture(shadowMap, vec4(coords.xy, cascade, receiverDepth));
+#elif defined(SHADOW_FILTER_POISSON)
+	vec2 texelSize = 1.0f / vec2(textureSize(shadowMap, 0).xy);
+	float lit = 0.0f;
+	for (int i = 0; i < POISSON_TAPS; i++)
+		lit += texture(shadowMap, vec4(coords.xy + poissonDisk[i] * POISSON_RADIUS * texelSize, cascade, receiverDepth));
+	return 1.0f - lit / float(POISSON_TAPS);
+#elif defined(SHADOW_FILTER_PCSS)
+	vec2 texelSize = 1.0f / vec2(textureSize(shadowMap, 0).xy);
+	float minRadius = PCSS_MIN_RADIUS * texelSize.x;
+	float maxRadius = PCSS_MAX_RADIUS * texelSize.x;
+
+	//blocker search, the region that can hold casters of this receiver grows with its depth
+	float searchRadius = clamp(coords.z * cascadeDepthToUV[cascade] * LIGHT_SIZE, minRadius, maxRadius);
+	float blockerSum = 0.0f;
+	int blockerCount = 0;
+	for (int i = 0; i < POISSON_TAPS; i++) {
+		float depth = texture(shadowMap, vec3(coords.xy + poissonDisk[i] * searchRadius, cascade)).r;
+		if (depth < receiverDepth) {
+			blockerSum += depth;
+			blockerCount++;
+		}
+	}
+	if (blockerCount == 0)
+		return 0.0f;
+
+	//penumbra width from the receiver to blocker distance, then a PCF of that width
+	float blockerDepth = blockerSum / float(blockerCount);
+	float filterRadius = clamp((receiverDepth - blockerDepth) * cascadeDepthToUV[cascade] * LIGHT_SIZE, minRadius, maxRadius);
+	float shadow = 0.0f;
+	for (int i = 0; i < POISSON_TAPS; i++) {
+		float depth = texture(shadowMap, vec3(coords.xy + poissonDisk[i] * filterRadius, cascade)).r;
+		shadow += receiverDepth > depth ? 1.0f : 0.0f;
+	}
+	return shadow / float(POISSON_TAPS);
+#else
+	float closestDepth = texture(shadowMap, vec3(coords.xy, cascade)).r;
+	return receiverDepth > closestDepth ? 1.0f : 0.0f;
+#endif
+}
 
 float computeShadow()
 {
+	vec4 fPosEye = view * model * vec4(fPosition, 1.0f);
+	float viewDepth = -fPosEye.z;
+	if (viewDepth > cascadeSplits[cascadeCount - 1])
+		return 0.0f;
+
+	int cascade = 0;
+	while (cascade < cascadeCount - 1 && viewDepth > cascadeSplits[cascade])
+		cascade++;
 
+	vec4 fragPosLightSpace = cascadeMatrices[cascade] * model * vec4(fPosition, 1.0f);
 	vec3 normalizedCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
 	normalizedCoords = normalizedCoords * 0.5 + 0.5;
 	if (normalizedCoords.z > 1.0f)
 		return 0.0f;
-	float closestDepth = texture(shadowMap, normalizedCoords.xy).r;
-	float currentDepth = normalizedCoords.z;
-	float bias = max(0.05f * (1.0f - dot(normalizedCoords, lightDir)), 0.005f);
-	float shadow = currentDepth - bias > closestDepth ? 1.0 : 0.0;
 
-	return shadow;
+	//surfaces turned away from the light need a larger offset
+	vec3 normalEye = normalize(normalMatrix * fNormal);
+	vec3 lightDirN = normalize(vec3(view * vec4(lightDir, 0.0f)));
+	float bias = cascadeBias[cascade] * (1.0f + 4.0f * (1.0f - max(dot(normalEye, lightDirN), 0.0f)));
+
+	return sampleShadow(normalizedCoords, cascade, bias);
 
 }
 
@@ -69,6 +182,22 @@ void computeDirLight()
 }
 
 uniform vec3 pLightPosition;
+
+//shadows - point light, distance to the nearest caster around the lamp
+uniform samplerCube pointShadowMap;
+uniform float pointShadowFar;
+
+float computePointShadow()
+{
+	//the shadow cubemap is in world space, around the bulb
+	vec3 lightToFragment = vec3(model * vec4(fPosition, 1.0f)) - pLightPosition;
+	float currentDepth = length(lightToFragment);
+	if (currentDepth > pointShadowFar)
+		return 0.0f;
+	float closestDepth = texture(pointShadowMap, lightToFragment).r * pointShadowFar;
+	float bias = 0.05f;
+	return currentDepth - bias > closestDepth ? 1.0 : 0.0;
+}
     
 float constant = 1.0f;
 float linear = 0.0045f;
@@ -80,7 +209,8 @@ float shininess = 32.0f;
 void computePointLight()
 {		
 	vec4 fPosEye = view * model * vec4(fPosition, 1.0f);
-	vec4 lightPosEye = view * model * vec4(pLightPosition, 1.0f);
+	//the bulb is in world space, the same position the shadow cubemap is drawn around
+	vec4 lightPosEye = view * vec4(pLightPosition, 1.0f);
 	
 	vec3 cameraPosEye = vec3(0.0f);//in eye coordinates, the viewer is situated at the origin
 
@@ -132,15 +262,23 @@ void main()
 		computePointLight();
 	}
 
-	float shadow = computeShadow();
+	float shadow = changeLight == 1 ? computeShadow() : computePointShadow();
 
 	//compute fog
 	float fogFactor = computeFog();
     vec4 fogColor = vec4(0.5f, 0.5f, 0.5f, 1.0f);
 
-	ambient *= texture(diffuseTexture, fTexCoords);
-	diffuse *= texture(diffuseTexture, fTexCoords);
-	specular *= texture(specularTexture, fTexCoords);
+#ifdef MATERIAL_ARRAYS
+	ivec4 material = materials[materialId];
+	vec3 diffuseColor = sampleMaterial(material.x, material.y).rgb;
+	vec3 specularColor = sampleMaterial(material.z, material.w).rgb;
+#else
+	vec3 diffuseColor = texture(diffuseTexture, fTexCoords).rgb;
+	vec3 specularColor = texture(specularTexture, fTexCoords).rgb;
+#endif
+	ambient *= diffuseColor;
+	diffuse *= diffuseColor;
+	specular *= specularColor;
 
     //compute final vertex color
 	vec3 color = min((ambient + (1.0f - shadow)*diffuse) + (1.0f - shadow)*specular, 1.0f);
@@ -13,9 +13,6 @@ uniform mat4 view;
 uniform mat4 projection;
 uniform vec3 pLightPosition;
 
-out vec4 fragPosLightSpace;
-uniform mat4 lightSpaceTrMatrix;
-
 uniform int changeLight; //true - directional; false - point
 uniform int fog; 
 
@@ -25,6 +22,4 @@ void main()
 	fPosition = vPosition;
 	fNormal = vNormal;
 	fTexCoords = vTexCoords;
-
-	fragPosLightSpace = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
 }
@@ -0,0 +1,30 @@
+#version 410 core
+
+layout(location=0) in vec3 vPosition;
+layout(location=1) in vec3 vNormal;
+layout(location=2) in vec2 vTexCoords;
+//per-instance model matrix (occupies locations 3-6)
+layout(location=3) in mat4 instanceModel;
+
+out vec3 fPosition;
+out vec3 fNormal;
+out vec2 fTexCoords;
+
+//kept at identity for instanced draws, basic.frag still multiplies by it
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 pLightPosition;
+
+uniform int changeLight; //true - directional; false - point
+uniform int fog; 
+
+void main() 
+{
+	vec4 worldPosition = instanceModel * vec4(vPosition, 1.0f);
+	gl_Position = projection * view * model * worldPosition;
+	//the fragment shader works with model-space positions, so hand it the world position
+	fPosition = worldPosition.xyz;
+	fNormal = vNormal;
+	fTexCoords = vTexCoords;
+}
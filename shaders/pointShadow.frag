@@ -0,0 +1,12 @@
+#version 410 core
+
+in vec4 fragPosition;
+
+uniform vec3 lightPosition;
+uniform float farPlane;
+
+void main()
+{
+	//linear distance to the light, so the lookup does not need the face projection
+	gl_FragDepth = length(fragPosition.xyz - lightPosition) / farPlane;
+}
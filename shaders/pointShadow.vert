@@ -0,0 +1,11 @@
+#version 410 core
+
+layout(location=0) in vec3 vPosition;
+
+uniform mat4 model;
+
+void main()
+{
+	//the geometry shader projects into each cube face
+	gl_Position = model * vec4(vPosition, 1.0f);
+}
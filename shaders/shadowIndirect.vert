@@ -0,0 +1,18 @@
+#version 410 core
+
+layout(location=0) in vec3 vPosition;
+//index of the draw's transform: the base instance with multi draw indirect, 0 plus drawBase otherwise
+layout(location=7) in uint drawIndex;
+
+uniform mat4 lightSpaceTrMatrix;
+//model matrices, one RGBA32F texel per column
+uniform samplerBuffer drawTransforms;
+uniform int drawBase;
+
+void main()
+{
+	int texel = (int(drawIndex) + drawBase) * 4;
+	mat4 model = mat4(texelFetch(drawTransforms, texel), texelFetch(drawTransforms, texel + 1),
+		texelFetch(drawTransforms, texel + 2), texelFetch(drawTransforms, texel + 3));
+	gl_Position = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+}